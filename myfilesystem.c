@@ -1,26 +1,505 @@
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
-#include <math.h>
 #include <pthread.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 
 #include "myfilesystem.h"
 
+// builds with FS_COUNT_ALLOCATIONS count every heap allocation made by the file system,
+// so tests can check that reads, writes and verification do not allocate
+#ifdef FS_COUNT_ALLOCATIONS
+static size_t allocation_count = 0;
+
+static void * counted_malloc(size_t size){
+	__atomic_fetch_add(&allocation_count, 1, __ATOMIC_RELAXED);
+	return malloc(size);
+}
+
+static void * counted_calloc(size_t count, size_t size){
+	__atomic_fetch_add(&allocation_count, 1, __ATOMIC_RELAXED);
+	return calloc(count, size);
+}
+
+static void * counted_realloc(void * pointer, size_t size){
+	__atomic_fetch_add(&allocation_count, 1, __ATOMIC_RELAXED);
+	return realloc(pointer, size);
+}
+
+// returns the number of heap allocations made so far
+size_t fs_allocation_count(void){
+	return __atomic_load_n(&allocation_count, __ATOMIC_RELAXED);
+}
+
+#define malloc(size) counted_malloc(size)
+#define calloc(count, size) counted_calloc(count, size)
+#define realloc(pointer, size) counted_realloc(pointer, size)
+#endif
+
+// builds with FS_TRACE_SPANS record when each thread enters and leaves the phases of a call marked with
+// SPAN_BEGIN and SPAN_END, in other builds the marks compile to nothing
+// every thread keeps its latest SPAN_RING_SIZE events in its own ring, so recording takes no lock,
+// and fs_dump_spans writes the rings of every thread as Chrome trace-event JSON, leaving out what earlier dumps wrote
+#ifdef FS_TRACE_SPANS
+#define SPAN_RING_SIZE 16384
+
+// define an event in a span ring, phase is 'B' when a span begins and 'E' when it ends
+typedef struct span_event{
+	const char * name;
+	uint64_t time; // nanoseconds
+	char phase;
+} span_event;
+
+// define the ring of one thread, only that thread records to it
+// rings are kept after their thread exits so its spans can still be dumped, and taken over by a new thread
+typedef struct span_ring{
+	span_event events[SPAN_RING_SIZE];
+	uint64_t head; // number of events recorded, the latest at (head - 1) % SPAN_RING_SIZE
+	uint64_t dumped; // number of events recorded before the last dump, which later dumps leave out
+	int thread_id;
+	int in_use;
+	struct span_ring * next;
+} span_ring;
+
+static span_ring * span_rings = NULL;
+static int span_thread_count = 0;
+static pthread_key_t span_key;
+static pthread_once_t span_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t span_dump_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// frees the ring of an exiting thread for the next thread to take
+static void release_span_ring(void * arg){
+	span_ring * ring = arg;
+	__atomic_store_n(&ring->in_use, 0, __ATOMIC_RELEASE);
+}
+
+static void init_span_key(void){
+	pthread_key_create(&span_key, release_span_ring);
+}
+
+// helper function to get the span ring of the calling thread, taking a free ring or making one the first time
+// returns NULL if no ring could be made (malloc error)
+static span_ring * thread_span_ring(void){
+	
+	pthread_once(&span_once, init_span_key);
+	span_ring * ring = pthread_getspecific(span_key);
+	if (ring != NULL){
+		return ring;
+	}
+	
+	for (ring = __atomic_load_n(&span_rings, __ATOMIC_ACQUIRE); ring != NULL; ring = ring->next){
+		int free_ring = 0;
+		if (__atomic_compare_exchange_n(&ring->in_use, &free_ring, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)){
+			break;
+		}
+	}
+	if (ring == NULL){
+		ring = calloc(1, sizeof(span_ring));
+		if (ring == NULL){ // malloc error
+			return NULL;
+		}
+		ring->in_use = 1;
+		ring->thread_id = __atomic_add_fetch(&span_thread_count, 1, __ATOMIC_RELAXED);
+		ring->next = __atomic_load_n(&span_rings, __ATOMIC_RELAXED);
+		while (!__atomic_compare_exchange_n(&span_rings, &ring->next, ring, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+	}
+	pthread_setspecific(span_key, ring);
+	return ring;
+}
+
+// helper function to record an event in the ring of the calling thread
+static void span_record(const char * name, char phase){
+	
+	span_ring * ring = thread_span_ring();
+	if (ring == NULL){
+		return;
+	}
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	
+	// the slot is written after the count of events before it, so fs_dump_spans can tell when it reads an overwritten slot
+	uint64_t head = ring->head;
+	span_event * event = &ring->events[head % SPAN_RING_SIZE];
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	__atomic_store_n(&event->name, name, __ATOMIC_RELAXED);
+	__atomic_store_n(&event->time, (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec, __ATOMIC_RELAXED);
+	__atomic_store_n(&event->phase, phase, __ATOMIC_RELAXED);
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+// helper function to copy the events of a ring recorded since the last dump and at or after since into events
+// events being overwritten while they are read are left out, and the ring counts them all as dumped
+// returns the number of events copied
+static int span_ring_take(span_ring * ring, uint64_t since, span_event * events){
+	
+	int count = 0;
+	uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	uint64_t start = (head > SPAN_RING_SIZE) ? head - SPAN_RING_SIZE : 0;
+	for (uint64_t i = (ring->dumped > start) ? ring->dumped : start; i < head; i++){
+		span_event * event = &ring->events[i % SPAN_RING_SIZE];
+		span_event copy;
+		copy.name = __atomic_load_n(&event->name, __ATOMIC_RELAXED);
+		copy.time = __atomic_load_n(&event->time, __ATOMIC_RELAXED);
+		copy.phase = __atomic_load_n(&event->phase, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (i + SPAN_RING_SIZE <= __atomic_load_n(&ring->head, __ATOMIC_RELAXED) || copy.time < since){
+			continue;
+		}
+		events[count++] = copy;
+	}
+	ring->dumped = head;
+	return count;
+}
+
+// helper function to keep only the events of one thread that make up whole spans
+// a thread's spans nest, so an end closes the latest open begin of the same name, and ends without one
+// (their begin was overwritten or recorded before since) and begins still open are dropped
+// returns the number of events kept, which stay in order at the start of events
+static int span_pairs(span_event * events, int count, int * open){
+	
+	int number_open = 0;
+	for (int i = 0; i < count; i++){
+		if (events[i].phase == 'B'){
+			open[number_open++] = i;
+		}
+		else if (number_open > 0 && strcmp(events[open[number_open - 1]].name, events[i].name) == 0){
+			number_open--;
+		}
+		else{
+			events[i].name = NULL;
+		}
+	}
+	for (int i = 0; i < number_open; i++){
+		events[open[i]].name = NULL;
+	}
+	
+	int kept = 0;
+	for (int i = 0; i < count; i++){
+		if (events[i].name != NULL){
+			events[kept++] = events[i];
+		}
+	}
+	return kept;
+}
+
+// helper function to write the whole spans recorded by every thread at or after since (nanoseconds) to path
+// as Chrome trace-event JSON, leaving out events an earlier dump wrote
+// returns 0 if successful, returns 1 if path cannot be written (or malloc error)
+static int dump_spans_since(char * path, uint64_t since){
+	
+	span_event * events = malloc(SPAN_RING_SIZE * sizeof(span_event));
+	int * open = malloc(SPAN_RING_SIZE * sizeof(int));
+	FILE * output = (events != NULL && open != NULL) ? fopen(path, "w") : NULL;
+	if (output == NULL){
+		free(events);
+		free(open);
+		return 1;
+	}
+	
+	pthread_mutex_lock(&span_dump_lock);
+	fprintf(output, "{\"traceEvents\":[");
+	int first = 1;
+	for (span_ring * ring = __atomic_load_n(&span_rings, __ATOMIC_ACQUIRE); ring != NULL; ring = ring->next){
+		int count = span_pairs(events, span_ring_take(ring, since, events), open);
+		for (int i = 0; i < count; i++){
+			fprintf(output, "%s\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d}", first ? "" : ",", events[i].name, events[i].phase, events[i].time / 1000.0, (int) getpid(), ring->thread_id);
+			first = 0;
+		}
+	}
+	fprintf(output, "\n]}\n");
+	pthread_mutex_unlock(&span_dump_lock);
+	
+	fclose(output);
+	free(events);
+	free(open);
+	return 0;
+}
+
+// function to write the spans recorded by every thread since the last dump to path as Chrome trace-event JSON,
+// for chrome://tracing or Perfetto, only spans with both their begin and end recorded are written
+// returns 0 if successful, returns 1 if path cannot be written
+int fs_dump_spans(char * path){
+	return dump_spans_since(path, 0);
+}
+
+#define SPAN_BEGIN(name) span_record(name, 'B')
+#define SPAN_END(name) span_record(name, 'E')
+#else
+#define SPAN_BEGIN(name) ((void) 0)
+#define SPAN_END(name) ((void) 0)
+#endif
+
 // helper function to truncate filenames
-static void truncate(char * filename){
+static void truncate_filename(char * filename){
 	if (strlen(filename) > 63)
 		filename[63] = '\0';
 }
 
+// smallest and largest supported hash tree block sizes
+#define MIN_BLOCK_SIZE 256
+#define MAX_BLOCK_SIZE 65536
+
+// directory_table entries starting with VOLUME_RECORD_MAGIC hold volume parameters rather than a file
+// layout of the 72 byte record: magic (8 bytes), version (4 bytes), block size (4 bytes),
+// hash algorithm (4 bytes), features (4 bytes), rest reserved
+// volumes without a volume record use the original format (256 byte blocks hashed with fletcher)
+#define VOLUME_RECORD_MAGIC "\x01MYFSVOL"
+#define VOLUME_RECORD_VERSION 1
+
+// directory_table entries starting with EXTENT_RECORD_MARKER hold an extra extent of a file
+// layout of the 72 byte record: marker (1 byte), flags (1 byte), reserved (2 bytes),
+// file_index of the file's own entry (4 bytes), position in the file's extent list (4 bytes),
+// stored length of compressed extents (4 bytes at 12), reserved up to offset (4 bytes at 64)
+// and length (4 bytes at 68) as in a file entry
+// the file's own entry holds its first extent, its offset and its total length
+#define EXTENT_RECORD_MARKER 0x02
+
+// helper function to check if a filename can not be given to a file, as its entry would not be read back as one
+// entries starting with a null byte are free, and volume and extent records start with their own first bytes
+// returns 1 if it can not, returns 0 otherwise
+static int reserved_filename(char * filename){
+	return filename[0] == '\0' || filename[0] == VOLUME_RECORD_MAGIC[0] || filename[0] == EXTENT_RECORD_MARKER;
+}
+
+// traces start with TRACE_MAGIC, followed by TRACE_RECORD_SIZE byte records, all little endian:
+// operation (1 byte), reserved (3 bytes), name id (4 bytes), second name id, handle or snapshot id (4 bytes),
+// result (4 bytes), offset (8 bytes), count (8 bytes), start in nanoseconds since the trace began (8 bytes)
+// and duration in nanoseconds (8 bytes)
+// a TRACE_NAME record gives the name with its name id, count is its length and the name follows the record
+// name ids count up from 1, 0 is no name
+#define TRACE_MAGIC "MYFSTRC1"
+#define TRACE_RECORD_SIZE 48
+
+// operations in traces
+#define TRACE_NAME 0
+#define TRACE_CREATE_FILE 1
+#define TRACE_RESIZE_FILE 2
+#define TRACE_REPACK 3
+#define TRACE_DELETE_FILE 4
+#define TRACE_RENAME_FILE 5
+#define TRACE_CLONE_FILE 6
+#define TRACE_DEDUPLICATE 7
+#define TRACE_READ_FILE 8
+#define TRACE_WRITE_FILE 9
+#define TRACE_IMPORT_FILE 10
+#define TRACE_EXPORT_FILE 11
+#define TRACE_FILE_SIZE 12
+#define TRACE_LIST_FILES 13
+#define TRACE_FS_OPEN 14
+#define TRACE_FS_READ 15
+#define TRACE_FS_WRITE 16
+#define TRACE_FS_SIZE 17
+#define TRACE_FS_CLOSE_HANDLE 18
+#define TRACE_CREATE_SNAPSHOT 19
+#define TRACE_DELETE_SNAPSHOT 20
+#define TRACE_READ_SNAPSHOT_FILE 21
+#define TRACE_SNAPSHOT_FILE_SIZE 22
+#define TRACE_COMPUTE_HASH_TREE 23
+#define TRACE_COMPUTE_HASH_BLOCK 24
+#define TRACE_SYNC_FS 25
+#define TRACE_SCRUB_FS 26
+#define TRACE_SCRUB_CORRUPT_BLOCKS 27
+#define TRACE_SCRUB_AGE 28
+#define TRACE_FS_ADVISE 29
+
+#ifdef FS_TRACE_SPANS
+// names of the operations, for the span of each call
+static const char * trace_operation_names[] = {
+	"name", "create_file", "resize_file", "repack", "delete_file", "rename_file", "clone_file", "deduplicate",
+	"read_file", "write_file", "import_file", "export_file", "file_size", "list_files", "fs_open", "fs_read",
+	"fs_write", "fs_size", "fs_close_handle", "create_snapshot", "delete_snapshot", "read_snapshot_file",
+	"snapshot_file_size", "compute_hash_tree", "compute_hash_block", "sync_fs", "scrub_fs",
+	"scrub_corrupt_blocks", "scrub_age", "fs_advise"
+};
+#endif
+
+// extent flags, stored in the flags byte of extent records
+// the first extent of a file is held by the file's own entry, which has no flags
+#define EXTENT_UNWRITTEN 0x01 // range reads as zeros, file_data has not been written
+#define EXTENT_COMPRESSED 0x02 // file_data holds stored_length bytes which decompress to at least length bytes
+#define EXTENT_FILLED 0x80 // only passed to append_file_range, the caller writes the range itself so it is not zero filled
+
+// bytes of a file compressed together in volumes with FS_FEATURE_COMPRESSION
+// compressed extents start at a multiple of it within the file and are never longer
+#define COMPRESSION_CHUNK_SIZE 16384
+
+// number of tree levels packed into one page sized group in the blocked hash tree layout
+// (2^8 - 1 nodes of 16 bytes plus one slot of padding is 4 KiB)
+#define PAGE_GROUP_LEVELS 8
+#define MAX_PAGE_GROUP_LAYERS 8
+
+// function used to hash a single leaf block of file_data
+typedef void (* hash_leaf_function)(uint8_t * buf, size_t length, uint8_t * output);
+
+// hash provider used for every node of the hash tree, selected per volume
+typedef struct hash_provider{
+	int id;
+	void (* hash)(uint8_t * buf, size_t length, uint8_t * output); // hashes any buffer to 16 bytes
+	hash_leaf_function (* select_leaf)(size_t block_size); // leaf hashing function for a block size
+} hash_provider;
+
+// define a contiguous range of file_data holding part of a file
+// file_index is the directory_table entry recording the range
+// length is the number of bytes of the file, stored_length is the number of bytes of file_data for compressed extents
+typedef struct extent{
+	int offset;
+	int length;
+	int file_index;
+	int flags;
+	int stored_length;
+} extent;
+
+// define a run of bytes written to a file but not yet to file_data
+typedef struct write_back_run{
+	size_t offset;
+	size_t length;
+	size_t capacity;
+	uint8_t * data;
+	struct write_back_run * next;
+} write_back_run;
+
+// define the writes held back for a file, in runs sorted by offset that never overlap or touch
+typedef struct write_back{
+	write_back_run * runs;
+	size_t bytes; // bytes held in runs
+	size_t length; // length of the file once the runs are written
+	size_t reserved; // bytes of write_back_growth kept free for resizing the file to length
+	long since; // time of the first held write in milliseconds
+} write_back;
+
 // define node for offset sorted list
+// offset is the offset of the first extent and length is the total length of the file
+// filename is kept in the name arena and shared with the file's copies in snapshots
+// write_back holds writes not yet in file_data, or is NULL
 typedef struct offset_node{
     int offset;
 	int length;
 	int file_index;
-	char filename[64];
+	char * filename;
+	int number_of_extents;
+	int extent_capacity;
+	extent * extents;
+	write_back * write_back;
     struct offset_node * next;
 } offset_node;
 
+// file nodes are taken from slabs of NODE_SLAB_SIZE nodes owned by the helper node
+// freed nodes go on a free list and keep their extent array for the next file to use
+#define NODE_SLAB_SIZE 64
+
+// define a slab of file nodes
+typedef struct node_slab{
+	struct node_slab * next;
+	offset_node nodes[NODE_SLAB_SIZE];
+} node_slab;
+
+// define a read-only copy of every file taken by create_snapshot
+// files holds copies of the file nodes whose extents keep their file_data referenced
+typedef struct snapshot{
+	int id;
+	offset_node * files;
+	struct snapshot * next;
+} snapshot;
+
+// filenames are kept in blocks of NAME_BLOCK_SIZE bytes instead of inline in each file node
+// each name takes a slot of a multiple of 8 bytes, a 4 byte reference count then the name,
+// and freed slots are reused for names that need the same slot size
+#define NAME_BLOCK_SIZE 4096
+#define NAME_SLOT_SIZES 9 // 8 to 72 bytes, enough for 63 characters
+
+// define a block of the name arena
+typedef struct name_block{
+	struct name_block * next;
+	int used;
+	char data[NAME_BLOCK_SIZE];
+} name_block;
+
+// define a handle returned by fs_open, file is NULL once the file is deleted
+// in shared mounts generation is the entry generation of the file's directory_table entry when it was opened
+typedef struct open_handle{
+	offset_node * file;
+	int open;
+	uint32_t generation;
+} open_handle;
+
+// define a used range of file_data and the number of extents referencing it
+typedef struct space_extent{
+	int offset;
+	int length;
+	int references;
+} space_extent;
+
+// define the start of the sidecar of a volume opened with shared_mount
+typedef struct shared_mount_header{
+	uint64_t magic;
+	pthread_mutex_t lock; // process-shared and robust, taken by io_begin after the list lock
+	uint64_t generation; // moved on by every call that may have changed the volume, other processes drop what they buffered of it
+	uint64_t metadata_generation; // moved on by every call that wrote directory_table, other processes load their file lists again
+	long tree_slots;
+	int tree_layout;
+} shared_mount_header;
+
+// volumes opened with direct_io read and write file_data and hash_data with O_DIRECT,
+// through DIRECT_IO_BUFFER_SIZE byte buffers aligned to DIRECT_IO_ALIGNMENT, of which DIRECT_IO_POOL_SIZE are kept for reuse
+#define DIRECT_IO_ALIGNMENT 4096
+#define DIRECT_IO_BUFFER_SIZE (64 * 1024)
+#define DIRECT_IO_POOL_SIZE 4
+
+// define a file opened with O_DIRECT as well as through stdio
+typedef struct direct_file{
+	int fd; // opened with O_DIRECT, -1 if the file is only used through stdio
+	int buffered_fd; // the stdio stream's, for bytes past aligned_size
+	size_t aligned_size; // bytes of the file up to its last aligned boundary when it was opened
+} direct_file;
+
+// volumes opened with a read_ahead_size follow up to READ_AHEAD_STREAMS files being read front to back,
+// a file becomes a stream after READ_AHEAD_TRIGGER reads in a row each start where the last one ended,
+// or when fs_advise says it will be read sequentially
+#define READ_AHEAD_STREAMS 8
+#define READ_AHEAD_TRIGGER 2
+
+// define a range of a file read ahead and checked against the hash tree, held in memory
+// the window is only used while changes is the volume's, so no call has changed the volume since it was read
+typedef struct read_ahead_window{
+	uint8_t * data; // read_ahead_size bytes, allocated when the window is first filled
+	size_t offset;
+	size_t length; // 0 if the window holds nothing
+	uint64_t changes;
+} read_ahead_window;
+
+// define the reads of a file followed for read-ahead
+// reads are served from current, and next is filled by the read-ahead thread with the range after it
+typedef struct read_ahead_stream{
+	char name[64]; // empty if the stream is not in use
+	int advice; // one of the FS_ADVICE_ values
+	size_t next_offset; // where a read continuing the last one starts
+	int sequential; // reads in a row that continued the last one
+	uint64_t last_used;
+	read_ahead_window current;
+	read_ahead_window next;
+	int prefetch; // set while the read-ahead thread has to fill next with [prefetch_offset, prefetch_offset + prefetch_length)
+	size_t prefetch_offset;
+	size_t prefetch_length;
+} read_ahead_stream;
+
+// define a name written to a trace and the id records refer to it by
+typedef struct trace_name{
+	char name[64];
+	uint32_t id;
+} trace_name;
+
+// classes of calls taking the list lock, in the order the io scheduler hands it out
+#define IO_FOREGROUND_READ 0
+#define IO_FOREGROUND_WRITE 1
+#define IO_BACKGROUND 2 // repacking, whole tree hashing, deduplication and scrubbing
+#define IO_CLASSES 3
+
 // define helper node which points to headers for offset sorted list, hash tree within virtual memory, three FILEs and data about file system
 typedef struct helper_node{
 	offset_node * offset_node;
@@ -29,1129 +508,6745 @@ typedef struct helper_node{
 	int number_of_blocks;
 	int max_depth;
 	
+	// in-memory layout of hash_tree, hash_data is always breadth-first
+	int tree_layout;
+	long tree_slots;
+	int layer_offset;
+	long layer_base[MAX_PAGE_GROUP_LAYERS];
+	int layer_start[MAX_PAGE_GROUP_LAYERS];
+	int layer_height[MAX_PAGE_GROUP_LAYERS];
+	
+	// tree geometry, computed once by init_fs
+	size_t block_size;
+	int block_shift;
+	int leaf_start;
+	const hash_provider * hash_provider;
+	hash_leaf_function hash_leaf;
+	int volume_record_index;
+	int features;
+	
+	// used ranges of file_data sorted by offset, free space is every gap between them
+	space_extent * space_map;
+	int space_count;
+	int space_capacity;
+	
+	// ranges of file_data in unwritten extents, sorted by offset and read as zeros when hashing
+	// worked out again from the extents whenever the whole hash tree is rebuilt
+	extent * unwritten_map;
+	int unwritten_count;
+	
+	// hash of a zero filled subtree for each depth of the hash tree, zero_hash[max_depth] is a zero block
+	uint8_t zero_hash[32][16];
+	
+	// name arena holding every filename, with a list of free slots for each slot size
+	name_block * name_blocks;
+	char * free_names[NAME_SLOT_SIZES];
+	
+	// slabs holding every file node, and the nodes not in use
+	node_slab * node_slabs;
+	offset_node * free_nodes;
+	
+	// every file sorted by filename, for lookups and listing
+	offset_node ** name_index;
+	int name_count;
+	int name_capacity;
+	
+	// small writes held back from file_data, flushed per file once write_back_size bytes are held
+	// or write_back_delay milliseconds have passed, and before any call that needs them in file_data
+	size_t write_back_size;
+	int write_back_delay;
+	int write_back_files; // files with held writes
+	size_t write_back_growth; // bytes kept free for the files with held writes to grow once flushed
+	long write_back_oldest; // time of the oldest held write
+	
+	// threads used to move file_data when repacking
+	int n_processors;
+	
+	// files opened with fs_open, a handle is an index into handles
+	// handles follow their file to a new node when resizing moves it
+	open_handle * handles;
+	int handle_capacity;
+	
+	// in deferred consistency mode, leaves whose hashes no longer match file_data, one bit per block,
+	// and whether extents changed so the whole tree has to be rebuilt, both cleared by sync_hash_blocks
+	int hash_consistency;
+	uint64_t * dirty_leaves;
+	int dirty_count;
+	int tree_stale;
+	
+	// background scrubber, verifying SCRUB_SUBTREE_BLOCKS leaves at a time and waiting between subtrees
+	// to keep to scrub_rate bytes per second, reads trust blocks scrubbed in the last scrub_trust milliseconds
+	// scrub_times holds when each subtree was last found to match hash_data, 0 if never or if a block in it is corrupt
+	// corrupt_blocks holds the blocks found corrupt in order, until a later scrub finds them correct
+	size_t scrub_rate;
+	int scrub_trust;
+	int scrub_running; // 1 while the scrubber thread runs, close_fs sets it to 0 to stop it
+	int scrub_next; // next subtree for the scrubber
+	pthread_t scrubber;
+	pthread_cond_t scrub_wake;
+	long * scrub_times;
+	int * corrupt_blocks;
+	int corrupt_count;
+	int corrupt_capacity;
+	
+	// snapshots taken since init_fs, newest first
+	snapshot * snapshots;
+	int next_snapshot_id;
+	
 	FILE * file_data;
 	FILE * directory_table;
 	FILE * hash_data;
 	
+	// file_data and hash_data opened with O_DIRECT in volumes opened with direct_io, and the pool of aligned buffers,
+	// guarded by the list lock, changed nodes of the hash tree are written to hash_data a whole unit at a time by io_end
+	direct_file direct_file_data;
+	direct_file direct_hash_data;
+	uint8_t * direct_pool[DIRECT_IO_POOL_SIZE];
+	int direct_pool_count;
+	uint64_t * direct_hash_dirty;
+	size_t direct_hash_dirty_count;
+	
 	size_t total_space;
 	size_t filled_space;
 	pthread_mutex_t list_lock;
 	
+	// io scheduler handing out the list lock, io_lock guards the counts of queued calls for each class
+	// background work runs in slices and gives the list lock to queued foreground calls between them,
+	// waiting as long as the slice is allowed to take at background_rate bytes per second
+	pthread_mutex_t io_lock;
+	pthread_cond_t io_turn;
+	int io_waiting[IO_CLASSES];
+	int io_busy;
+	size_t background_rate;
+	int io_changing; // set while a call that may change the volume holds the list lock
+	int io_metadata; // set once the call holding the list lock writes directory_table
+	uint64_t changes; // counts calls that may have changed the volume, and reloads of a shared mount
+	
+	// trace of every call, written when the volume is opened with a trace_path, or NULL
+	// trace_names holds the names written to it so far, sorted by name
+	FILE * trace;
+	pthread_mutex_t trace_lock;
+	uint64_t trace_start;
+	trace_name * trace_names;
+	int trace_name_count;
+	int trace_name_capacity;
+	
+#ifdef FS_TRACE_SPANS
+	char * span_path; // spans are dumped here by close_fs, or NULL
+	uint64_t span_start; // nanoseconds when the volume was mounted, close_fs only dumps spans recorded since
+#endif
+	
+	// read-ahead, the thread is started by the first stream that reads ahead
+	// read_ahead_pending is guarded by io_lock, the streams by the list lock
+	size_t read_ahead_size;
+	read_ahead_stream read_ahead_streams[READ_AHEAD_STREAMS];
+	uint64_t read_ahead_uses;
+	pthread_t read_ahead_thread;
+	pthread_cond_t read_ahead_wake;
+	int read_ahead_running;
+	int read_ahead_pending;
+	
+	// sidecar of a volume opened with shared_mount, or NULL
+	// shared_generation is the generation stdio was last flushed at, shared_metadata_generation the one the file lists were loaded at
+	// entry_generations follows the hash tree in the sidecar, one for each of the shared_entries directory_table entries
+	shared_mount_header * shared;
+	int shared_fd;
+	size_t shared_size;
+	uint64_t shared_generation;
+	uint64_t shared_metadata_generation;
+	uint32_t * entry_generations;
+	long shared_entries;
+	
 } helper_node;
 
-// recursive helper method to verify hash data
-// returns the total number of node within hash tree that are incorrect
-// (i.e. returns 0 if hash tree is correct
-static int verify_hash_block_rec(void * helper, int offset, int depth){
-	helper_node * node_pointer = helper;
-	
-	if (depth == 0){
-		return 0;
+// buffers needed only during one call (blocks being hashed, chunks being compressed) come from
+// a scratch arena kept for each thread instead of the heap
+// an arena is a list of blocks that only grows, the blocks after current are spare, and buffers taken
+// after a scratch_save are given back together by scratch_release, so the same calls reuse the same memory
+#define SCRATCH_BLOCK_SIZE (64 * 1024)
+
+// define a block of a scratch arena
+typedef struct scratch_block{
+	struct scratch_block * next;
+	size_t size;
+	size_t used;
+	uint8_t data[];
+} scratch_block;
+
+// define the scratch arena of a thread
+typedef struct scratch_arena{
+	scratch_block * blocks;
+	scratch_block * current;
+} scratch_arena;
+
+// define a point in a scratch arena to go back to
+typedef struct scratch_mark{
+	scratch_block * block;
+	size_t used;
+} scratch_mark;
+
+static pthread_key_t scratch_key;
+static pthread_once_t scratch_once = PTHREAD_ONCE_INIT;
+
+// frees the scratch arena of a thread when the thread exits
+static void free_scratch_arena(void * arg){
+	
+	scratch_arena * arena = arg;
+	while (arena->blocks != NULL){
+		scratch_block * next_block = arena->blocks->next;
+		free(arena->blocks);
+		arena->blocks = next_block;
 	}
-	
-	else if (depth == node_pointer->max_depth){
-		// read in data from block in file_data and calculate fletcher
-		void * tmp_file_data = malloc(256);
-		int start_offset = (pow(2, node_pointer->max_depth + 1) - 1) - node_pointer->number_of_blocks;
-		int file_data_offset = (offset - start_offset) * 256;
-		
-		uint8_t * buffercalc = malloc(16);
-		uint8_t * bufferread = malloc(16);
-		
-		fseek(node_pointer->file_data, file_data_offset, SEEK_SET);
-		fread(tmp_file_data, 256, 1, node_pointer->file_data);
-		
-		fletcher(tmp_file_data, 256, buffercalc);
-		
-		fseek(node_pointer->hash_data, offset * 16, SEEK_SET);
-		fread(bufferread, 16, 1, node_pointer->hash_data);
-		
-		// flush buffers for multithreading
-		fflush(node_pointer->hash_data);
-		fflush(node_pointer->file_data);
-		free(tmp_file_data);
-				
-		if (memcmp(buffercalc, bufferread, 16) != 0){
-			free(buffercalc);
-			free(bufferread);
-			return 1 + verify_hash_block_rec(helper, (int)((offset-1)/2), depth-1);
-		}
-		else{
-			free(buffercalc);
-			free(bufferread);
-			return verify_hash_block_rec(helper, (int)((offset-1)/2), depth-1);
+	free(arena);
+}
+
+static void init_scratch_key(void){
+	pthread_key_create(&scratch_key, free_scratch_arena);
+}
+
+// helper function to get the scratch arena of the calling thread
+// returns NULL if unsuccessful (malloc error)
+static scratch_arena * thread_scratch(void){
+	
+	pthread_once(&scratch_once, init_scratch_key);
+	scratch_arena * arena = pthread_getspecific(scratch_key);
+	if (arena == NULL){
+		arena = calloc(1, sizeof(scratch_arena));
+		if (arena == NULL || pthread_setspecific(scratch_key, arena) != 0){ // malloc error
+			free(arena);
+			return NULL;
 		}
 	}
+	return arena;
+}
+
+// returns the point of the calling thread's scratch arena to go back to with scratch_release
+static scratch_mark scratch_save(void){
+	
+	scratch_mark mark = {NULL, 0};
+	scratch_arena * arena = thread_scratch();
+	if (arena != NULL && arena->current != NULL){
+		mark.block = arena->current;
+		mark.used = arena->current->used;
+	}
+	return mark;
+}
+
+// helper function to take length bytes from the calling thread's scratch arena
+// returns the buffer, or NULL if unsuccessful (malloc error)
+static void * scratch_alloc(size_t length){
 	
-	else{
-		//fletcher block n + n+1
-		// then go up
-		
-		void * tmp_file_data = malloc(32);
-		
-		uint8_t * buffercalc = malloc(16);
-		uint8_t * bufferread = malloc(16);
-		
-		fseek(node_pointer->hash_data, offset * 16, SEEK_SET);
-		fread(bufferread, 16, 1, node_pointer->hash_data);
-		
-		fseek(node_pointer->hash_data, (16 * ((offset * 2) + 1)), SEEK_SET);
-		fread(tmp_file_data, 32, 1, node_pointer->hash_data);
-		
-		fletcher(tmp_file_data, 32, buffercalc);
-		free(tmp_file_data);
-		
-		if (memcmp(buffercalc, bufferread, 16) != 0){
-			free(buffercalc);
-			free(bufferread);
-			return 1 + verify_hash_block_rec(helper, (int)((offset-1)/2), depth-1);
+	scratch_arena * arena = thread_scratch();
+	if (arena == NULL){ // malloc error
+		return NULL;
+	}
+	length = (length + 15) & ~(size_t)15;
+	
+	// move on to the first spare block with enough room, adding one to the end if there is none
+	scratch_block * last = NULL;
+	scratch_block * block = arena->current;
+	if (block == NULL && arena->blocks != NULL){
+		block = arena->blocks;
+		block->used = 0;
+	}
+	while (block != NULL && block->used + length > block->size){
+		last = block;
+		block = block->next;
+		if (block != NULL){
+			block->used = 0;
+		}
+	}
+	if (block == NULL){
+		size_t size = (length > SCRATCH_BLOCK_SIZE) ? length : SCRATCH_BLOCK_SIZE;
+		block = malloc(sizeof(scratch_block) + size);
+		if (block == NULL){ // malloc error
+			return NULL;
+		}
+		block->next = NULL;
+		block->size = size;
+		block->used = 0;
+		if (last == NULL){
+			arena->blocks = block;
 		}
 		else{
-			free(buffercalc);
-			free(bufferread);
-			return verify_hash_block_rec(helper, (int)((offset-1)/2), depth-1);
+			last->next = block;
 		}
 	}
 	
-	// should never reach here
-	return 0;
+	arena->current = block;
+	void * buffer = block->data + block->used;
+	block->used += length;
+	return buffer;
 }
 
-// helper function to verify hash tree from starting block
-// calls recursive helper function for verification of tree
-// returns the total number of node within hash tree that are incorrect
-// (i.e. returns 0 if hash tree is correct
-static int verify_hash_block(size_t block_offset, void * helper) {
-	helper_node * node_pointer = helper;
-	int start_offset = (pow(2, node_pointer->max_depth + 1) - 1) - node_pointer->number_of_blocks;
+// gives back every buffer taken from the calling thread's scratch arena since mark was saved
+static void scratch_release(scratch_mark mark){
 	
-    return verify_hash_block_rec(helper, start_offset + block_offset, node_pointer->max_depth);
+	scratch_arena * arena = thread_scratch();
+	if (arena == NULL){
+		return;
+	}
+	arena->current = (mark.block != NULL) ? mark.block : arena->blocks;
+	if (arena->current != NULL){
+		arena->current->used = mark.used;
+	}
 }
 
-// helper function to see if filename exists
-// returns 0 if file exists, 1 if it doesn't exist
-static int does_filename_exist(void * helper, char * filename){
+// modulus used by the fletcher sums
+#define FLETCHER_MODULUS 4294967295ULL
+
+// fletcher hash of buffer, treating it as little endian 32 bit words zero padded to a multiple of 4 bytes
+// inlined into the leaf hashing functions below so a constant length lets the compiler unroll the loop
+static inline void fletcher_core(const uint8_t * buf, size_t length, uint8_t * output){
 	
-	helper_node * node_pointer = helper;
-	offset_node * offset_tmp_pointer = node_pointer->offset_node;
+	uint64_t a = 0;
+	uint64_t b = 0;
+	uint64_t c = 0;
+	uint64_t d = 0;
 	
-	while(offset_tmp_pointer->next != NULL){
-	if (strncmp(offset_tmp_pointer->next->filename, filename, 64) == 0){
-		// file exists
-		return 0;
+	size_t length_4_bytes = length / 4;
+	uint32_t word;
+	
+	for (size_t i = 0; i < length_4_bytes; i++){
+		memcpy(&word, buf + (i * 4), 4);
+		a = (a + word) % FLETCHER_MODULUS;
+		b = (b + a) % FLETCHER_MODULUS;
+		c = (c + b) % FLETCHER_MODULUS;
+		d = (d + c) % FLETCHER_MODULUS;
 	}
-		
-		offset_tmp_pointer = offset_tmp_pointer->next;
-	}	
 	
-	// file doesn't exist
-	return 1;
+	// pad last partial word with zeros
+	if (length % 4 != 0){
+		word = 0;
+		memcpy(&word, buf + (length_4_bytes * 4), length % 4);
+		a = (a + word) % FLETCHER_MODULUS;
+		b = (b + a) % FLETCHER_MODULUS;
+		c = (c + b) % FLETCHER_MODULUS;
+		d = (d + c) % FLETCHER_MODULUS;
+	}
+	
+	memcpy(output, &a, 4);
+	memcpy(output+4, &b, 4);
+	memcpy(output+8, &c, 4);
+	memcpy(output+12, &d, 4);
 }
 
-// recursive helper method to calculate hash of node in hash tree
-// always returns 0
-static int calculate_hash(void * helper, int offset, int depth){
-	
-	helper_node * node_pointer = helper;
-	//printf("Max depth: %d, Depth: %d, Offset: %d\n", node_pointer->max_depth, depth, offset);
+// leaf hashing functions specialised for common block sizes
+// DEFINE_LEAF_FUNCTIONS(name) expects an inline name##_core(buf, length, output) and defines
+// select_##name##_leaf, which returns a copy of the core with a constant length where one exists
+// only leaves are specialised, internal nodes hash their 32 bytes of children through hash_provider.hash
+#define DEFINE_HASH_LEAF(name, size) \
+static void hash_leaf_##name##_##size(uint8_t * buf, size_t length, uint8_t * output){ \
+	(void) length; \
+	name##_core(buf, size, output); \
+}
+
+#define DEFINE_LEAF_FUNCTIONS(name) \
+DEFINE_HASH_LEAF(name, 256) \
+DEFINE_HASH_LEAF(name, 4096) \
+DEFINE_HASH_LEAF(name, 65536) \
+\
+static void hash_leaf_##name##_generic(uint8_t * buf, size_t length, uint8_t * output){ \
+	name##_core(buf, length, output); \
+} \
+\
+static hash_leaf_function select_##name##_leaf(size_t block_size){ \
+	switch (block_size){ \
+		case 256: \
+			return hash_leaf_##name##_256; \
+		case 4096: \
+			return hash_leaf_##name##_4096; \
+		case 65536: \
+			return hash_leaf_##name##_65536; \
+		default: \
+			return hash_leaf_##name##_generic; \
+	} \
+}
+
+DEFINE_LEAF_FUNCTIONS(fletcher)
+
+static const hash_provider fletcher_provider = {FS_HASH_FLETCHER, fletcher, select_fletcher_leaf};
+
+// CRC32C (Castagnoli) polynomial, reflected
+#define CRC32C_POLYNOMIAL 0x82F63B78
+
+static uint32_t crc32c_table[256];
+static pthread_once_t crc32c_table_once = PTHREAD_ONCE_INIT;
+
+// fills the lookup table for the software CRC32C
+static void init_crc32c_table(void){
+	for (uint32_t i = 0; i < 256; i++){
+		uint32_t crc = i;
+		for (int j = 0; j < 8; j++){
+			crc = (crc >> 1) ^ (CRC32C_POLYNOMIAL & (0 - (crc & 1)));
+		}
+		crc32c_table[i] = crc;
+	}
+}
+
+// CRC32C of buffer into the first 4 bytes of output, remaining 12 bytes are zero
+// CRC32C only has 32 bits of strength, so it is only suitable for catching accidental corruption
+static void hash_crc32c_software(uint8_t * buf, size_t length, uint8_t * output){
 	
-	if (depth == node_pointer->max_depth){
-		// read in data from block in file_data and calculate fletcher
-		void * tmp_file_data = malloc(256);
-		int start_offset = (pow(2, node_pointer->max_depth + 1) - 1) - node_pointer->number_of_blocks;
-		int file_data_offset = (offset - start_offset) * 256;
-		
-		fseek(node_pointer->file_data, file_data_offset, SEEK_SET);
-		fread(tmp_file_data, 256, 1, node_pointer->file_data);
-		
-		fletcher(tmp_file_data, 256, node_pointer->hash_tree + (offset * 16));
+	pthread_once(&crc32c_table_once, init_crc32c_table);
 	
-		fseek(node_pointer->hash_data, offset * 16, SEEK_SET);
-		fwrite(node_pointer->hash_tree + (offset * 16), 16, 1, node_pointer->hash_data);
-		fflush(node_pointer->hash_data);
-		free(tmp_file_data);
-		return 0;
+	uint32_t crc = 0xFFFFFFFF;
+	for (size_t i = 0; i < length; i++){
+		crc = (crc >> 8) ^ crc32c_table[(crc ^ buf[i]) & 0xFF];
 	}
+	crc = ~crc;
 	
-	else{
-		// calculate left node, then right node and then fletcher the concatenation of the two
-		calculate_hash(helper, (offset * 2) + 1, depth + 1);
-		calculate_hash(helper, (offset * 2) + 2, depth + 1);
-		fletcher(node_pointer->hash_tree + (16 * ((offset * 2) + 1)), 32, node_pointer->hash_tree + (offset * 16));
-		
-		// update hash_data file
-		fseek(node_pointer->hash_data, offset * 16, SEEK_SET);
-		fwrite(node_pointer->hash_tree + (offset * 16), 16, 1, node_pointer->hash_data);
-		fflush(node_pointer->hash_data);
-		return 0;
-	}
+	memset(output, 0, 16);
+	memcpy(output, &crc, 4);
 }
 
-// computes hash tree of file_data and stores it in hash_data
-// calls recursive hash calculation function
-void compute_hash_tree(void * helper) {
-	helper_node * node_pointer = helper;
-	pthread_mutex_lock(&node_pointer->list_lock);
-	calculate_hash(helper, 0, 0);
-	
-	// flush buffers for multithreading
-	fflush(node_pointer->file_data);
-	fflush(node_pointer->directory_table);
-	fflush(node_pointer->hash_data);		
-	
-	pthread_mutex_unlock(&node_pointer->list_lock);
-    return;
+static hash_leaf_function select_crc32c_software_leaf(size_t block_size){
+	(void) block_size;
+	return hash_crc32c_software;
 }
 
-// helper method for repacking
-// returns 1 if no files exist
-// returns 0 if files exist and has repacked successfully
-static int repack_helper(void * helper){
+static const hash_provider crc32c_software_provider = {FS_HASH_CRC32C, hash_crc32c_software, select_crc32c_software_leaf};
 
-	helper_node * node_pointer = helper;
-	offset_node * offset_tmp_pointer = node_pointer->offset_node;	
-	int last_free_offset = 0;
-	void * tmp_memory = NULL;
-	
-	if (offset_tmp_pointer->next == NULL){ //no files exist
-		return 1;
+#if defined(__x86_64__) && defined(__GNUC__)
+// same as hash_crc32c_software using the SSE4.2 crc32 instruction, 8 bytes at a time
+__attribute__((target("sse4.2")))
+static void hash_crc32c_sse42(uint8_t * buf, size_t length, uint8_t * output){
+	
+	uint64_t crc = 0xFFFFFFFF;
+	uint64_t word;
+	size_t i = 0;
+	
+	for (; i + 8 <= length; i += 8){
+		memcpy(&word, buf + i, 8);
+		crc = __builtin_ia32_crc32di(crc, word);
 	}
-	else{
-		offset_tmp_pointer = offset_tmp_pointer->next;
+	uint32_t crc32 = crc;
+	for (; i < length; i++){
+		crc32 = __builtin_ia32_crc32qi(crc32, buf[i]);
 	}
+	crc32 = ~crc32;
 	
-	while (offset_tmp_pointer != NULL){
-		if (offset_tmp_pointer->offset >= last_free_offset){ //file can be shifted to the left
-			tmp_memory = malloc(offset_tmp_pointer->length);
-			
-			//read file data to tmp_memory
-			fseek(node_pointer->file_data, offset_tmp_pointer->offset, SEEK_SET);
-			fread(tmp_memory, offset_tmp_pointer->length, 1, node_pointer->file_data);
-			
-			//write file data from tmp_memory to new offset
-			fseek(node_pointer->file_data, last_free_offset, SEEK_SET);
-			fwrite(tmp_memory, offset_tmp_pointer->length, 1, node_pointer->file_data);
-			
-			//write data directory
-			fseek(node_pointer->directory_table, (offset_tmp_pointer->file_index) + 64, SEEK_SET);
-			fwrite(&last_free_offset, 4, 1, node_pointer->directory_table);
-			
-			// flush buffers for multithreading
-			fflush(node_pointer->file_data);
-			fflush(node_pointer->directory_table);
-			fflush(node_pointer->hash_data);		
-			
-			//adjust offset in both sorted lists
-			free(tmp_memory);
-			offset_tmp_pointer->offset = last_free_offset;
-			last_free_offset = last_free_offset + offset_tmp_pointer->length;
-		}
-		
-		offset_tmp_pointer = offset_tmp_pointer->next;
-	}
-    return 0;
+	memset(output, 0, 16);
+	memcpy(output, &crc32, 4);
 }
 
-// helper method to find free file_index in directory_table
-// returns the first free file index in directory_table
-static int find_free_file_index(void * helper){
-	
-	helper_node * node_pointer = helper;
-	
-	fseek(node_pointer->directory_table, 0, SEEK_END);
-	int file_directory_table_size = ftell(node_pointer->directory_table);
-	int file_index = 0;
+static hash_leaf_function select_crc32c_sse42_leaf(size_t block_size){
+	(void) block_size;
+	return hash_crc32c_sse42;
+}
 
-	fseek(node_pointer->directory_table, 0, SEEK_SET);
-	
-	char buff = '\0';
-	char null_byte = '\0';
+static const hash_provider crc32c_sse42_provider = {FS_HASH_CRC32C, hash_crc32c_sse42, select_crc32c_sse42_leaf};
+#endif
+
+// constants for the fast 128 bit hash (the xxHash64 primes)
+#define FAST128_PRIME1 0x9E3779B185EBCA87ULL
+#define FAST128_PRIME2 0xC2B2AE3D27D4EB4FULL
+#define FAST128_PRIME3 0x165667B19E3779F9ULL
+
+static inline uint64_t fast128_rotl(uint64_t x, int r){
+	return (x << r) | (x >> (64 - r));
+}
+
+// one xxHash64 style accumulator round
+static inline uint64_t fast128_round(uint64_t acc, uint64_t input){
+	acc += input * FAST128_PRIME2;
+	acc = fast128_rotl(acc, 31);
+	return acc * FAST128_PRIME1;
+}
+
+static inline uint64_t fast128_avalanche(uint64_t h){
+	h ^= h >> 33;
+	h *= FAST128_PRIME2;
+	h ^= h >> 29;
+	h *= FAST128_PRIME3;
+	h ^= h >> 32;
+	return h;
+}
+
+// fast non-cryptographic 128 bit hash of buffer into output
+// four independent 64 bit lanes consume 32 bytes per step, then are folded into two 64 bit halves
+static inline void fast128_core(const uint8_t * buf, size_t length, uint8_t * output){
+	
+	uint64_t v1 = FAST128_PRIME1 + FAST128_PRIME2;
+	uint64_t v2 = FAST128_PRIME2;
+	uint64_t v3 = 0;
+	uint64_t v4 = 0 - FAST128_PRIME1;
+	uint64_t words[4];
+	size_t i = 0;
+	
+	for (; i + 32 <= length; i += 32){
+		memcpy(words, buf + i, 32);
+		v1 = fast128_round(v1, words[0]);
+		v2 = fast128_round(v2, words[1]);
+		v3 = fast128_round(v3, words[2]);
+		v4 = fast128_round(v4, words[3]);
+	}
 	
-	while(file_index < file_directory_table_size){
-		fread(&buff, 1, 1, node_pointer->directory_table);
-		if (memcmp(&buff, &null_byte, 1) == 0){
-			return file_index;
-		}
-		file_index += 72;
-		fseek(node_pointer->directory_table, 71, SEEK_CUR);
+	// remaining bytes, zero padded to whole words
+	if (i < length){
+		memset(words, 0, 32);
+		memcpy(words, buf + i, length - i);
+		v1 = fast128_round(v1, words[0]);
+		v2 = fast128_round(v2, words[1]);
+		v3 = fast128_round(v3, words[2]);
+		v4 = fast128_round(v4, words[3]);
 	}
 	
-	// no free file indexes
-	return -1;
+	uint64_t low = fast128_rotl(v1, 1) + fast128_rotl(v2, 7) + fast128_rotl(v3, 12) + fast128_rotl(v4, 18);
+	low = fast128_avalanche(low ^ (length * FAST128_PRIME1));
+	uint64_t high = (v1 ^ v3) + fast128_rotl(v2 ^ v4, 29) + (length * FAST128_PRIME3);
+	high = fast128_avalanche(high ^ low);
 	
+	memcpy(output, &low, 8);
+	memcpy(output + 8, &high, 8);
 }
 
-// initializes linked list for file nodes
-// nodes are stored in a singly linked lists:
-// list stores offset, length, file index (in directory_data) and filename and is sorted based on offset
-static void * init_list(void){
-	
-	helper_node * node_pointer = malloc(sizeof(helper_node));
-	if(node_pointer == NULL) // malloc error
-		return NULL;
+static void hash_fast128(uint8_t * buf, size_t length, uint8_t * output){
+	fast128_core(buf, length, output);
+}
 
-	// create offset sorted list header
-	offset_node * offset_header = calloc(1, sizeof(offset_node));
-	if(offset_header == NULL) // malloc error
-		return NULL;
-	offset_header->offset = -1;
-	offset_header->length = -1;
-	offset_header->file_index = -1;
+DEFINE_LEAF_FUNCTIONS(fast128)
 
-	// attach helper node to both header nodes
-	node_pointer->offset_node = offset_header;
-	
-	node_pointer->hash_tree = NULL;
-	return (void *) node_pointer;
+static const hash_provider fast128_provider = {FS_HASH_FAST128, hash_fast128, select_fast128_leaf};
+
+// helper function to get the hash provider for a hash algorithm
+// CRC32C uses the SSE4.2 instruction when the processor supports it
+// returns NULL if the hash algorithm is unknown
+static const hash_provider * select_hash_provider(int hash_algorithm){
+	switch (hash_algorithm){
+		case FS_HASH_FLETCHER:
+			return &fletcher_provider;
+		case FS_HASH_CRC32C:
+#if defined(__x86_64__) && defined(__GNUC__)
+			if (__builtin_cpu_supports("sse4.2")){
+				return &crc32c_sse42_provider;
+			}
+#endif
+			return &crc32c_software_provider;
+		case FS_HASH_FAST128:
+			return &fast128_provider;
+		default:
+			return NULL;
+	}
 }
 
-// when nodes are added, insert into correct location to keep sorted
-// returns 0 if successful,
-// returns 1 if unsucessful (malloc error)
-static int add_node(void * helper, char * filename, int offset, int length, int file_index){
+// slot of each node of a complete subtree within its page group, indexed by subtree height then
+// breadth-first index within the subtree, for the blocked layout
+static uint8_t veb_slot_table[PAGE_GROUP_LEVELS + 1][1 << PAGE_GROUP_LEVELS];
+static pthread_once_t veb_slot_table_once = PTHREAD_ONCE_INIT;
+
+// recursive helper to find the slot of the node at level, position within a complete subtree of
+// the given height stored in van Emde Boas order (top half subtree, then each bottom half subtree)
+static int veb_slot(int level, int position, int height){
 	
-	helper_node * node_pointer = helper;
+	if (height == 1){
+		return 0;
+	}
 	
-	// create entry in offset sorted list
-	offset_node * offset_tmp_pointer = node_pointer->offset_node;
-		
-	// loop through list until next node is either NULL or offset is less than the offset to be inserted
-	while(offset_tmp_pointer->next != NULL && offset > offset_tmp_pointer->next->offset){
-		offset_tmp_pointer = offset_tmp_pointer->next;
+	int top = height / 2;
+	int bottom = height - top;
+	
+	if (level < top){
+		return veb_slot(level, position, top);
 	}
+	
+	int bottom_level = level - top;
+	int subtree = position >> bottom_level;
+	return ((1 << top) - 1) + (subtree * ((1 << bottom) - 1)) + veb_slot(bottom_level, position & ((1 << bottom_level) - 1), bottom);
+}
 
-	// add node to offset sorted list
-	offset_node * offset_node_pointer = malloc(sizeof(offset_node));
-	if (offset_node_pointer == NULL){ //malloc error
-		return 1;
+// fills veb_slot_table for every subtree height up to PAGE_GROUP_LEVELS
+static void init_veb_slot_table(void){
+	for (int height = 1; height <= PAGE_GROUP_LEVELS; height++){
+		for (int level = 0; level < height; level++){
+			for (int position = 0; position < (1 << level); position++){
+				veb_slot_table[height][(1 << level) - 1 + position] = veb_slot(level, position, height);
+			}
+		}
 	}
-	offset_node_pointer->offset = offset;
-	offset_node_pointer->length = length;
-	strncpy(offset_node_pointer->filename, filename, 64);
-	offset_node_pointer->file_index = file_index;
-	offset_node_pointer->next = offset_tmp_pointer->next;
-	offset_tmp_pointer->next = offset_node_pointer;
-
-	node_pointer->filled_space += length;
-	
-	return 0;
 }
 
-// removes node with filename from sorted list
-// returns 0 if successful, returns 1 if filename doesn't exist
-static int remove_node(void * helper, char * filename){	
+// helper function to set up the in-memory layout of the hash tree, must be called after init_geometry
+// the blocked layout splits the tree into layers of PAGE_GROUP_LEVELS levels, and each layer into
+// page sized groups holding one complete subtree in van Emde Boas order, so a leaf to root walk
+// touches one page per PAGE_GROUP_LEVELS levels and only a few cache lines within each page
+// only the top layer can be shorter, so padding is limited to one slot per page group
+// returns 0 if successful, returns 1 if the tree is too deep for the blocked layout
+static int init_tree_layout(helper_node * helper, int tree_layout){
+	
+	helper->tree_layout = tree_layout;
+	helper->tree_slots = (2 * (long)helper->number_of_blocks) - 1;
+	
+	if (tree_layout != FS_LAYOUT_BLOCKED){
+		return 0;
+	}
 	
-	helper_node * node_pointer = helper;
+	pthread_once(&veb_slot_table_once, init_veb_slot_table);
 	
-	// remove from offset sorted list
-	offset_node * offset_tmp_pointer = node_pointer->offset_node;
+	int levels = helper->max_depth + 1;
+	int top_height = levels % PAGE_GROUP_LEVELS;
+	if (top_height == 0){
+		top_height = PAGE_GROUP_LEVELS;
+	}
 	
-	while(offset_tmp_pointer->next != NULL){
-		if (strncmp(offset_tmp_pointer->next->filename, filename, 64) == 0){
-			offset_node * tmp_offset_node = offset_tmp_pointer->next;
-			offset_tmp_pointer->next = offset_tmp_pointer->next->next;
-			
-			// subtract file size from filled space
-			int file_size = tmp_offset_node->length;
-			node_pointer->filled_space -= file_size;
-			
-			free(tmp_offset_node);
-			return 0;
+	// shifting levels by layer_offset makes every layer after the top one start on a multiple of PAGE_GROUP_LEVELS
+	helper->layer_offset = PAGE_GROUP_LEVELS - top_height;
+	
+	long slots = 0;
+	int start = 0;
+	for (int layer = 0; start < levels; layer++){
+		if (layer == MAX_PAGE_GROUP_LAYERS){
+			return 1;
 		}
+		int height = (layer == 0) ? top_height : PAGE_GROUP_LEVELS;
 		
-		offset_tmp_pointer = offset_tmp_pointer->next;
-	}	
-	return 1;
+		// each layer holds 2^start groups of 2^height slots, padded so the next layer starts on a page
+		helper->layer_base[layer] = slots;
+		helper->layer_start[layer] = start;
+		helper->layer_height[layer] = height;
+		slots += ((long)1 << start) << height;
+		slots = (slots + (1 << PAGE_GROUP_LEVELS) - 1) & ~(long)((1 << PAGE_GROUP_LEVELS) - 1);
+		start += height;
+	}
+	helper->tree_slots = slots;
+	return 0;
 }
 
-// helper method to get node in offset sorted list from filename
-static offset_node * get_offset_node(void * helper, char * filename){
+// returns a pointer to the 16 byte hash of the node with breadth-first index in the in-memory hash tree
+static inline uint8_t * tree_node(helper_node * node_pointer, long index){
 	
-	helper_node * node_pointer = helper;
+	if (node_pointer->tree_layout != FS_LAYOUT_BLOCKED){
+		return node_pointer->hash_tree + (index * 16);
+	}
 	
-	offset_node * offset_tmp_pointer = node_pointer->offset_node;
+	int level = 63 - __builtin_clzl(index + 1);
+	long position = (index + 1) - ((long)1 << level);
 	
-	while(offset_tmp_pointer->next != NULL){
-		if (strncmp(offset_tmp_pointer->next->filename, filename, 64) == 0){
-			return offset_tmp_pointer->next;
-		}
-		offset_tmp_pointer = offset_tmp_pointer->next;
-	}
+	int layer = (level + node_pointer->layer_offset) / PAGE_GROUP_LEVELS;
+	int group_level = level - node_pointer->layer_start[layer];
+	int height = node_pointer->layer_height[layer];
+	
+	long group = position >> group_level;
+	int group_index = ((1 << group_level) - 1) + (position & ((1 << group_level) - 1));
+	
+	long slot = node_pointer->layer_base[layer] + (group << height) + veb_slot_table[height][group_index];
+	return node_pointer->hash_tree + (slot * 16);
+}
 
-	return NULL;
+// helper function to hash the two children of an internal node into output
+static inline void hash_children(helper_node * node_pointer, long index, uint8_t * output){
+	uint8_t children[32];
+	memcpy(children, tree_node(node_pointer, (index * 2) + 1), 16);
+	memcpy(children + 16, tree_node(node_pointer, (index * 2) + 2), 16);
+	node_pointer->hash_provider->hash(children, 32, output);
 }
 
-// helper function to delete files
-// returns 1 if file doesn't exist
-// returns 0 if file deleted successfully
-static int delete_file_helper(char * filename, void * helper){
-	helper_node * node_pointer = helper;
-	offset_node * tmp = get_offset_node(helper, filename);
-	char null_byte = '\0';
+// helper function to take an aligned buffer of DIRECT_IO_BUFFER_SIZE bytes from the pool of a volume opened with direct_io
+// returns NULL if malloc error
+static uint8_t * direct_io_take(helper_node * node_pointer){
 	
-	if (tmp != NULL){ //file exists
-		fseek(node_pointer->directory_table, tmp->file_index, SEEK_SET);
-		fwrite(&null_byte, 1, 1, node_pointer->directory_table);
-		// flush buffers for multithreading
-		fflush(node_pointer->directory_table);
-		remove_node(helper, filename);
-		return 0;
+	if (node_pointer->direct_pool_count > 0){
+		return node_pointer->direct_pool[--node_pointer->direct_pool_count];
 	}
-	else{ //file doesn't exist
-		return 1;
+	void * buffer = NULL;
+	if (posix_memalign(&buffer, DIRECT_IO_ALIGNMENT, DIRECT_IO_BUFFER_SIZE) != 0){
+		return NULL;
 	}
+	return buffer;
 }
 
-// function to initialize all data structures from three files
-// returns pointer to helper node memory address
-// returns NULL if an error is experienced during initialization
-void * init_fs(char * f1, char * f2, char * f3, int n_processors) {
-	
-	int int_bytes = sizeof(int);
+// helper function to give a buffer taken by direct_io_take back to the pool
+static void direct_io_give(helper_node * node_pointer, uint8_t * buffer){
 	
-	//truncate filenames if necessary
-	truncate(f1);
-	truncate(f2);
-	truncate(f3);
-	
-	//return error if any duplicate names
-	if (strcmp(f1, f2) == 0 || strcmp(f1, f3) == 0 || strcmp(f2, f3) == 0){
-		printf("Error: duplicate filenames\n");
-		return NULL;
+	if (node_pointer->direct_pool_count < DIRECT_IO_POOL_SIZE){
+		node_pointer->direct_pool[node_pointer->direct_pool_count++] = buffer;
 	}
-	
-	FILE * file_data_pointer;
-	FILE * directory_table_pointer;
-	FILE * hash_data_pointer;
-	
-	//open files
-	file_data_pointer = fopen(f1, "r+");
-	if (file_data_pointer == NULL){
-		perror("Error");
-		return NULL;
+	else{
+		free(buffer);
+	}
+}
+
+// helper function to work out the aligned range of a file a piece of a read or write starting at position goes through
+// the range holds at most one pool buffer and ends at the last aligned boundary of the file
+static size_t direct_io_range(direct_file * file, size_t position, size_t remaining, size_t * start){
+	
+	*start = position & ~(size_t)(DIRECT_IO_ALIGNMENT - 1);
+	size_t end = (position + remaining + DIRECT_IO_ALIGNMENT - 1) & ~(size_t)(DIRECT_IO_ALIGNMENT - 1);
+	if (end > file->aligned_size){
+		end = file->aligned_size;
 	}
+	if (end - *start > DIRECT_IO_BUFFER_SIZE){
+		end = *start + DIRECT_IO_BUFFER_SIZE;
+	}
+	return end - *start;
+}
+
+// helper function to read length bytes from offset of a file opened with O_DIRECT, through pool buffers
+// bytes past the last aligned boundary of the file are read through the page cache
+// returns the number of bytes read
+static size_t direct_read(helper_node * node_pointer, direct_file * file, size_t offset, void * buf, size_t length){
+	
+	size_t done = 0;
+	while (done < length){
+		size_t position = offset + done;
+		size_t remaining = length - done;
+		if (position >= file->aligned_size){
+			ssize_t bytes = pread(file->buffered_fd, (uint8_t *) buf + done, remaining, position);
+			return done + ((bytes > 0) ? bytes : 0);
+		}
 		
-	directory_table_pointer = fopen(f2, "r+");
-	if (directory_table_pointer == NULL){
-		perror("Error");
-		return NULL;
+		size_t start = 0;
+		size_t range = direct_io_range(file, position, remaining, &start);
+		uint8_t * buffer = direct_io_take(node_pointer);
+		if (buffer == NULL){ // malloc error
+			return done;
+		}
+		ssize_t bytes = pread(file->fd, buffer, range, start);
+		if (bytes <= (ssize_t)(position - start)){
+			direct_io_give(node_pointer, buffer);
+			return done;
+		}
+		size_t piece = bytes - (position - start);
+		if (piece > remaining){
+			piece = remaining;
+		}
+		memcpy((uint8_t *) buf + done, buffer + (position - start), piece);
+		direct_io_give(node_pointer, buffer);
+		done += piece;
+		if ((size_t)bytes < range){ // short read
+			return done;
+		}
 	}
-	
-	hash_data_pointer = fopen(f3, "r+");
-	if (hash_data_pointer == NULL){
-		perror("Error");
-		return NULL;
+	return done;
+}
+
+// helper function to write length bytes to offset of a file opened with O_DIRECT, through pool buffers
+// aligned units the write only covers part of are read first, and bytes past the last aligned boundary
+// of the file are written through the page cache
+// returns 0 if successful, returns 1 if unsuccessful
+static int direct_write(helper_node * node_pointer, direct_file * file, size_t offset, const void * buf, size_t length){
+	
+	size_t done = 0;
+	while (done < length){
+		size_t position = offset + done;
+		size_t remaining = length - done;
+		if (position >= file->aligned_size){
+			return pwrite(file->buffered_fd, (const uint8_t *) buf + done, remaining, position) != (ssize_t)remaining;
+		}
+		
+		size_t start = 0;
+		size_t range = direct_io_range(file, position, remaining, &start);
+		size_t piece = start + range - position;
+		if (piece > remaining){
+			piece = remaining;
+		}
+		uint8_t * buffer = direct_io_take(node_pointer);
+		if (buffer == NULL){ // malloc error
+			return 1;
+		}
+		int failed = 0;
+		if (position > start){
+			failed |= pread(file->fd, buffer, DIRECT_IO_ALIGNMENT, start) != DIRECT_IO_ALIGNMENT;
+		}
+		size_t tail = (position + piece) & ~(size_t)(DIRECT_IO_ALIGNMENT - 1);
+		if (tail < start + range && (tail > start || position == start)){
+			failed |= pread(file->fd, buffer + (tail - start), DIRECT_IO_ALIGNMENT, tail) != DIRECT_IO_ALIGNMENT;
+		}
+		if (!failed){
+			memcpy(buffer + (position - start), (const uint8_t *) buf + done, piece);
+			failed = pwrite(file->fd, buffer, range, start) != (ssize_t)range;
+		}
+		direct_io_give(node_pointer, buffer);
+		if (failed){
+			return 1;
+		}
+		done += piece;
 	}
-    
-	// calculate total space;
-	int file_data_size = 0;
-	fseek(file_data_pointer, 0, SEEK_END);
-	file_data_size = ftell(file_data_pointer);
-	
-	//allocate memory for sorted array of file information stored in virtual memory
-	void * helper_address = init_list();
-	helper_node * helper = helper_address;
+	return 0;
+}
+
+// helper function to read length bytes of file_data from offset
+// returns the number of bytes read
+static size_t read_file_data(helper_node * node_pointer, size_t offset, void * buf, size_t length){
 	
-	//Read 72 bytes until -1 is returned (i.e. end of file)
-	void * tmp = malloc(72);
-	int file_index = 0;
+	if (node_pointer->direct_file_data.fd >= 0){
+		return direct_read(node_pointer, &node_pointer->direct_file_data, offset, buf, length);
+	}
+	fseek(node_pointer->file_data, offset, SEEK_SET);
+	return fread(buf, 1, length, node_pointer->file_data);
+}
+
+// helper function to write length bytes of file_data at offset
+// in volumes opened with direct_io a write that fails with O_DIRECT is made again through the page cache
+// returns 0 if successful, returns 1 if the bytes could not be written
+static int write_file_data(helper_node * node_pointer, size_t offset, const void * buf, size_t length){
 	
-	int tmp_offset = 0;
-	int tmp_length = 0;
+	if (node_pointer->direct_file_data.fd >= 0){
+		if (direct_write(node_pointer, &node_pointer->direct_file_data, offset, buf, length) == 0){
+			return 0;
+		}
+		return pwrite(node_pointer->direct_file_data.buffered_fd, buf, length, offset) != (ssize_t)length;
+	}
+	fseek(node_pointer->file_data, offset, SEEK_SET);
+	return fwrite(buf, length, 1, node_pointer->file_data) != 1;
+}
+
+// helper function to read length bytes of hash_data from offset
+static void read_hash_data(helper_node * node_pointer, size_t offset, void * buf, size_t length){
 	
-	helper->file_data = file_data_pointer;
-	helper->directory_table = directory_table_pointer;
-	helper->hash_data = hash_data_pointer;
+	if (node_pointer->direct_hash_data.fd >= 0){
+		direct_read(node_pointer, &node_pointer->direct_hash_data, offset, buf, length);
+		return;
+	}
+	fseek(node_pointer->hash_data, offset, SEEK_SET);
+	fread(buf, 1, length, node_pointer->hash_data);
+}
+
+// helper function to mark the aligned units of hash_data holding nodes first to last as changed,
+// in volumes opened with direct_io
+static void direct_hash_mark(helper_node * node_pointer, long first, long last){
+	
+	for (size_t unit = (first * 16) / DIRECT_IO_ALIGNMENT; unit <= (size_t)(last * 16) / DIRECT_IO_ALIGNMENT; unit++){
+		uint64_t bit = (uint64_t)1 << (unit & 63);
+		if (!(node_pointer->direct_hash_dirty[unit >> 6] & bit)){
+			node_pointer->direct_hash_dirty[unit >> 6] |= bit;
+			node_pointer->direct_hash_dirty_count++;
+		}
+	}
+}
+
+// helper function to write the changed units of hash_data of a volume opened with direct_io
+// units are built from the hash tree in memory, so hash_data is never read back to write part of a unit
+static void direct_hash_flush(helper_node * node_pointer){
 	
-	int filled_space = 0;
+	if (node_pointer->direct_hash_dirty_count == 0){
+		return;
+	}
+	uint8_t * buffer = direct_io_take(node_pointer);
+	if (buffer == NULL){ // malloc error, the units are written by the next flush
+		return;
+	}
 	
-	char null_byte = '\0';
-	while(fread(tmp, 72, 1, directory_table_pointer) == 1){
-		//skip over null-starting entries
-		if (memcmp(tmp, &null_byte, 1) == 0){
-			file_index++;
+	SPAN_BEGIN("fwrite hash_data");
+	long nodes = (2 * (long)node_pointer->number_of_blocks) - 1;
+	long nodes_per_unit = DIRECT_IO_ALIGNMENT / 16;
+	size_t units = (nodes + nodes_per_unit - 1) / nodes_per_unit;
+	size_t unit = 0;
+	while (unit < units){
+		if (!(node_pointer->direct_hash_dirty[unit >> 6] & ((uint64_t)1 << (unit & 63)))){
+			unit++;
 			continue;
-		}	
-		
-		memcpy(&tmp_offset, tmp + 64, int_bytes);
-		memcpy(&tmp_length, tmp + 68, int_bytes);
-		
-		// calculate filled_space
-		filled_space += tmp_length;
+		}
 		
-		if (add_node(helper, tmp, tmp_offset, tmp_length, file_index*72) != 0){
-			printf("Error adding node\n");
-			return NULL;
+		// consecutive changed units are written together, up to a pool buffer at a time
+		size_t first = unit;
+		while (unit < units && unit - first < DIRECT_IO_BUFFER_SIZE / DIRECT_IO_ALIGNMENT && (node_pointer->direct_hash_dirty[unit >> 6] & ((uint64_t)1 << (unit & 63)))){
+			node_pointer->direct_hash_dirty[unit >> 6] &= ~((uint64_t)1 << (unit & 63));
+			node_pointer->direct_hash_dirty_count--;
+			unit++;
+		}
+		long first_node = first * nodes_per_unit;
+		long end_node = unit * nodes_per_unit;
+		if (end_node > nodes){
+			end_node = nodes;
+		}
+		for (long i = first_node; i < end_node; i++){
+			memcpy(buffer + (i - first_node) * 16, tree_node(node_pointer, i), 16);
 		}
 		
-		file_index++;
+		// the last unit of the hash tree is only partly there, and goes through the page cache
+		size_t offset = first * DIRECT_IO_ALIGNMENT;
+		size_t length = (end_node - first_node) * 16;
+		size_t aligned_length = 0;
+		if (offset < node_pointer->direct_hash_data.aligned_size){
+			aligned_length = node_pointer->direct_hash_data.aligned_size - offset;
+			if (aligned_length > length){
+				aligned_length = length & ~(size_t)(DIRECT_IO_ALIGNMENT - 1);
+			}
+			pwrite(node_pointer->direct_hash_data.fd, buffer, aligned_length, offset);
+		}
+		if (aligned_length < length){
+			pwrite(node_pointer->direct_hash_data.buffered_fd, buffer + aligned_length, length - aligned_length, offset + aligned_length);
+		}
 	}
+	SPAN_END("fwrite hash_data");
+	direct_io_give(node_pointer, buffer);
+}
+
+// helper function to open file_data and hash_data again with O_DIRECT, for volumes opened with direct_io, once the geometry is known
+// a file the file system it is on cannot open with O_DIRECT is used through stdio
+// returns 0 if successful, returns 1 if malloc error
+static int direct_io_open(helper_node * node_pointer, char * file_data_path, char * hash_data_path){
 	
-	// calculate total space;
-	int hash_data_size = 0;
-	fseek(hash_data_pointer, 0, SEEK_END);
-	hash_data_size = ftell(file_data_pointer);
-	
-	// alloc virtual memory to hold hash_data
-	void * tmp_hash = malloc(hash_data_size);
-	fread(tmp_hash, hash_data_size, 1, hash_data_pointer);
+	direct_file * files[2] = {&node_pointer->direct_file_data, &node_pointer->direct_hash_data};
+	char * paths[2] = {file_data_path, hash_data_path};
+	FILE * streams[2] = {node_pointer->file_data, node_pointer->hash_data};
 	
-	helper->number_of_blocks = file_data_size/256;
-	helper->hash_tree = tmp_hash;
+	// stdio buffers must not hold data written before the files are opened again
+	fflush(node_pointer->file_data);
+	fflush(node_pointer->hash_data);
 	
-	helper->max_depth = (int)log2((file_data_size/256));
+	for (int i = 0; i < 2; i++){
+		struct stat file_stat;
+		files[i]->buffered_fd = fileno(streams[i]);
+		if (fstat(files[i]->buffered_fd, &file_stat) != 0){
+			continue;
+		}
+		files[i]->aligned_size = (size_t)file_stat.st_size & ~(size_t)(DIRECT_IO_ALIGNMENT - 1);
+		files[i]->fd = open(paths[i], O_RDWR | O_DIRECT);
+	}
 	
-	// write file space to helper node
-	helper->total_space = file_data_size;
-	helper->filled_space = filled_space;
+	// one bit per aligned unit of the hash tree in hash_data
+	if (node_pointer->direct_hash_data.fd >= 0){
+		size_t units = ((2 * (size_t)node_pointer->number_of_blocks - 1) * 16 + DIRECT_IO_ALIGNMENT - 1) / DIRECT_IO_ALIGNMENT;
+		node_pointer->direct_hash_dirty = calloc((units + 63) / 64, sizeof(uint64_t));
+		if (node_pointer->direct_hash_dirty == NULL){ // malloc error
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// number of nodes converted per fread or fwrite when the hash tree layout differs from hash_data
+#define TREE_IO_CHUNK_NODES 65536
+
+// helper function to load the whole hash tree from hash_data
+static void load_hash_tree(helper_node * node_pointer){
 	
-	// init mutex
-	pthread_mutex_init(&helper->list_lock, NULL);
+	long nodes = (2 * (long)node_pointer->number_of_blocks) - 1;
 	
-	free(tmp);
+	if (node_pointer->tree_layout != FS_LAYOUT_BLOCKED){
+		read_hash_data(node_pointer, 0, node_pointer->hash_tree, nodes * 16);
+		return;
+	}
 	
-	return helper_address;
-}
+	uint8_t * chunk = calloc(TREE_IO_CHUNK_NODES, 16);
+	if (chunk == NULL){ // malloc error, read one node at a time
+		for (long i = 0; i < nodes; i++){
+			read_hash_data(node_pointer, i * 16, tree_node(node_pointer, i), 16);
+		}
+		return;
+	}
+	for (long start = 0; start < nodes; start += TREE_IO_CHUNK_NODES){
+		long count = nodes - start;
+		if (count > TREE_IO_CHUNK_NODES){
+			count = TREE_IO_CHUNK_NODES;
+		}
+		read_hash_data(node_pointer, start * 16, chunk, count * 16);
+		for (long i = 0; i < count; i++){
+			memcpy(tree_node(node_pointer, start + i), chunk + (i * 16), 16);
+		}
+	}
+	free(chunk);
+}
+
+// helper function to write the whole hash tree to hash_data in one sequential pass
+static void write_hash_tree(helper_node * node_pointer){
+	
+	long nodes = (2 * (long)node_pointer->number_of_blocks) - 1;
+	if (node_pointer->direct_hash_data.fd >= 0){
+		direct_hash_mark(node_pointer, 0, nodes - 1);
+		direct_hash_flush(node_pointer);
+		return;
+	}
+	fseek(node_pointer->hash_data, 0, SEEK_SET);
+	
+	if (node_pointer->tree_layout != FS_LAYOUT_BLOCKED){
+		SPAN_BEGIN("fwrite hash_data");
+		fwrite(node_pointer->hash_tree, 16, nodes, node_pointer->hash_data);
+		fflush(node_pointer->hash_data);
+		SPAN_END("fwrite hash_data");
+		return;
+	}
+	
+	uint8_t * chunk = malloc(TREE_IO_CHUNK_NODES * 16);
+	if (chunk == NULL){ // malloc error, write one node at a time
+		for (long i = 0; i < nodes; i++){
+			fwrite(tree_node(node_pointer, i), 16, 1, node_pointer->hash_data);
+		}
+		fflush(node_pointer->hash_data);
+		return;
+	}
+	for (long start = 0; start < nodes; start += TREE_IO_CHUNK_NODES){
+		long count = nodes - start;
+		if (count > TREE_IO_CHUNK_NODES){
+			count = TREE_IO_CHUNK_NODES;
+		}
+		for (long i = 0; i < count; i++){
+			memcpy(chunk + (i * 16), tree_node(node_pointer, start + i), 16);
+		}
+		SPAN_BEGIN("fwrite hash_data");
+		fwrite(chunk, 16, count, node_pointer->hash_data);
+		SPAN_END("fwrite hash_data");
+	}
+	fflush(node_pointer->hash_data);
+	free(chunk);
+}
+
+// helper function to write one node of the hash tree to hash_data
+// in volumes opened with direct_io the node's unit is only marked, and written by the next direct_hash_flush
+static inline void write_tree_node(helper_node * node_pointer, long index){
+	if (node_pointer->direct_hash_data.fd >= 0){
+		direct_hash_mark(node_pointer, index, index);
+		return;
+	}
+	fseek(node_pointer->hash_data, index * 16, SEEK_SET);
+	fwrite(tree_node(node_pointer, index), 16, 1, node_pointer->hash_data);
+}
+
+// orders extents by offset
+static int compare_extent_offsets(const void * a, const void * b){
+	const extent * first = a;
+	const extent * second = b;
+	return (first->offset > second->offset) - (first->offset < second->offset);
+}
+
+// helper function to add the unwritten extents of a list of files to the unwritten map
+// returns 0 if successful, returns 1 if unsuccessful (malloc error)
+static int collect_unwritten_extents(helper_node * node_pointer, offset_node * header, int * capacity){
+	
+	offset_node * offset_tmp_pointer = header->next;
+	
+	while (offset_tmp_pointer != NULL){
+		for (int i = 0; i < offset_tmp_pointer->number_of_extents; i++){
+			extent * extent_pointer = &offset_tmp_pointer->extents[i];
+			if (!(extent_pointer->flags & EXTENT_UNWRITTEN) || extent_pointer->length == 0){
+				continue;
+			}
+			
+			if (node_pointer->unwritten_count == *capacity){
+				int new_capacity = (*capacity == 0) ? 16 : *capacity * 2;
+				extent * new_map = realloc(node_pointer->unwritten_map, new_capacity * sizeof(extent));
+				if (new_map == NULL){ // malloc error
+					return 1;
+				}
+				node_pointer->unwritten_map = new_map;
+				*capacity = new_capacity;
+			}
+			node_pointer->unwritten_map[node_pointer->unwritten_count] = *extent_pointer;
+			node_pointer->unwritten_count++;
+		}
+		offset_tmp_pointer = offset_tmp_pointer->next;
+	}
+	return 0;
+}
+
+// helper function to work out the unwritten map from the extents of every file and snapshot
+// ranges shared by several files are only listed once
+// returns 0 if successful, returns 1 if unsuccessful (malloc error), leaving the map empty
+static int build_unwritten_map(helper_node * node_pointer){
+	
+	int capacity = 0;
+	free(node_pointer->unwritten_map);
+	node_pointer->unwritten_map = NULL;
+	node_pointer->unwritten_count = 0;
+	
+	int return_value = collect_unwritten_extents(node_pointer, node_pointer->offset_node, &capacity);
+	snapshot * snapshot_pointer = node_pointer->snapshots;
+	while (return_value == 0 && snapshot_pointer != NULL){
+		return_value = collect_unwritten_extents(node_pointer, snapshot_pointer->files, &capacity);
+		snapshot_pointer = snapshot_pointer->next;
+	}
+	if (return_value != 0){
+		free(node_pointer->unwritten_map);
+		node_pointer->unwritten_map = NULL;
+		node_pointer->unwritten_count = 0;
+		return 1;
+	}
+	
+	if (node_pointer->unwritten_count == 0){
+		return 0;
+	}
+	
+	// sort and merge overlapping ranges
+	qsort(node_pointer->unwritten_map, node_pointer->unwritten_count, sizeof(extent), compare_extent_offsets);
+	int count = 1;
+	for (int i = 1; i < node_pointer->unwritten_count; i++){
+		extent * previous = &node_pointer->unwritten_map[count - 1];
+		extent * current = &node_pointer->unwritten_map[i];
+		if (current->offset <= previous->offset + previous->length){
+			if (current->offset + current->length > previous->offset + previous->length){
+				previous->length = current->offset + current->length - previous->offset;
+			}
+		}
+		else{
+			node_pointer->unwritten_map[count] = *current;
+			count++;
+		}
+	}
+	node_pointer->unwritten_count = count;
+	return 0;
+}
+
+// helper function to find the first range in the unwritten map that ends after offset
+// returns unwritten_count if there is none
+static int unwritten_search(helper_node * node_pointer, size_t offset){
+	
+	int low = 0;
+	int high = node_pointer->unwritten_count;
+	
+	while (low < high){
+		int middle = (low + high) / 2;
+		extent * extent_pointer = &node_pointer->unwritten_map[middle];
+		if ((size_t)(extent_pointer->offset + extent_pointer->length) <= offset){
+			low = middle + 1;
+		}
+		else{
+			high = middle;
+		}
+	}
+	return low;
+}
+
+// helper function to check if [offset, offset + length) of file_data is entirely unwritten
+// returns 1 if it is, returns 0 otherwise
+static int is_unwritten(helper_node * node_pointer, size_t offset, size_t length){
+	
+	int i = unwritten_search(node_pointer, offset);
+	if (i == node_pointer->unwritten_count){
+		return 0;
+	}
+	
+	extent * extent_pointer = &node_pointer->unwritten_map[i];
+	return (size_t)extent_pointer->offset <= offset && offset + length <= (size_t)(extent_pointer->offset + extent_pointer->length);
+}
+
+// helper function to read file_data as it is hashed, with unwritten ranges read as zeros
+static void read_hashed_data(helper_node * node_pointer, size_t offset, size_t length, uint8_t * buf){
+	
+	if (is_unwritten(node_pointer, offset, length)){
+		memset(buf, 0, length);
+		return;
+	}
+	
+	SPAN_BEGIN("fread file_data");
+	size_t bytes_read = read_file_data(node_pointer, offset, buf, length);
+	SPAN_END("fread file_data");
+	if (bytes_read < length){ // short read, treat missing data as zeros
+		memset(buf + bytes_read, 0, length - bytes_read);
+	}
+	
+	for (int i = unwritten_search(node_pointer, offset); i < node_pointer->unwritten_count; i++){
+		extent * extent_pointer = &node_pointer->unwritten_map[i];
+		if ((size_t)extent_pointer->offset >= offset + length){
+			break;
+		}
+		size_t start = ((size_t)extent_pointer->offset > offset) ? (size_t)extent_pointer->offset : offset;
+		size_t stop = ((size_t)(extent_pointer->offset + extent_pointer->length) < offset + length) ? (size_t)(extent_pointer->offset + extent_pointer->length) : offset + length;
+		memset(buf + (start - offset), 0, stop - start);
+	}
+}
+
+// helper function to work out the hash of a zero filled subtree for each depth of the hash tree
+// must be called after init_geometry
+// returns 0 if successful, returns 1 if unsuccessful (malloc error)
+static int init_zero_hashes(helper_node * node_pointer){
+	
+	uint8_t * zero_block = calloc(1, node_pointer->block_size);
+	if (zero_block == NULL){ // malloc error
+		return 1;
+	}
+	node_pointer->hash_leaf(zero_block, node_pointer->block_size, node_pointer->zero_hash[node_pointer->max_depth]);
+	free(zero_block);
+	
+	for (int depth = node_pointer->max_depth - 1; depth >= 0; depth--){
+		uint8_t children[32];
+		memcpy(children, node_pointer->zero_hash[depth + 1], 16);
+		memcpy(children + 16, node_pointer->zero_hash[depth + 1], 16);
+		node_pointer->hash_provider->hash(children, 32, node_pointer->zero_hash[depth]);
+	}
+	return 0;
+}
+
+// recursive helper method to verify hash data
+// checks the node at offset against the data it covers and walks up to the root
+// stored hashes and the children of internal nodes are read from hash_data, as the hash tree in memory
+// would not show hash_data being corrupted after init_fs loaded it
+// returns the total number of node within hash tree that are incorrect, counting a leaf that cannot be read as one
+// (i.e. returns 0 if hash tree is correct
+static int verify_hash_block_rec(void * helper, int offset, int depth){
+	helper_node * node_pointer = helper;
+	uint8_t buffercalc[16];
+	uint8_t bufferread[16] = {0};
+	
+	if (depth == 0){
+		return 0;
+	}
+	
+	else if (depth == node_pointer->max_depth){
+		// read in data from block in file_data and calculate fletcher
+		scratch_mark mark = scratch_save();
+		void * tmp_file_data = scratch_alloc(node_pointer->block_size);
+		if (tmp_file_data == NULL){ // malloc error, a block that cannot be checked is not trusted
+			scratch_release(mark);
+			return 1;
+		}
+		size_t file_data_offset = (size_t)(offset - node_pointer->leaf_start) << node_pointer->block_shift;
+		
+		read_hashed_data(node_pointer, file_data_offset, node_pointer->block_size, tmp_file_data);
+		
+		SPAN_BEGIN("hash_leaf");
+		node_pointer->hash_leaf(tmp_file_data, node_pointer->block_size, buffercalc);
+		SPAN_END("hash_leaf");
+		
+		// flush buffers for multithreading
+		fflush(node_pointer->file_data);
+		scratch_release(mark);
+	}
+	
+	else{
+		//fletcher block n + n+1
+		// then go up
+		uint8_t children[32] = {0};
+		read_hash_data(node_pointer, (size_t)((offset * 2) + 1) * 16, children, 32);
+		node_pointer->hash_provider->hash(children, 32, buffercalc);
+	}
+	
+	read_hash_data(node_pointer, (size_t)offset * 16, bufferread, 16);
+	if (memcmp(buffercalc, bufferread, 16) != 0){
+		return 1 + verify_hash_block_rec(helper, (int)((offset-1)/2), depth-1);
+	}
+	else{
+		return verify_hash_block_rec(helper, (int)((offset-1)/2), depth-1);
+	}
+}
+
+// helper function to verify hash tree from starting block
+// calls recursive helper function for verification of tree
+// returns the total number of node within hash tree that are incorrect
+// (i.e. returns 0 if hash tree is correct
+static int verify_hash_block(size_t block_offset, void * helper) {
+	helper_node * node_pointer = helper;
+	
+	// hashes of volumes opened with direct_io that are not in hash_data yet are written first
+	direct_hash_flush(node_pointer);
+    return verify_hash_block_rec(helper, node_pointer->leaf_start + block_offset, node_pointer->max_depth);
+}
+
+// helper function to find where a filename is, or would go, in the name index
+// returns the index of the first file whose name is not less than filename
+static int name_search(helper_node * node_pointer, char * filename){
+	
+	int low = 0;
+	int high = node_pointer->name_count;
+	
+	while (low < high){
+		int middle = (low + high) / 2;
+		if (strncmp(node_pointer->name_index[middle]->filename, filename, 64) < 0){
+			low = middle + 1;
+		}
+		else{
+			high = middle;
+		}
+	}
+	return low;
+}
+
+// helper function to add a file to the name index
+// returns 0 if successful, returns 1 if unsuccessful (malloc error)
+static int name_index_insert(helper_node * node_pointer, offset_node * file){
+	
+	if (node_pointer->name_count == node_pointer->name_capacity){
+		int new_capacity = (node_pointer->name_capacity == 0) ? 16 : node_pointer->name_capacity * 2;
+		offset_node ** new_index = realloc(node_pointer->name_index, new_capacity * sizeof(offset_node *));
+		if (new_index == NULL){ // malloc error
+			return 1;
+		}
+		node_pointer->name_index = new_index;
+		node_pointer->name_capacity = new_capacity;
+	}
+	
+	int i = name_search(node_pointer, file->filename);
+	memmove(&node_pointer->name_index[i + 1], &node_pointer->name_index[i], (node_pointer->name_count - i) * sizeof(offset_node *));
+	node_pointer->name_index[i] = file;
+	node_pointer->name_count++;
+	return 0;
+}
+
+// helper function to take a file out of the name index
+static void name_index_remove(helper_node * node_pointer, offset_node * file){
+	
+	for (int i = name_search(node_pointer, file->filename); i < node_pointer->name_count; i++){
+		if (node_pointer->name_index[i] == file){
+			memmove(&node_pointer->name_index[i], &node_pointer->name_index[i + 1], (node_pointer->name_count - i - 1) * sizeof(offset_node *));
+			node_pointer->name_count--;
+			return;
+		}
+	}
+}
+
+// helper function to see if filename exists
+// returns 0 if file exists, 1 if it doesn't exist
+static int does_filename_exist(void * helper, char * filename){
+	
+	helper_node * node_pointer = helper;
+	int i = name_search(node_pointer, filename);
+	
+	if (i < node_pointer->name_count && strncmp(node_pointer->name_index[i]->filename, filename, 64) == 0){
+		// file exists
+		return 0;
+	}
+	
+	// file doesn't exist
+	return 1;
+}
+
+// number of bytes of file_data read per fread when rebuilding the whole hash tree
+#define REBUILD_CHUNK_SIZE (4 * 1024 * 1024)
+
+// rebuilds the entire hash tree from file_data and writes it to hash_data
+// file_data is read sequentially in REBUILD_CHUNK_SIZE chunks and every leaf in a chunk is hashed,
+// then the internal nodes are built bottom-up one level at a time in virtual memory
+// (children of node i are 2i+1 and 2i+2, so walking i downwards finishes each level before its parents)
+// and the finished tree is written to hash_data in a single sequential pass
+// returns 0 if successful, returns 1 if unsuccessful (malloc error)
+static int rebuild_hash_tree(void * helper){
+	
+	helper_node * node_pointer = helper;
+	int leaf_start = node_pointer->leaf_start;
+	
+	size_t chunk_size = REBUILD_CHUNK_SIZE;
+	if (chunk_size > node_pointer->total_space){
+		chunk_size = node_pointer->total_space;
+	}
+	
+	scratch_mark mark = scratch_save();
+	uint8_t * chunk = scratch_alloc(chunk_size);
+	if (chunk == NULL){ // malloc error
+		return 1;
+	}
+	SPAN_BEGIN("rebuild_hash_tree");
+	
+	// unwritten ranges are hashed as zeros
+	if (build_unwritten_map(node_pointer) != 0){ // malloc error
+		SPAN_END("rebuild_hash_tree");
+		scratch_release(mark);
+		return 1;
+	}
+	uint8_t * zero_block_hash = node_pointer->zero_hash[node_pointer->max_depth];
+	
+	// hash all leaves, one chunk of file_data at a time
+	int block = 0;
+	while (block < node_pointer->number_of_blocks){
+		size_t chunk_offset = (size_t)block << node_pointer->block_shift;
+		read_hashed_data(node_pointer, chunk_offset, chunk_size, chunk);
+		
+		int chunk_blocks = chunk_size >> node_pointer->block_shift;
+		for (int i = 0; i < chunk_blocks && block < node_pointer->number_of_blocks; i++, block++){
+			if (is_unwritten(node_pointer, chunk_offset + ((size_t)i << node_pointer->block_shift), node_pointer->block_size)){
+				memcpy(tree_node(node_pointer, leaf_start + block), zero_block_hash, 16);
+				continue;
+			}
+			SPAN_BEGIN("hash_leaf");
+			node_pointer->hash_leaf(chunk + ((size_t)i << node_pointer->block_shift), node_pointer->block_size, tree_node(node_pointer, leaf_start + block));
+			SPAN_END("hash_leaf");
+		}
+	}
+	scratch_release(mark);
+	
+	// build internal nodes level by level from the bottom up
+	// parents of two zero filled subtrees take the cached zero hash for their depth
+	int depth = node_pointer->max_depth - 1;
+	for (int i = leaf_start - 1; i >= 0; i--){
+		while (i < (1 << depth) - 1){
+			depth--;
+		}
+		uint8_t * left = tree_node(node_pointer, (i * 2) + 1);
+		uint8_t * right = tree_node(node_pointer, (i * 2) + 2);
+		if (memcmp(left, node_pointer->zero_hash[depth + 1], 16) == 0 && memcmp(right, node_pointer->zero_hash[depth + 1], 16) == 0){
+			memcpy(tree_node(node_pointer, i), node_pointer->zero_hash[depth], 16);
+			continue;
+		}
+		hash_children(node_pointer, i, tree_node(node_pointer, i));
+	}
+	
+	// write whole tree to hash_data
+	write_hash_tree(node_pointer);
+	
+	// every leaf is up to date now
+	if (node_pointer->dirty_leaves != NULL){
+		memset(node_pointer->dirty_leaves, 0, ((node_pointer->number_of_blocks + 63) / 64) * sizeof(uint64_t));
+	}
+	node_pointer->dirty_count = 0;
+	node_pointer->tree_stale = 0;
+	SPAN_END("rebuild_hash_tree");
+	return 0;
+}
+
+// helper function to rebuild the hash tree after extents or unwritten ranges changed
+// in deferred consistency mode the tree is only marked stale and rebuilt by the next sync_hash_blocks
+// returns 0 if successful, returns 1 if unsuccessful (malloc error)
+static int hash_tree_changed(void * helper){
+	
+	helper_node * node_pointer = helper;
+	
+	if (node_pointer->hash_consistency == FS_CONSISTENCY_DEFERRED){
+		node_pointer->tree_stale = 1;
+		return 0;
+	}
+	return rebuild_hash_tree(helper);
+}
+
+// helper function to mark the leaves covering [offset, offset + length) of file_data as dirty
+static void mark_dirty_leaves(helper_node * node_pointer, size_t offset, size_t length){
+	
+	int first = offset >> node_pointer->block_shift;
+	int last = (offset + length - 1) >> node_pointer->block_shift;
+	
+	for (int block = first; block <= last; block++){
+		uint64_t bit = (uint64_t)1 << (block & 63);
+		if ((node_pointer->dirty_leaves[block >> 6] & bit) == 0){
+			node_pointer->dirty_leaves[block >> 6] |= bit;
+			node_pointer->dirty_count++;
+		}
+	}
+}
+
+// helper function to hash again the dirty leaves among blocks [first, last] and every node above them
+// the leaves are taken in order so each level is worked out from the one below and a parent
+// shared by several dirty leaves is hashed once, the whole tree is rebuilt instead if it is stale
+// returns 0 if successful, returns 1 if unsuccessful (malloc error)
+static int sync_hash_blocks(helper_node * node_pointer, int first, int last){
+	
+	if (node_pointer->tree_stale){
+		return rebuild_hash_tree(node_pointer);
+	}
+	if (node_pointer->dirty_count == 0){
+		return 0;
+	}
+	
+	scratch_mark mark = scratch_save();
+	long * nodes = scratch_alloc(node_pointer->dirty_count * sizeof(long));
+	uint8_t * block_data = scratch_alloc(node_pointer->block_size);
+	if (nodes == NULL || block_data == NULL){ // malloc error
+		scratch_release(mark);
+		return 1;
+	}
+	SPAN_BEGIN("sync_hash_blocks");
+	
+	// hash the dirty leaves, skipping 64 clean blocks at a time
+	int number_of_nodes = 0;
+	int block = first;
+	while (block <= last){
+		uint64_t word = node_pointer->dirty_leaves[block >> 6] >> (block & 63);
+		if (word == 0){
+			block = (block | 63) + 1;
+			continue;
+		}
+		block += __builtin_ctzll(word);
+		if (block > last){
+			break;
+		}
+		node_pointer->dirty_leaves[block >> 6] &= ~((uint64_t)1 << (block & 63));
+		node_pointer->dirty_count--;
+		
+		long index = node_pointer->leaf_start + block;
+		read_hashed_data(node_pointer, (size_t)block << node_pointer->block_shift, node_pointer->block_size, block_data);
+		SPAN_BEGIN("hash_leaf");
+		node_pointer->hash_leaf(block_data, node_pointer->block_size, tree_node(node_pointer, index));
+		SPAN_END("hash_leaf");
+		write_tree_node(node_pointer, index);
+		nodes[number_of_nodes++] = index;
+		block++;
+	}
+	
+	// hash the parents of the nodes below, one level at a time up to the root
+	while (number_of_nodes > 0 && nodes[0] > 0){
+		int number_of_parents = 0;
+		for (int i = 0; i < number_of_nodes; i++){
+			long parent = (nodes[i] - 1) / 2;
+			if (number_of_parents == 0 || nodes[number_of_parents - 1] != parent){
+				nodes[number_of_parents++] = parent;
+			}
+		}
+		number_of_nodes = number_of_parents;
+		for (int i = 0; i < number_of_nodes; i++){
+			hash_children(node_pointer, nodes[i], tree_node(node_pointer, nodes[i]));
+			write_tree_node(node_pointer, nodes[i]);
+		}
+	}
+	scratch_release(mark);
+	SPAN_END("sync_hash_blocks");
+	return 0;
+}
+
+// helper function to hash again the leaves covering [offset, offset + length) of file_data and every node above them
+// each level is worked out from the one below, so each node is hashed once, and changed nodes are written to hash_data
+static void update_hash_range(helper_node * node_pointer, size_t offset, size_t length){
+	
+	if (length == 0){
+		return;
+	}
+	
+	// in deferred consistency mode the leaves are hashed by the next sync_hash_blocks
+	if (node_pointer->hash_consistency == FS_CONSISTENCY_DEFERRED){
+		mark_dirty_leaves(node_pointer, offset, length);
+		return;
+	}
+	
+	scratch_mark mark = scratch_save();
+	uint8_t * block_data = scratch_alloc(node_pointer->block_size);
+	if (block_data == NULL){ // malloc error
+		return;
+	}
+	SPAN_BEGIN("update_hash_range");
+	
+	long low = node_pointer->leaf_start + (long)(offset >> node_pointer->block_shift);
+	long high = node_pointer->leaf_start + (long)((offset + length - 1) >> node_pointer->block_shift);
+	for (long i = low; i <= high; i++){
+		read_hashed_data(node_pointer, (size_t)(i - node_pointer->leaf_start) << node_pointer->block_shift, node_pointer->block_size, block_data);
+		SPAN_BEGIN("hash_leaf");
+		node_pointer->hash_leaf(block_data, node_pointer->block_size, tree_node(node_pointer, i));
+		SPAN_END("hash_leaf");
+		write_tree_node(node_pointer, i);
+	}
+	scratch_release(mark);
+	
+	while (low > 0){
+		low = (low - 1) / 2;
+		high = (high - 1) / 2;
+		for (long i = low; i <= high; i++){
+			hash_children(node_pointer, i, tree_node(node_pointer, i));
+			write_tree_node(node_pointer, i);
+		}
+	}
+	SPAN_END("update_hash_range");
+}
+
+// helper function to bring the whole hash tree up to date with file_data
+// returns 0 if successful, returns 1 if unsuccessful (malloc error)
+static int sync_hash_tree(helper_node * node_pointer){
+	return sync_hash_blocks(node_pointer, 0, node_pointer->number_of_blocks - 1);
+}
+
+// returns the time in milliseconds, for write_back_delay and the scrubber
+static long current_milliseconds(void){
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec * 1000L) + (now.tv_nsec / 1000000L);
+}
+
+// returns the time in nanoseconds, for traces
+static uint64_t trace_clock(void){
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return ((uint64_t)now.tv_sec * 1000000000ULL) + now.tv_nsec;
+}
+
+// leaves of file_data verified together by the scrubber, the subtree they make up shares a last verified time
+#define SCRUB_SUBTREE_BLOCKS 64
+
+// helper function to record whether the scrubber found a block corrupt, keeping corrupt_blocks in order
+// returns 0 if successful, returns 1 if unsuccessful (malloc error)
+static int record_scrubbed_block(helper_node * node_pointer, int block, int corrupt){
+	
+	int low = 0;
+	int high = node_pointer->corrupt_count;
+	while (low < high){
+		int middle = (low + high) / 2;
+		if (node_pointer->corrupt_blocks[middle] < block){
+			low = middle + 1;
+		}
+		else{
+			high = middle;
+		}
+	}
+	int listed = (low < node_pointer->corrupt_count && node_pointer->corrupt_blocks[low] == block);
+	
+	if (corrupt && !listed){
+		if (node_pointer->corrupt_count == node_pointer->corrupt_capacity){
+			int new_capacity = (node_pointer->corrupt_capacity == 0) ? 16 : node_pointer->corrupt_capacity * 2;
+			int * new_blocks = realloc(node_pointer->corrupt_blocks, new_capacity * sizeof(int));
+			if (new_blocks == NULL){ // malloc error
+				return 1;
+			}
+			node_pointer->corrupt_blocks = new_blocks;
+			node_pointer->corrupt_capacity = new_capacity;
+		}
+		memmove(&node_pointer->corrupt_blocks[low + 1], &node_pointer->corrupt_blocks[low], (node_pointer->corrupt_count - low) * sizeof(int));
+		node_pointer->corrupt_blocks[low] = block;
+		node_pointer->corrupt_count++;
+	}
+	else if (!corrupt && listed){
+		memmove(&node_pointer->corrupt_blocks[low], &node_pointer->corrupt_blocks[low + 1], (node_pointer->corrupt_count - low - 1) * sizeof(int));
+		node_pointer->corrupt_count--;
+	}
+	return 0;
+}
+
+// helper function to verify every block of a subtree against hash_data, recording the results
+// returns the number of corrupt blocks in the subtree
+static int scrub_subtree(helper_node * node_pointer, int subtree){
+	
+	int first = subtree * SCRUB_SUBTREE_BLOCKS;
+	int last = first + SCRUB_SUBTREE_BLOCKS - 1;
+	if (last >= node_pointer->number_of_blocks){
+		last = node_pointer->number_of_blocks - 1;
+	}
+	
+	// hashes deferred for these blocks are worked out before they are checked
+	sync_hash_blocks(node_pointer, first, last);
+	int corrupt_blocks = 0;
+	for (int block = first; block <= last; block++){
+		int corrupt = (verify_hash_block(block, node_pointer) != 0);
+		record_scrubbed_block(node_pointer, block, corrupt);
+		corrupt_blocks += corrupt;
+	}
+	
+	node_pointer->scrub_times[subtree] = (corrupt_blocks == 0) ? current_milliseconds() : 0;
+	return corrupt_blocks;
+}
+
+// helper function to check if a read can trust a block without verifying it,
+// because the scrubber found its subtree matching hash_data in the last scrub_trust milliseconds
+// returns 1 if it can, returns 0 otherwise
+static int scrub_trusted(helper_node * node_pointer, int block){
+	
+	if (node_pointer->scrub_trust <= 0){
+		return 0;
+	}
+	long verified = node_pointer->scrub_times[block / SCRUB_SUBTREE_BLOCKS];
+	return verified != 0 && current_milliseconds() - verified <= node_pointer->scrub_trust;
+}
+
+// helper function to find the first space map entry that ends after offset
+// returns space_count if there is none
+static int space_search(helper_node * node_pointer, int offset){
+	
+	int low = 0;
+	int high = node_pointer->space_count;
+	
+	while (low < high){
+		int middle = (low + high) / 2;
+		space_extent * space_pointer = &node_pointer->space_map[middle];
+		if (space_pointer->offset + space_pointer->length <= offset){
+			low = middle + 1;
+		}
+		else{
+			high = middle;
+		}
+	}
+	return low;
+}
+
+// helper function to append a piece to a list of space map entries, merging it with the previous piece if possible
+// pieces with no references are dropped as they are free space
+static void add_space_piece(space_extent * pieces, int * number_of_pieces, int offset, int length, int references){
+	
+	if (length <= 0 || references <= 0){
+		return;
+	}
+	
+	if (*number_of_pieces > 0){
+		space_extent * previous = &pieces[*number_of_pieces - 1];
+		if (previous->offset + previous->length == offset && previous->references == references){
+			previous->length += length;
+			return;
+		}
+	}
+	
+	pieces[*number_of_pieces].offset = offset;
+	pieces[*number_of_pieces].length = length;
+	pieces[*number_of_pieces].references = references;
+	(*number_of_pieces)++;
+}
+
+// helper function to add delta to the number of references to every byte in [offset, offset + length)
+// the space map only holds bytes with at least one reference, filled_space is kept equal to its total length
+// returns 0 if successful, returns 1 if unsuccessful (malloc error)
+static int space_adjust(helper_node * node_pointer, int offset, int length, int delta){
+	
+	if (length <= 0 || delta == 0){
+		return 0;
+	}
+	
+	int end = offset + length;
+	int first = space_search(node_pointer, offset);
+	int last = first;
+	while (last < node_pointer->space_count && node_pointer->space_map[last].offset < end){
+		last++;
+	}
+	
+	// build the entries replacing first to last, split at offset and end
+	space_extent * pieces = malloc(((2 * (last - first)) + 3) * sizeof(space_extent));
+	if (pieces == NULL){ // malloc error
+		return 1;
+	}
+	int number_of_pieces = 0;
+	int position = offset;
+	long filled_change = 0; // applied once the pieces are spliced in, so a malloc error changes nothing
+	
+	for (int i = first; i < last; i++){
+		space_extent * space_pointer = &node_pointer->space_map[i];
+		int space_end = space_pointer->offset + space_pointer->length;
+		
+		if (space_pointer->offset < offset){ // part before offset is unchanged
+			add_space_piece(pieces, &number_of_pieces, space_pointer->offset, offset - space_pointer->offset, space_pointer->references);
+		}
+		if (space_pointer->offset > position){ // free gap becomes used
+			add_space_piece(pieces, &number_of_pieces, position, space_pointer->offset - position, delta);
+			filled_change += space_pointer->offset - position;
+			position = space_pointer->offset;
+		}
+		
+		int stop = (space_end < end) ? space_end : end;
+		add_space_piece(pieces, &number_of_pieces, position, stop - position, space_pointer->references + delta);
+		if (space_pointer->references + delta <= 0){ // used range becomes free
+			filled_change -= stop - position;
+		}
+		position = stop;
+		
+		if (space_end > end){ // part after end is unchanged
+			add_space_piece(pieces, &number_of_pieces, end, space_end - end, space_pointer->references);
+		}
+	}
+	if (position < end){ // free gap at the end becomes used
+		add_space_piece(pieces, &number_of_pieces, position, end - position, delta);
+		filled_change += end - position;
+	}
+	
+	// make room and splice the pieces in
+	int new_count = node_pointer->space_count - (last - first) + number_of_pieces;
+	if (new_count > node_pointer->space_capacity){
+		int new_capacity = (node_pointer->space_capacity == 0) ? 16 : node_pointer->space_capacity * 2;
+		while (new_capacity < new_count){
+			new_capacity *= 2;
+		}
+		space_extent * new_map = realloc(node_pointer->space_map, new_capacity * sizeof(space_extent));
+		if (new_map == NULL){ // malloc error
+			free(pieces);
+			return 1;
+		}
+		node_pointer->space_map = new_map;
+		node_pointer->space_capacity = new_capacity;
+	}
+	
+	memmove(&node_pointer->space_map[first + number_of_pieces], &node_pointer->space_map[last], (node_pointer->space_count - last) * sizeof(space_extent));
+	memcpy(&node_pointer->space_map[first], pieces, number_of_pieces * sizeof(space_extent));
+	node_pointer->space_count = new_count;
+	node_pointer->filled_space += filled_change;
+	free(pieces);
+	
+	// merge with neighbouring entries
+	int i = (first > 0) ? first - 1 : 0;
+	int stop = first + number_of_pieces;
+	while (i < stop && i + 1 < node_pointer->space_count){
+		space_extent * current = &node_pointer->space_map[i];
+		space_extent * next = &node_pointer->space_map[i + 1];
+		if (current->offset + current->length == next->offset && current->references == next->references){
+			current->length += next->length;
+			memmove(next, next + 1, (node_pointer->space_count - i - 2) * sizeof(space_extent));
+			node_pointer->space_count--;
+			stop--;
+		}
+		else{
+			i++;
+		}
+	}
+	return 0;
+}
+
+// returns the number of bytes of file_data an extent takes
+static inline int extent_stored_length(extent * extent_pointer){
+	return (extent_pointer->flags & EXTENT_COMPRESSED) ? extent_pointer->stored_length : extent_pointer->length;
+}
+
+// helper function to add delta to the references of every extent of a file
+static void reference_file_space(helper_node * node_pointer, offset_node * file, int delta){
+	for (int i = 0; i < file->number_of_extents; i++){
+		space_adjust(node_pointer, file->extents[i].offset, extent_stored_length(&file->extents[i]), delta);
+	}
+}
+
+// helper function to find where the free gap starting at offset ends
+// returns offset if offset is in use
+static int space_gap_end(helper_node * node_pointer, int offset){
+	
+	int i = space_search(node_pointer, offset);
+	
+	if (i == node_pointer->space_count){
+		return node_pointer->total_space;
+	}
+	if (node_pointer->space_map[i].offset <= offset){
+		return offset;
+	}
+	return node_pointer->space_map[i].offset;
+}
+
+// helper function to check if any byte in [offset, offset + length) of file_data is referenced more than once
+// returns 1 if it is shared, returns 0 otherwise
+static int space_shared(helper_node * node_pointer, int offset, int length){
+	
+	int i = space_search(node_pointer, offset);
+	
+	while (i < node_pointer->space_count && node_pointer->space_map[i].offset < offset + length){
+		if (node_pointer->space_map[i].references > 1){
+			return 1;
+		}
+		i++;
+	}
+	return 0;
+}
+
+// helper function to count the bytes of a file that no snapshot or other file references
+// these are the bytes freed if the file is deleted
+static size_t file_owned_space(helper_node * node_pointer, offset_node * file){
+	
+	size_t owned_space = 0;
+	
+	for (int i = 0; i < file->number_of_extents; i++){
+		int offset = file->extents[i].offset;
+		int end = offset + extent_stored_length(&file->extents[i]);
+		
+		for (int j = space_search(node_pointer, offset); j < node_pointer->space_count && node_pointer->space_map[j].offset < end; j++){
+			space_extent * space_pointer = &node_pointer->space_map[j];
+			if (space_pointer->references == 1){
+				int start = (space_pointer->offset > offset) ? space_pointer->offset : offset;
+				int stop = (space_pointer->offset + space_pointer->length < end) ? space_pointer->offset + space_pointer->length : end;
+				owned_space += stop - start;
+			}
+		}
+	}
+	return owned_space;
+}
+
+// helper function to find the first gap in file_data of at least length bytes
+// returns offset of the gap, returns -1 if no gap is large enough
+static int find_free_space(helper_node * node_pointer, size_t length){
+	
+	int position = 0;
+	
+	for (int i = 0; i < node_pointer->space_count; i++){
+		if ((size_t)(node_pointer->space_map[i].offset - position) >= length){
+			return position;
+		}
+		position = node_pointer->space_map[i].offset + node_pointer->space_map[i].length;
+	}
+	
+	if (node_pointer->total_space - position >= length){
+		return position;
+	}
+	return -1;
+}
+
+// helper function to gather free gaps of file_data adding up to length bytes, in offset order
+// the gaps are not referenced, the caller does that when it uses them
+// returns number of gaps written to gaps (allocated by this function), returns -1 if there is not enough free space
+static int find_free_gaps(helper_node * node_pointer, size_t length, extent ** gaps){
+	
+	int number_of_gaps = 0;
+	int position = 0;
+	size_t remaining = length;
+	
+	*gaps = malloc((node_pointer->space_count + 1) * sizeof(extent));
+	if (*gaps == NULL){ // malloc error
+		return -1;
+	}
+	
+	for (int i = 0; i <= node_pointer->space_count && remaining > 0; i++){
+		int gap_end = node_pointer->total_space;
+		if (i < node_pointer->space_count){
+			gap_end = node_pointer->space_map[i].offset;
+		}
+		
+		size_t gap_length = gap_end - position;
+		if (gap_length > remaining){
+			gap_length = remaining;
+		}
+		if (gap_length > 0){
+			(*gaps)[number_of_gaps].offset = position;
+			(*gaps)[number_of_gaps].length = gap_length;
+			(*gaps)[number_of_gaps].file_index = -1;
+			(*gaps)[number_of_gaps].flags = 0;
+			number_of_gaps++;
+			remaining -= gap_length;
+		}
+		
+		if (i < node_pointer->space_count){
+			position = node_pointer->space_map[i].offset + node_pointer->space_map[i].length;
+		}
+	}
+	
+	if (remaining > 0){
+		free(*gaps);
+		*gaps = NULL;
+		return -1;
+	}
+	return number_of_gaps;
+}
+
+// helper function to write zeros to a range of file_data
+// the zeros are written a piece at a time from a static block, so nothing is allocated
+static void zero_file_data(helper_node * node_pointer, int offset, int length){
+	
+	static const uint8_t zeros[65536];
+	while (length > 0){
+		int piece = (length < (int)sizeof(zeros)) ? length : (int)sizeof(zeros);
+		write_file_data(node_pointer, offset, zeros, piece);
+		offset += piece;
+		length -= piece;
+	}
+}
+
+// helper function to write a file's own directory_table entry (name, offset of first extent and total length)
+static void write_file_record(helper_node * node_pointer, offset_node * file){
+	
+	char directory_table_record[72] = {0};
+	strncpy(directory_table_record, file->filename, 64);
+	memcpy(directory_table_record + 64, &file->offset, 4);
+	memcpy(directory_table_record + 68, &file->length, 4);
+	
+	fseek(node_pointer->directory_table, file->file_index, SEEK_SET);
+	fwrite(directory_table_record, 72, 1, node_pointer->directory_table);
+	node_pointer->io_metadata = 1;
+}
+
+// helper function to write the directory_table entry for extent number index of a file
+// the first extent is recorded in the file's own entry
+static void write_extent_record(helper_node * node_pointer, offset_node * file, int index){
+	
+	if (index == 0){
+		write_file_record(node_pointer, file);
+		return;
+	}
+	
+	extent * extent_pointer = &file->extents[index];
+	char directory_table_record[72] = {0};
+	directory_table_record[0] = EXTENT_RECORD_MARKER;
+	directory_table_record[1] = extent_pointer->flags;
+	memcpy(directory_table_record + 4, &file->file_index, 4);
+	memcpy(directory_table_record + 8, &index, 4);
+	if (extent_pointer->flags & EXTENT_COMPRESSED){
+		memcpy(directory_table_record + 12, &extent_pointer->stored_length, 4);
+	}
+	memcpy(directory_table_record + 64, &extent_pointer->offset, 4);
+	memcpy(directory_table_record + 68, &extent_pointer->length, 4);
+	
+	fseek(node_pointer->directory_table, extent_pointer->file_index, SEEK_SET);
+	fwrite(directory_table_record, 72, 1, node_pointer->directory_table);
+	node_pointer->io_metadata = 1;
+}
+
+// helper function to free a directory_table entry
+static void clear_record(helper_node * node_pointer, int file_index){
+	char null_byte = '\0';
+	fseek(node_pointer->directory_table, file_index, SEEK_SET);
+	fwrite(&null_byte, 1, 1, node_pointer->directory_table);
+	node_pointer->io_metadata = 1;
+}
+
+// helper function to append an extent to a file, the caller updates the file's length
+// returns 0 if successful, returns 1 if unsuccessful (malloc error)
+static int append_extent(offset_node * file, int offset, int length, int file_index, int flags){
+	
+	if (file->number_of_extents == file->extent_capacity){
+		int new_capacity = (file->extent_capacity == 0) ? 1 : file->extent_capacity * 2;
+		extent * new_extents = realloc(file->extents, new_capacity * sizeof(extent));
+		if (new_extents == NULL){ // malloc error
+			return 1;
+		}
+		file->extents = new_extents;
+		file->extent_capacity = new_capacity;
+	}
+	
+	file->extents[file->number_of_extents].offset = offset;
+	file->extents[file->number_of_extents].length = length;
+	file->extents[file->number_of_extents].file_index = file_index;
+	file->extents[file->number_of_extents].flags = flags;
+	file->extents[file->number_of_extents].stored_length = length;
+	file->number_of_extents++;
+	return 0;
+}
+
+// LZ77 codec used for compressed extents, in the LZ4 block format:
+// each sequence is a token (literal count in the high 4 bits, match length - 4 in the low 4 bits),
+// extra literal count bytes, the literals, a 2 byte little endian match distance and extra match length bytes
+// counts of 15 or more continue in following bytes, each adding up to 255
+// the last sequence has literals only, and ends the input
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_DISTANCE 65535
+#define LZ_HASH_BITS 12
+
+// returns the most bytes lz_compress can write for length bytes of input
+static inline size_t lz_compress_bound(size_t length){
+	return length + (length / 255) + 16;
+}
+
+// helper function to write the extra bytes of a count of 15 or more
+// returns number of bytes written
+static size_t lz_write_count(uint8_t * output, size_t count){
+	
+	size_t written = 0;
+	while (count >= 255){
+		output[written++] = 255;
+		count -= 255;
+	}
+	output[written++] = count;
+	return written;
+}
+
+// helper function to write one sequence, a match_length of 0 writes the last sequence
+// returns number of bytes written
+static size_t lz_write_sequence(uint8_t * output, const uint8_t * literals, size_t literal_count, size_t distance, size_t match_length){
+	
+	size_t written = 1;
+	size_t literal_nibble = (literal_count < 15) ? literal_count : 15;
+	size_t match_nibble = 0;
+	if (match_length > 0){
+		match_nibble = (match_length - LZ_MIN_MATCH < 15) ? match_length - LZ_MIN_MATCH : 15;
+	}
+	output[0] = (literal_nibble << 4) | match_nibble;
+	
+	if (literal_nibble == 15){
+		written += lz_write_count(output + written, literal_count - 15);
+	}
+	memcpy(output + written, literals, literal_count);
+	written += literal_count;
+	
+	if (match_length > 0){
+		output[written++] = distance & 0xff;
+		output[written++] = distance >> 8;
+		if (match_nibble == 15){
+			written += lz_write_count(output + written, match_length - LZ_MIN_MATCH - 15);
+		}
+	}
+	return written;
+}
+
+// compresses length bytes of input into output, which has room for lz_compress_bound(length) bytes
+// matches are found greedily through a hash table of the last position of every 4 byte sequence
+// returns the compressed length
+static size_t lz_compress(const uint8_t * input, size_t length, uint8_t * output){
+	
+	uint32_t table[1 << LZ_HASH_BITS] = {0};
+	size_t position = 0;
+	size_t anchor = 0;
+	size_t written = 0;
+	
+	while (position + LZ_MIN_MATCH <= length){
+		uint32_t sequence;
+		memcpy(&sequence, input + position, 4);
+		uint32_t hash = (sequence * 2654435761U) >> (32 - LZ_HASH_BITS);
+		size_t candidate = table[hash];
+		table[hash] = position;
+		
+		if (candidate < position && position - candidate <= LZ_MAX_DISTANCE && memcmp(input + candidate, input + position, LZ_MIN_MATCH) == 0){
+			size_t match_length = LZ_MIN_MATCH;
+			while (position + match_length < length && input[candidate + match_length] == input[position + match_length]){
+				match_length++;
+			}
+			written += lz_write_sequence(output + written, input + anchor, position - anchor, position - candidate, match_length);
+			position += match_length;
+			anchor = position;
+		}
+		else{
+			position++;
+		}
+	}
+	
+	written += lz_write_sequence(output + written, input + anchor, length - anchor, 0, 0);
+	return written;
+}
+
+// helper function to read the extra bytes of a count of 15 or more
+// returns 0 if successful, returns 1 if the input ends first
+static int lz_read_count(const uint8_t * input, size_t length, size_t * position, size_t * count){
+	
+	uint8_t byte;
+	do{
+		if (*position >= length){
+			return 1;
+		}
+		byte = input[(*position)++];
+		*count += byte;
+	} while (byte == 255);
+	return 0;
+}
+
+// decompresses length bytes of input into output, which has room for capacity bytes
+// returns the decompressed length, returns -1 if the input is not valid or does not fit
+static long lz_decompress(const uint8_t * input, size_t length, uint8_t * output, size_t capacity){
+	
+	size_t position = 0;
+	size_t written = 0;
+	
+	while (position < length){
+		uint8_t token = input[position++];
+		
+		size_t literal_count = token >> 4;
+		if (literal_count == 15 && lz_read_count(input, length, &position, &literal_count) != 0){
+			return -1;
+		}
+		if (literal_count > length - position || literal_count > capacity - written){
+			return -1;
+		}
+		memcpy(output + written, input + position, literal_count);
+		position += literal_count;
+		written += literal_count;
+		
+		if (position == length){ // last sequence
+			break;
+		}
+		
+		if (length - position < 2){
+			return -1;
+		}
+		size_t distance = input[position] | (input[position + 1] << 8);
+		position += 2;
+		size_t match_length = token & 15;
+		if (match_length == 15 && lz_read_count(input, length, &position, &match_length) != 0){
+			return -1;
+		}
+		match_length += LZ_MIN_MATCH;
+		if (distance == 0 || distance > written || match_length > capacity - written){
+			return -1;
+		}
+		
+		// copy one byte at a time as the match can overlap the bytes it writes
+		for (size_t i = 0; i < match_length; i++){
+			output[written + i] = output[written - distance + i];
+		}
+		written += match_length;
+	}
+	return written;
+}
+
+// helper function to read count bytes starting at offset of the data of a compressed extent
+// returns 0 if successful, returns 1 if the file_data does not decompress (buf is zero filled)
+static int read_compressed_extent(helper_node * node_pointer, extent * extent_pointer, size_t offset, size_t count, void * buf){
+	
+	scratch_mark mark = scratch_save();
+	uint8_t * stored = scratch_alloc(extent_pointer->stored_length);
+	uint8_t * chunk = scratch_alloc(COMPRESSION_CHUNK_SIZE);
+	if (stored == NULL || chunk == NULL){ // malloc error
+		scratch_release(mark);
+		memset(buf, 0, count);
+		return 1;
+	}
+	
+	read_file_data(node_pointer, extent_pointer->offset, stored, extent_pointer->stored_length);
+	long chunk_length = lz_decompress(stored, extent_pointer->stored_length, chunk, COMPRESSION_CHUNK_SIZE);
+	
+	int return_value = 0;
+	if (chunk_length < 0 || (size_t)chunk_length < offset + count){
+		memset(buf, 0, count);
+		return_value = 1;
+	}
+	else{
+		memcpy(buf, chunk + offset, count);
+	}
+	
+	scratch_release(mark);
+	return return_value;
+}
+
+// helper function to read or write count bytes of a file starting at offset, following its extents
+// the caller checks that the range is within the file, and materializes unwritten extents
+// and expands compressed extents before writing
+static void file_data_io(helper_node * node_pointer, offset_node * file, size_t offset, size_t count, void * buf, int write){
+	
+	size_t extent_start = 0;
+	
+	SPAN_BEGIN("file_data_io");
+	for (int i = 0; i < file->number_of_extents && count > 0; i++){
+		extent * extent_pointer = &file->extents[i];
+		size_t extent_end = extent_start + extent_pointer->length;
+		
+		if (offset < extent_end){
+			size_t extent_offset = offset - extent_start;
+			size_t extent_count = extent_end - offset;
+			if (extent_count > count){
+				extent_count = count;
+			}
+			
+			if (write){
+				write_file_data(node_pointer, extent_pointer->offset + extent_offset, buf, extent_count);
+			}
+			else if (extent_pointer->flags & EXTENT_UNWRITTEN){
+				memset(buf, 0, extent_count);
+			}
+			else if (extent_pointer->flags & EXTENT_COMPRESSED){
+				read_compressed_extent(node_pointer, extent_pointer, extent_offset, extent_count, buf);
+			}
+			else{
+				read_file_data(node_pointer, extent_pointer->offset + extent_offset, buf, extent_count);
+			}
+			
+			buf = (uint8_t *) buf + extent_count;
+			offset += extent_count;
+			count -= extent_count;
+		}
+		extent_start = extent_end;
+	}
+	SPAN_END("file_data_io");
+}
+
+// largest number of bytes of file_data moved by one worker at a time when repacking
+#define REPACK_CHUNK_SIZE (4 * 1024 * 1024)
+
+// bytes of file_data repack moves before giving way to foreground calls
+#define REPACK_SLICE_SIZE (16 * 1024 * 1024)
+
+// define where a used range of file_data moves to when repacking
+typedef struct repack_move{
+	int old_offset;
+	int new_offset;
+	int length;
+} repack_move;
+
+// define a chunk of a used range of file_data that moves left when repacking
+// a chunk is in a later wave than every chunk whose data it writes over, so chunks of one wave can move at once
+typedef struct repack_chunk{
+	off_t old_offset;
+	off_t new_offset;
+	size_t length;
+	int wave;
+} repack_chunk;
+
+// define the chunks of one wave, shared by the threads moving them
+typedef struct repack_work{
+	repack_chunk * chunks;
+	int next; // next chunk to be taken by a thread
+	int end;
+	int fd;
+	int failed;
+	pthread_mutex_t lock;
+} repack_work;
+
+// helper function to order chunks by wave, then by offset
+static int compare_repack_chunks(const void * a, const void * b){
+	
+	const repack_chunk * first = a;
+	const repack_chunk * second = b;
+	
+	if (first->wave != second->wave){
+		return (first->wave < second->wave) ? -1 : 1;
+	}
+	return (first->old_offset < second->old_offset) ? -1 : (first->old_offset > second->old_offset);
+}
+
+// helper function to copy length bytes from in_offset of one file descriptor to out_offset of another
+// the kernel copies the data where it can (kernel_copy is 0 for overlapping ranges of one file, which
+// copy_file_range cannot copy), anything left is read into buffer and written REPACK_CHUNK_SIZE bytes at a time
+// returns 0 if successful, returns 1 if unsuccessful
+static int copy_fd_range(int in_fd, off_t in_offset, int out_fd, off_t out_offset, size_t length, uint8_t * buffer, int kernel_copy){
+	
+#ifdef __linux__
+	while (kernel_copy && length > 0){
+		ssize_t copied = copy_file_range(in_fd, &in_offset, out_fd, &out_offset, length, 0);
+		if (copied <= 0){
+			break;
+		}
+		length -= copied;
+	}
+#endif
+	
+	while (length > 0){
+		if (buffer == NULL){ // malloc error
+			return 1;
+		}
+		size_t chunk = (length < REPACK_CHUNK_SIZE) ? length : REPACK_CHUNK_SIZE;
+		for (size_t done = 0; done < chunk;){
+			ssize_t bytes = pread(in_fd, buffer + done, chunk - done, in_offset + done);
+			if (bytes <= 0){
+				return 1;
+			}
+			done += bytes;
+		}
+		for (size_t done = 0; done < chunk;){
+			ssize_t bytes = pwrite(out_fd, buffer + done, chunk - done, out_offset + done);
+			if (bytes <= 0){
+				return 1;
+			}
+			done += bytes;
+		}
+		in_offset += chunk;
+		out_offset += chunk;
+		length -= chunk;
+	}
+	return 0;
+}
+
+// helper function to move one chunk of file_data
+// a chunk moving over part of itself is read whole and then written
+// returns 0 if successful, returns 1 if unsuccessful
+static int move_repack_chunk(int fd, repack_chunk * chunk, uint8_t * buffer){
+	int overlapping = chunk->old_offset < chunk->new_offset + (off_t)chunk->length;
+	return copy_fd_range(fd, chunk->old_offset, fd, chunk->new_offset, chunk->length, buffer, !overlapping);
+}
+
+// helper function run by each thread moving a wave of chunks, takes chunks until none are left
+static void * repack_worker(void * arg){
+	
+	repack_work * work = arg;
+	uint8_t * buffer = malloc(REPACK_CHUNK_SIZE);
+	
+	while (1){
+		pthread_mutex_lock(&work->lock);
+		int i = work->next++;
+		pthread_mutex_unlock(&work->lock);
+		if (i >= work->end){
+			break;
+		}
+		
+		if (move_repack_chunk(work->fd, &work->chunks[i], buffer) != 0){
+			pthread_mutex_lock(&work->lock);
+			work->failed = 1;
+			pthread_mutex_unlock(&work->lock);
+		}
+	}
+	free(buffer);
+	return NULL;
+}
+
+// helper function to split the moves of repacking into chunks and move them with up to n_processors threads
+// moves are in offset order and only ever move left, so a chunk can only write over data of earlier chunks:
+// each chunk waits for the earlier chunks it writes over, and chunks with nothing to wait for move together
+// returns 0 if successful, returns 1 if unsuccessful
+static int move_repack_chunks(helper_node * node_pointer, repack_move * moves, int number_of_moves){
+	
+	int number_of_chunks = 0;
+	for (int i = 0; i < number_of_moves; i++){
+		if (moves[i].old_offset != moves[i].new_offset){
+			number_of_chunks += (moves[i].length + REPACK_CHUNK_SIZE - 1) / REPACK_CHUNK_SIZE;
+		}
+	}
+	if (number_of_chunks == 0){
+		return 0;
+	}
+	
+	repack_chunk * chunks = malloc(number_of_chunks * sizeof(repack_chunk));
+	pthread_t * threads = malloc(node_pointer->n_processors * sizeof(pthread_t));
+	if (chunks == NULL || threads == NULL){ // malloc error
+		free(chunks);
+		free(threads);
+		return 1;
+	}
+	
+	// plan every chunk and the wave it moves in
+	int chunk_count = 0;
+	for (int i = 0; i < number_of_moves; i++){
+		if (moves[i].old_offset == moves[i].new_offset){
+			continue;
+		}
+		for (int moved = 0; moved < moves[i].length; moved += REPACK_CHUNK_SIZE){
+			repack_chunk * chunk = &chunks[chunk_count];
+			chunk->old_offset = moves[i].old_offset + moved;
+			chunk->new_offset = moves[i].new_offset + moved;
+			chunk->length = moves[i].length - moved;
+			if (chunk->length > REPACK_CHUNK_SIZE){
+				chunk->length = REPACK_CHUNK_SIZE;
+			}
+			
+			chunk->wave = 0;
+			off_t new_end = chunk->new_offset + chunk->length;
+			for (int j = chunk_count - 1; j >= 0 && chunks[j].old_offset + (off_t)chunks[j].length > chunk->new_offset; j--){
+				if (chunks[j].old_offset < new_end && chunks[j].wave >= chunk->wave){
+					chunk->wave = chunks[j].wave + 1;
+				}
+			}
+			chunk_count++;
+		}
+	}
+	qsort(chunks, number_of_chunks, sizeof(repack_chunk), compare_repack_chunks);
+	
+	// stdio buffers must not hold data the threads move underneath them
+	fflush(node_pointer->file_data);
+	
+	repack_work work;
+	work.chunks = chunks;
+	work.fd = fileno(node_pointer->file_data);
+	work.failed = 0;
+	pthread_mutex_init(&work.lock, NULL);
+	
+	// move one wave at a time, this thread moves chunks too
+	int start = 0;
+	while (start < number_of_chunks){
+		int end = start;
+		while (end < number_of_chunks && chunks[end].wave == chunks[start].wave){
+			end++;
+		}
+		work.next = start;
+		work.end = end;
+		
+		int number_of_threads = 0;
+		while (number_of_threads < node_pointer->n_processors - 1 && number_of_threads < end - start - 1){
+			if (pthread_create(&threads[number_of_threads], NULL, repack_worker, &work) != 0){
+				break;
+			}
+			number_of_threads++;
+		}
+		repack_worker(&work);
+		for (int i = 0; i < number_of_threads; i++){
+			pthread_join(threads[i], NULL);
+		}
+		start = end;
+	}
+	pthread_mutex_destroy(&work.lock);
+	
+	// flush buffers for multithreading
+	fflush(node_pointer->file_data);
+	
+	free(chunks);
+	free(threads);
+	return work.failed;
+}
+
+// helper function to find where a byte of file_data ends up after repacking
+// moves holds every used range, in offset order
+// bytes in a free gap (zero length extents) go to the end of the packed data before them
+static int repacked_offset(repack_move * moves, int number_of_moves, int offset, int packed_end){
+	
+	int low = 0;
+	int high = number_of_moves;
+	
+	// find first move that ends after offset
+	while (low < high){
+		int middle = (low + high) / 2;
+		if (moves[middle].old_offset + moves[middle].length <= offset){
+			low = middle + 1;
+		}
+		else{
+			high = middle;
+		}
+	}
+	
+	if (low == number_of_moves){
+		return packed_end;
+	}
+	if (moves[low].old_offset <= offset){
+		return moves[low].new_offset + (offset - moves[low].old_offset);
+	}
+	return moves[low].new_offset;
+}
+
+// define a copy of directory_table in memory, changed entries are written back in one fwrite
+typedef struct table_copy{
+	uint8_t * data;
+	long first_changed;
+	long end_changed;
+} table_copy;
+
+// helper function to move every extent of a file to where repacking moved its data
+// the new offsets are recorded in the copy of directory_table for extents that have an entry
+static void repack_file_extents(helper_node * node_pointer, offset_node * file, repack_move * moves, int packed_end, table_copy * table){
+	
+	for (int i = 0; i < file->number_of_extents; i++){
+		extent * extent_pointer = &file->extents[i];
+		int new_offset = repacked_offset(moves, node_pointer->space_count, extent_pointer->offset, packed_end);
+		
+		if (extent_pointer->file_index >= 0 && new_offset != extent_pointer->offset){
+			memcpy(table->data + extent_pointer->file_index + 64, &new_offset, 4);
+			if (extent_pointer->file_index < table->first_changed){
+				table->first_changed = extent_pointer->file_index;
+			}
+			if (extent_pointer->file_index + 72 > table->end_changed){
+				table->end_changed = extent_pointer->file_index + 72;
+			}
+		}
+		extent_pointer->offset = new_offset;
+	}
+	file->offset = file->extents[0].offset;
+}
+
+// helper method for repacking
+// plans where every used range of file_data moves, as far left as possible in offset order,
+// moves the data with move_repack_chunks, then moves every extent with the range it is in
+// and writes the changed directory_table entries in one go
+// a slice (slice_bytes above 0) only moves the first ranges that are not packed yet, until about slice_bytes
+// bytes have moved, so file_data is in a consistent state between slices and their hashes are worked out again here
+// moving every range (slice_bytes of 0) leaves the hash tree stale, the caller rebuilds it with hash_tree_changed
+// returns -1 if no files exist (or a copy failed)
+// returns the number of bytes moved otherwise
+static long repack_slice(void * helper, size_t slice_bytes){
+
+	helper_node * node_pointer = helper;
+	offset_node * offset_tmp_pointer = node_pointer->offset_node;	
+	int last_free_offset = 0;
+	
+	if (offset_tmp_pointer->next == NULL){ //no files exist
+		return -1;
+	}
+	
+	fseek(node_pointer->directory_table, 0, SEEK_END);
+	long table_size = ftell(node_pointer->directory_table);
+	table_copy table;
+	table.data = malloc(table_size);
+	table.first_changed = table_size;
+	table.end_changed = 0;
+	repack_move * moves = malloc((node_pointer->space_count + 1) * sizeof(repack_move));
+	if (moves == NULL || table.data == NULL){ // malloc error
+		free(moves);
+		free(table.data);
+		return -1;
+	}
+	fseek(node_pointer->directory_table, 0, SEEK_SET);
+	fread(table.data, table_size, 1, node_pointer->directory_table);
+	
+	for (int i = 0; i < node_pointer->space_count; i++){
+		moves[i].old_offset = node_pointer->space_map[i].offset;
+		moves[i].new_offset = last_free_offset;
+		moves[i].length = node_pointer->space_map[i].length;
+		last_free_offset = last_free_offset + moves[i].length;
+	}
+	
+	// ranges after the slice stay where they are
+	long moved_bytes = 0;
+	for (int i = 0; i < node_pointer->space_count; i++){
+		if (slice_bytes > 0 && (size_t)moved_bytes >= slice_bytes){
+			moves[i].new_offset = moves[i].old_offset;
+			last_free_offset = moves[i].old_offset + moves[i].length;
+		}
+		if (moves[i].new_offset != moves[i].old_offset){
+			moved_bytes += moves[i].length;
+		}
+	}
+	
+	// nothing is changed if the data could not be moved
+	if (move_repack_chunks(node_pointer, moves, node_pointer->space_count) != 0){
+		free(moves);
+		free(table.data);
+		return -1;
+	}
+	for (int i = 0; i < node_pointer->space_count; i++){
+		node_pointer->space_map[i].offset = moves[i].new_offset;
+	}
+	if (slice_bytes == 0){
+		node_pointer->tree_stale = 1;
+	}
+	
+	// adjust offset of every extent
+	offset_tmp_pointer = offset_tmp_pointer->next;
+	while (offset_tmp_pointer != NULL){
+		repack_file_extents(node_pointer, offset_tmp_pointer, moves, last_free_offset, &table);
+		offset_tmp_pointer = offset_tmp_pointer->next;
+	}
+	
+	// snapshots share the moved ranges so their extents move too
+	snapshot * snapshot_pointer = node_pointer->snapshots;
+	while (snapshot_pointer != NULL){
+		offset_tmp_pointer = snapshot_pointer->files->next;
+		while (offset_tmp_pointer != NULL){
+			repack_file_extents(node_pointer, offset_tmp_pointer, moves, last_free_offset, &table);
+			offset_tmp_pointer = offset_tmp_pointer->next;
+		}
+		snapshot_pointer = snapshot_pointer->next;
+	}
+	
+	// hash again where data moved from and to, with unwritten ranges in their new places
+	if (slice_bytes > 0 && moved_bytes > 0){
+		if (build_unwritten_map(node_pointer) != 0){ // malloc error, the whole tree is hashed again later instead
+			node_pointer->tree_stale = 1;
+		}
+		else{
+			for (int i = 0; i < node_pointer->space_count; i++){
+				if (moves[i].new_offset != moves[i].old_offset){
+					update_hash_range(node_pointer, moves[i].old_offset, moves[i].length);
+					update_hash_range(node_pointer, moves[i].new_offset, moves[i].length);
+				}
+			}
+		}
+	}
+	free(moves);
+	
+	// write data directory
+	if (table.first_changed < table.end_changed){
+		fseek(node_pointer->directory_table, table.first_changed, SEEK_SET);
+		fwrite(table.data + table.first_changed, table.end_changed - table.first_changed, 1, node_pointer->directory_table);
+		node_pointer->io_metadata = 1;
+	}
+	free(table.data);
+	
+	// moved ranges are now contiguous, merge the ones that touch with the same number of references
+	int count = 0;
+	for (int i = 0; i < node_pointer->space_count; i++){
+		space_extent * previous = (count > 0) ? &node_pointer->space_map[count - 1] : NULL;
+		if (previous != NULL && previous->offset + previous->length == node_pointer->space_map[i].offset && previous->references == node_pointer->space_map[i].references){
+			node_pointer->space_map[count - 1].length += node_pointer->space_map[i].length;
+		}
+		else{
+			node_pointer->space_map[count] = node_pointer->space_map[i];
+			count++;
+		}
+	}
+	node_pointer->space_count = count;
+	
+	// flush buffers for multithreading
+	fflush(node_pointer->file_data);
+	fflush(node_pointer->directory_table);
+	fflush(node_pointer->hash_data);
+    return moved_bytes;
+}
+
+// helper method for repacking every used range of file_data at once
+// moved data leaves the hash tree stale, the caller rebuilds it with hash_tree_changed
+// returns 1 if no files exist (or a copy failed)
+// returns 0 if files exist and has repacked successfully
+static int repack_helper(void * helper){
+	SPAN_BEGIN("repack_helper");
+	int return_value = (repack_slice(helper, 0) < 0) ? 1 : 0;
+	SPAN_END("repack_helper");
+	return return_value;
+}
+
+
+// helper method to find free file_index in directory_table at or after start
+// returns the first free file index in directory_table at or after start
+static int find_free_file_index_from(void * helper, int start){
+	
+	helper_node * node_pointer = helper;
+	
+	fseek(node_pointer->directory_table, 0, SEEK_END);
+	int file_directory_table_size = ftell(node_pointer->directory_table);
+	int file_index = start;
+
+	fseek(node_pointer->directory_table, start, SEEK_SET);
+	
+	char buff = '\0';
+	char null_byte = '\0';
+	
+	while(file_index < file_directory_table_size){
+		fread(&buff, 1, 1, node_pointer->directory_table);
+		if (memcmp(&buff, &null_byte, 1) == 0){
+			return file_index;
+		}
+		file_index += 72;
+		fseek(node_pointer->directory_table, 71, SEEK_CUR);
+	}
+	
+	// no free file indexes
+	return -1;
+	
+}
+
+// helper method to find free file_index in directory_table
+// returns the first free file index in directory_table
+static int find_free_file_index(void * helper){
+	return find_free_file_index_from(helper, 0);
+}
+
+// helper method to find count free file indexes in directory_table
+// returns 0 if successful, returns 1 if there are not enough free entries
+static int find_free_file_indexes(void * helper, int count, int * file_indexes){
+	
+	int start = 0;
+	for (int i = 0; i < count; i++){
+		file_indexes[i] = find_free_file_index_from(helper, start);
+		if (file_indexes[i] < 0){
+			return 1;
+		}
+		start = file_indexes[i] + 72;
+	}
+	return 0;
+}
+
+// helper function to take a file node from the slabs, adding a slab if every node is in use
+// the node is zeroed apart from the extent array it kept from its last use
+// returns the node, or NULL if unsuccessful (malloc error)
+static offset_node * take_node(helper_node * node_pointer){
+	
+	if (node_pointer->free_nodes == NULL){
+		node_slab * slab = calloc(1, sizeof(node_slab));
+		if (slab == NULL){ // malloc error
+			return NULL;
+		}
+		slab->next = node_pointer->node_slabs;
+		node_pointer->node_slabs = slab;
+		for (int i = NODE_SLAB_SIZE - 1; i >= 0; i--){
+			slab->nodes[i].next = node_pointer->free_nodes;
+			node_pointer->free_nodes = &slab->nodes[i];
+		}
+	}
+	
+	offset_node * node = node_pointer->free_nodes;
+	node_pointer->free_nodes = node->next;
+	extent * extents = node->extents;
+	int extent_capacity = node->extent_capacity;
+	memset(node, 0, sizeof(offset_node));
+	node->extents = extents;
+	node->extent_capacity = extent_capacity;
+	return node;
+}
+
+// initializes linked list for file nodes
+// nodes are stored in a singly linked lists:
+// list stores offset, length, file index (in directory_data), filename and extents and is sorted based on offset
+// also initializes the empty space map
+static void * init_list(void){
+	
+	helper_node * node_pointer = malloc(sizeof(helper_node));
+	if(node_pointer == NULL) // malloc error
+		return NULL;
+	node_pointer->node_slabs = NULL;
+	node_pointer->free_nodes = NULL;
+
+	// create offset sorted list header
+	offset_node * offset_header = take_node(node_pointer);
+	if(offset_header == NULL){ // malloc error
+		free(node_pointer);
+		return NULL;
+	}
+	offset_header->offset = -1;
+	offset_header->length = -1;
+	offset_header->file_index = -1;
+
+	// attach helper node to both header nodes
+	node_pointer->offset_node = offset_header;
+	
+	node_pointer->hash_tree = NULL;
+	node_pointer->space_map = NULL;
+	node_pointer->space_count = 0;
+	node_pointer->space_capacity = 0;
+	node_pointer->filled_space = 0;
+	node_pointer->snapshots = NULL;
+	node_pointer->next_snapshot_id = 0;
+	node_pointer->unwritten_map = NULL;
+	node_pointer->unwritten_count = 0;
+	node_pointer->name_index = NULL;
+	node_pointer->name_count = 0;
+	node_pointer->name_capacity = 0;
+	node_pointer->write_back_size = 0;
+	node_pointer->write_back_delay = 0;
+	node_pointer->write_back_files = 0;
+	node_pointer->write_back_growth = 0;
+	node_pointer->write_back_oldest = 0;
+	node_pointer->n_processors = 1;
+	node_pointer->handles = NULL;
+	node_pointer->handle_capacity = 0;
+	node_pointer->name_blocks = NULL;
+	memset(node_pointer->free_names, 0, sizeof(node_pointer->free_names));
+	node_pointer->hash_consistency = FS_CONSISTENCY_IMMEDIATE;
+	node_pointer->dirty_leaves = NULL;
+	node_pointer->dirty_count = 0;
+	node_pointer->tree_stale = 0;
+	node_pointer->scrub_rate = 0;
+	node_pointer->scrub_trust = 0;
+	node_pointer->scrub_running = 0;
+	node_pointer->scrub_next = 0;
+	node_pointer->scrub_times = NULL;
+	node_pointer->corrupt_blocks = NULL;
+	node_pointer->corrupt_count = 0;
+	node_pointer->corrupt_capacity = 0;
+	node_pointer->direct_file_data.fd = -1;
+	node_pointer->direct_hash_data.fd = -1;
+	node_pointer->direct_pool_count = 0;
+	node_pointer->direct_hash_dirty = NULL;
+	node_pointer->direct_hash_dirty_count = 0;
+	node_pointer->read_ahead_size = 0;
+	memset(node_pointer->read_ahead_streams, 0, sizeof(node_pointer->read_ahead_streams));
+	node_pointer->read_ahead_uses = 0;
+	node_pointer->read_ahead_running = 0;
+	node_pointer->read_ahead_pending = 0;
+	node_pointer->shared = NULL;
+	node_pointer->entry_generations = NULL;
+	node_pointer->shared_entries = 0;
+	node_pointer->io_changing = 0;
+	node_pointer->io_metadata = 0;
+	node_pointer->changes = 0;
+	node_pointer->trace = NULL;
+	node_pointer->trace_names = NULL;
+	node_pointer->trace_name_count = 0;
+	node_pointer->trace_name_capacity = 0;
+#ifdef FS_TRACE_SPANS
+	node_pointer->span_path = NULL;
+	node_pointer->span_start = trace_clock();
+#endif
+	
+	// init mutex and io scheduler
+	pthread_mutex_init(&node_pointer->list_lock, NULL);
+	pthread_mutex_init(&node_pointer->io_lock, NULL);
+	pthread_cond_init(&node_pointer->io_turn, NULL);
+	memset(node_pointer->io_waiting, 0, sizeof(node_pointer->io_waiting));
+	node_pointer->io_busy = 0;
+	pthread_cond_init(&node_pointer->read_ahead_wake, NULL);
+	pthread_mutex_init(&node_pointer->trace_lock, NULL);
+	pthread_cond_init(&node_pointer->scrub_wake, NULL);
+	return (void *) node_pointer;
+}
+
+// helper function to find which slot size a name of name_length characters takes in the name arena
+static int name_slot_size(size_t name_length){
+	return (4 + name_length + 1 + 7) / 8 - 1;
+}
+
+// helper function to copy a filename into the name arena
+// returns the copy, which has one reference, or NULL if unsuccessful (malloc error)
+static char * intern_name(helper_node * node_pointer, char * filename){
+	
+	size_t name_length = strnlen(filename, 63);
+	int slot_size = name_slot_size(name_length);
+	
+	// reuse a freed slot of the same size, or take the next one from the newest block
+	char * slot = node_pointer->free_names[slot_size];
+	if (slot != NULL){
+		memcpy(&node_pointer->free_names[slot_size], slot, sizeof(char *));
+	}
+	else{
+		name_block * block = node_pointer->name_blocks;
+		if (block == NULL || block->used + (slot_size + 1) * 8 > NAME_BLOCK_SIZE){
+			block = malloc(sizeof(name_block));
+			if (block == NULL){ // malloc error
+				return NULL;
+			}
+			block->next = node_pointer->name_blocks;
+			block->used = 0;
+			node_pointer->name_blocks = block;
+		}
+		slot = block->data + block->used;
+		block->used += (slot_size + 1) * 8;
+	}
+	
+	uint32_t references = 1;
+	memcpy(slot, &references, 4);
+	memcpy(slot + 4, filename, name_length);
+	slot[4 + name_length] = '\0';
+	return slot + 4;
+}
+
+// helper function to add a reference to a name in the name arena
+// returns the name
+static char * share_name(char * name){
+	
+	uint32_t references;
+	memcpy(&references, name - 4, 4);
+	references++;
+	memcpy(name - 4, &references, 4);
+	return name;
+}
+
+// helper function to drop a reference to a name in the name arena, its slot is freed with the last one
+static void release_name(helper_node * node_pointer, char * name){
+	
+	if (name == NULL){
+		return;
+	}
+	
+	uint32_t references;
+	memcpy(&references, name - 4, 4);
+	references--;
+	if (references > 0){
+		memcpy(name - 4, &references, 4);
+		return;
+	}
+	
+	char * slot = name - 4;
+	int slot_size = name_slot_size(strlen(name));
+	memcpy(slot, &node_pointer->free_names[slot_size], sizeof(char *));
+	node_pointer->free_names[slot_size] = slot;
+}
+
+// helper function to give a file node back to the slabs, releasing its name
+static void give_node(helper_node * node_pointer, offset_node * node){
+	
+	release_name(node_pointer, node->filename);
+	node->filename = NULL;
+	node->number_of_extents = 0;
+	node->next = node_pointer->free_nodes;
+	node_pointer->free_nodes = node;
+}
+
+// helper function to free every slab of file nodes and the extent arrays of their nodes
+static void free_node_slabs(helper_node * node_pointer){
+	
+	while (node_pointer->node_slabs != NULL){
+		node_slab * next_slab = node_pointer->node_slabs->next;
+		for (int i = 0; i < NODE_SLAB_SIZE; i++){
+			free(node_pointer->node_slabs->nodes[i].extents);
+		}
+		free(node_pointer->node_slabs);
+		node_pointer->node_slabs = next_slab;
+	}
+	node_pointer->free_nodes = NULL;
+}
+
+// when nodes are added, insert into correct location to keep sorted
+// the new file has one extent, recorded at file_index, and its space is not referenced yet
+// returns 0 if successful,
+// returns 1 if unsucessful (malloc error)
+static int add_node(void * helper, char * filename, int offset, int length, int file_index){
+	
+	helper_node * node_pointer = helper;
+	
+	// create entry in offset sorted list
+	offset_node * offset_tmp_pointer = node_pointer->offset_node;
+		
+	// loop through list until next node is either NULL or offset is less than the offset to be inserted
+	while(offset_tmp_pointer->next != NULL && offset > offset_tmp_pointer->next->offset){
+		offset_tmp_pointer = offset_tmp_pointer->next;
+	}
+
+	// add node to offset sorted list
+	offset_node * offset_node_pointer = take_node(node_pointer);
+	if (offset_node_pointer == NULL){ //malloc error
+		return 1;
+	}
+	offset_node_pointer->offset = offset;
+	offset_node_pointer->length = length;
+	offset_node_pointer->filename = intern_name(node_pointer, filename);
+	offset_node_pointer->file_index = file_index;
+	if (offset_node_pointer->filename == NULL || append_extent(offset_node_pointer, offset, length, file_index, 0) != 0 || name_index_insert(node_pointer, offset_node_pointer) != 0){
+		give_node(node_pointer, offset_node_pointer);
+		return 1;
+	}
+	offset_node_pointer->next = offset_tmp_pointer->next;
+	offset_tmp_pointer->next = offset_node_pointer;
+	
+	return 0;
+}
+
+// helper function to drop the held back writes of a file without writing them
+static void discard_write_back(helper_node * node_pointer, offset_node * file){
+	
+	write_back * write_back_pointer = file->write_back;
+	if (write_back_pointer == NULL){
+		return;
+	}
+	
+	write_back_run * run = write_back_pointer->runs;
+	while (run != NULL){
+		write_back_run * next_run = run->next;
+		free(run->data);
+		free(run);
+		run = next_run;
+	}
+	node_pointer->write_back_files--;
+	node_pointer->write_back_growth -= write_back_pointer->reserved;
+	free(write_back_pointer);
+	file->write_back = NULL;
+}
+
+// helper function to find the file of an open handle
+// returns NULL if the handle is not open or its file has been deleted
+static offset_node * handle_file(helper_node * node_pointer, int handle){
+	
+	if (handle < 0 || handle >= node_pointer->handle_capacity || !node_pointer->handles[handle].open){
+		return NULL;
+	}
+	return node_pointer->handles[handle].file;
+}
+
+// helper function to detach every handle from a file that is about to be freed
+// if handles is not NULL the detached handles are returned in it, to be given to the file's new node
+// returns the number of handles returned in handles,
+// returns -1 if unsuccessful (malloc error), in which case every handle is left on the file
+static int take_handles(helper_node * node_pointer, offset_node * file, int ** handles){
+	
+	int number_of_handles = 0;
+	for (int i = 0; i < node_pointer->handle_capacity; i++){
+		if (node_pointer->handles[i].file == file){
+			number_of_handles++;
+		}
+	}
+	if (handles != NULL){
+		*handles = NULL;
+		if (number_of_handles > 0){
+			*handles = malloc(number_of_handles * sizeof(int));
+			if (*handles == NULL){ // malloc error
+				return -1;
+			}
+		}
+	}
+	
+	int count = 0;
+	for (int i = 0; i < node_pointer->handle_capacity; i++){
+		if (node_pointer->handles[i].file == file){
+			node_pointer->handles[i].file = NULL;
+			if (handles != NULL){
+				(*handles)[count++] = i;
+			}
+		}
+	}
+	return count;
+}
+
+// helper function to point handles taken by take_handles at a file's new node
+static void give_handles(helper_node * node_pointer, offset_node * file, int * handles, int number_of_handles){
+	
+	for (int i = 0; i < number_of_handles; i++){
+		node_pointer->handles[handles[i]].file = file;
+	}
+	free(handles);
+}
+
+// removes node with filename from sorted list
+// the caller releases the file's space first, held back writes are dropped
+// and handles to the file no longer refer to anything
+// returns 0 if successful, returns 1 if filename doesn't exist
+static int remove_node(void * helper, char * filename){	
+	
+	helper_node * node_pointer = helper;
+	
+	// remove from offset sorted list
+	offset_node * offset_tmp_pointer = node_pointer->offset_node;
+	
+	while(offset_tmp_pointer->next != NULL){
+		if (strncmp(offset_tmp_pointer->next->filename, filename, 64) == 0){
+			offset_node * tmp_offset_node = offset_tmp_pointer->next;
+			offset_tmp_pointer->next = offset_tmp_pointer->next->next;
+			name_index_remove(node_pointer, tmp_offset_node);
+			discard_write_back(node_pointer, tmp_offset_node);
+			take_handles(node_pointer, tmp_offset_node, NULL);
+			
+			give_node(node_pointer, tmp_offset_node);
+			return 0;
+		}
+		
+		offset_tmp_pointer = offset_tmp_pointer->next;
+	}	
+	return 1;
+}
+
+// helper method to get node in offset sorted list from filename
+static offset_node * get_offset_node(void * helper, char * filename){
+	
+	helper_node * node_pointer = helper;
+	offset_node * file = NULL;
+	
+	SPAN_BEGIN("get_offset_node");
+	int i = name_search(node_pointer, filename);
+	if (i < node_pointer->name_count && strncmp(node_pointer->name_index[i]->filename, filename, 64) == 0){
+		file = node_pointer->name_index[i];
+	}
+	SPAN_END("get_offset_node");
+
+	return file;
+}
+
+// helper function to check if a file has an unwritten extent
+// returns 1 if it does, returns 0 otherwise
+static int has_unwritten_extents(offset_node * file){
+	
+	for (int i = 0; i < file->number_of_extents; i++){
+		if (file->extents[i].flags & EXTENT_UNWRITTEN){
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// helper function to check if any file in a list has an unwritten extent
+// returns 1 if one does, returns 0 otherwise
+static int list_has_unwritten_extents(offset_node * header){
+	
+	offset_node * offset_tmp_pointer = header->next;
+	
+	while (offset_tmp_pointer != NULL){
+		if (has_unwritten_extents(offset_tmp_pointer)){
+			return 1;
+		}
+		offset_tmp_pointer = offset_tmp_pointer->next;
+	}
+	return 0;
+}
+
+// helper function to give every node of a list of file nodes back to the slabs, including its header node
+static void free_file_list(helper_node * node_pointer, offset_node * header){
+	
+	offset_node * prev_offset_node = header;
+	offset_node * next_offset_node = NULL;
+	
+	while (prev_offset_node != NULL){
+		next_offset_node = prev_offset_node->next;
+		give_node(node_pointer, prev_offset_node);
+		prev_offset_node = next_offset_node;
+	}
+}
+
+// helper function to delete files
+// clears the file's directory_table entries and releases its space
+// returns 1 if file doesn't exist
+// returns 0 if file deleted successfully
+static int delete_file_helper(char * filename, void * helper){
+	helper_node * node_pointer = helper;
+	offset_node * tmp = get_offset_node(helper, filename);
+	
+	if (tmp != NULL){ //file exists
+		for (int i = 0; i < tmp->number_of_extents; i++){
+			clear_record(node_pointer, tmp->extents[i].file_index);
+		}
+		// flush buffers for multithreading
+		fflush(node_pointer->directory_table);
+		reference_file_space(node_pointer, tmp, -1);
+		remove_node(helper, filename);
+		return 0;
+	}
+	else{ //file doesn't exist
+		return 1;
+	}
+}
+
+
+// helper function to work out the hash tree geometry for a block size
+// also selects the leaf hashing function specialised for that block size,
+// so the hash provider must already be set
+// returns 0 if successful, returns 1 if the block size is not supported
+static int init_geometry(helper_node * helper, size_t block_size){
+	
+	if (block_size < MIN_BLOCK_SIZE || block_size > MAX_BLOCK_SIZE || (block_size & (block_size - 1)) != 0){
+		return 1;
+	}
+	if (helper->total_space % block_size != 0 || helper->total_space < block_size){
+		return 1;
+	}
+	
+	helper->block_size = block_size;
+	helper->block_shift = 0;
+	while (((size_t)1 << helper->block_shift) < block_size){
+		helper->block_shift++;
+	}
+	
+	helper->number_of_blocks = helper->total_space >> helper->block_shift;
+	
+	// max_depth is floor(log2(number_of_blocks)), leaves start after the last internal node
+	helper->max_depth = 0;
+	while (((long)1 << (helper->max_depth + 1)) <= helper->number_of_blocks){
+		helper->max_depth++;
+	}
+	helper->leaf_start = ((1 << (helper->max_depth + 1)) - 1) - helper->number_of_blocks;
+	
+	helper->hash_leaf = helper->hash_provider->select_leaf(block_size);
+	return 0;
+}
+
+// helper function to read the volume record from a directory_table entry
+// returns 0 if the entry is a volume record, returns 1 otherwise,
+// returns 2 if the entry is a volume record of a version this build cannot read
+static int read_volume_record(void * record, size_t * block_size, int * hash_algorithm, int * features){
+	
+	int version = 0;
+	int tmp_block_size = 0;
+	
+	if (memcmp(record, VOLUME_RECORD_MAGIC, 8) != 0){
+		return 1;
+	}
+	memcpy(&version, record + 8, 4);
+	if (version != VOLUME_RECORD_VERSION){
+		return 2;
+	}
+	memcpy(&tmp_block_size, record + 12, 4);
+	memcpy(hash_algorithm, record + 16, 4);
+	memcpy(features, record + 20, 4);
+	
+	*block_size = tmp_block_size;
+	return 0;
+}
+
+// helper function to write the volume record into a free directory_table entry
+// returns 0 if successful, returns 1 if there is no free entry
+static int write_volume_record(void * helper){
+	
+	helper_node * node_pointer = helper;
+	char record[72] = {0};
+	int version = VOLUME_RECORD_VERSION;
+	int block_size = node_pointer->block_size;
+	int hash_algorithm = node_pointer->hash_provider->id;
+	int features = node_pointer->features;
+	
+	if (node_pointer->volume_record_index < 0){
+		node_pointer->volume_record_index = find_free_file_index(helper);
+		if (node_pointer->volume_record_index < 0){
+			return 1;
+		}
+	}
+	
+	memcpy(record, VOLUME_RECORD_MAGIC, 8);
+	memcpy(record + 8, &version, 4);
+	memcpy(record + 12, &block_size, 4);
+	memcpy(record + 16, &hash_algorithm, 4);
+	memcpy(record + 20, &features, 4);
+	
+	fseek(node_pointer->directory_table, node_pointer->volume_record_index, SEEK_SET);
+	fwrite(record, 72, 1, node_pointer->directory_table);
+	fflush(node_pointer->directory_table);
+	node_pointer->io_metadata = 1;
+	return 0;
+}
+
+// define an extra extent read from directory_table, before the file it belongs to is known
+typedef struct extent_record{
+	int owner;
+	int position;
+	extent extent;
+} extent_record;
+
+// orders extent records by the file they belong to, then by position in the file
+static int compare_extent_records(const void * a, const void * b){
+	const extent_record * first = a;
+	const extent_record * second = b;
+	
+	if (first->owner != second->owner){
+		return (first->owner < second->owner) ? -1 : 1;
+	}
+	return (first->position > second->position) - (first->position < second->position);
+}
+
+// helper function to attach the extent records read by init_fs to their files
+// the first extent of each file loses the length of its other extents, as the file's own entry holds the total
+// records of files that no longer exist are freed
+static void attach_extent_records(helper_node * node_pointer, extent_record * records, int number_of_records, int number_of_entries){
+	
+	if (number_of_records == 0){
+		return;
+	}
+	
+	qsort(records, number_of_records, sizeof(extent_record), compare_extent_records);
+	
+	// look up files by directory_table entry
+	offset_node ** files = calloc(number_of_entries, sizeof(offset_node *));
+	if (files == NULL){ // malloc error
+		return;
+	}
+	offset_node * offset_tmp_pointer = node_pointer->offset_node->next;
+	while (offset_tmp_pointer != NULL){
+		files[offset_tmp_pointer->file_index / 72] = offset_tmp_pointer;
+		offset_tmp_pointer = offset_tmp_pointer->next;
+	}
+	
+	for (int i = 0; i < number_of_records; i++){
+		int owner = records[i].owner;
+		offset_node * file = NULL;
+		if (owner >= 0 && owner % 72 == 0 && owner / 72 < number_of_entries){
+			file = files[owner / 72];
+		}
+		
+		if (file == NULL){ // file no longer exists
+			clear_record(node_pointer, records[i].extent.file_index);
+			continue;
+		}
+		append_extent(file, records[i].extent.offset, records[i].extent.length, records[i].extent.file_index, records[i].extent.flags);
+		file->extents[file->number_of_extents - 1].stored_length = records[i].extent.stored_length;
+		file->extents[0].length -= records[i].extent.length;
+	}
+	
+	free(files);
+	fflush(node_pointer->directory_table);
+}
+
+// helper function to read every file and its extents from directory_table into the empty lists of a helper node
+// the volume parameters are given back if directory_table holds a volume record, and left as they are otherwise
+// returns 0 if successful, returns 1 if unsuccessful (malloc error or a volume record of an unknown version)
+static int load_directory_table(helper_node * helper, size_t * block_size, int * hash_algorithm, int * features){
+	
+	int int_bytes = sizeof(int);
+	
+	//Read 72 bytes until -1 is returned (i.e. end of file)
+	void * tmp = malloc(72);
+	if (tmp == NULL){ // malloc error
+		return 1;
+	}
+	int file_index = 0;
+	
+	int tmp_offset = 0;
+	int tmp_length = 0;
+	
+	// extra extents of files are attached once every file has been read
+	extent_record * extent_records = NULL;
+	int number_of_extent_records = 0;
+	int extent_record_capacity = 0;
+	
+	char null_byte = '\0';
+	fseek(helper->directory_table, 0, SEEK_SET);
+	while(fread(tmp, 72, 1, helper->directory_table) == 1){
+		//skip over null-starting entries
+		if (memcmp(tmp, &null_byte, 1) == 0){
+			file_index++;
+			continue;
+		}	
+		
+		// volume parameters are not a file
+		int volume_record = read_volume_record(tmp, block_size, hash_algorithm, features);
+		if (volume_record == 2){
+			printf("Error: volume record version is not supported\n");
+			free(extent_records);
+			free(tmp);
+			return 1;
+		}
+		if (volume_record == 0){
+			helper->volume_record_index = file_index*72;
+			file_index++;
+			continue;
+		}
+		
+		memcpy(&tmp_offset, tmp + 64, int_bytes);
+		memcpy(&tmp_length, tmp + 68, int_bytes);
+		
+		if (*(char *) tmp == EXTENT_RECORD_MARKER){
+			if (number_of_extent_records == extent_record_capacity){
+				extent_record_capacity = (extent_record_capacity == 0) ? 16 : extent_record_capacity * 2;
+				extent_record * new_records = realloc(extent_records, extent_record_capacity * sizeof(extent_record));
+				if (new_records == NULL){ // malloc error
+					free(extent_records);
+					free(tmp);
+					return 1;
+				}
+				extent_records = new_records;
+			}
+			extent_record * record = &extent_records[number_of_extent_records];
+			memcpy(&record->owner, tmp + 4, int_bytes);
+			memcpy(&record->position, tmp + 8, int_bytes);
+			record->extent.offset = tmp_offset;
+			record->extent.length = tmp_length;
+			record->extent.file_index = file_index*72;
+			record->extent.flags = ((uint8_t *) tmp)[1];
+			memcpy(&record->extent.stored_length, tmp + 12, int_bytes);
+			number_of_extent_records++;
+			
+			file_index++;
+			continue;
+		}
+		
+		if (add_node(helper, tmp, tmp_offset, tmp_length, file_index*72) != 0){
+			printf("Error adding node\n");
+			free(extent_records);
+			free(tmp);
+			return 1;
+		}
+		
+		file_index++;
+	}
+	
+	attach_extent_records(helper, extent_records, number_of_extent_records, file_index);
+	free(extent_records);
+	
+	// calculate filled_space from the space every file references
+	offset_node * offset_tmp_pointer = helper->offset_node->next;
+	while (offset_tmp_pointer != NULL){
+		reference_file_space(helper, offset_tmp_pointer, 1);
+		offset_tmp_pointer = offset_tmp_pointer->next;
+	}
+	free(tmp);
+	return build_unwritten_map(helper);
+}
+
+// volumes opened with shared_mount are coordinated through a sidecar file named after directory_table with
+// SHARED_MOUNT_SUFFIX, mapped by every process with the volume mounted
+// the sidecar holds a shared_mount_header in its first SHARED_MOUNT_HEADER_SIZE bytes, then the hash tree,
+// so processes share one hash tree and only keep their own file lists, then a generation for each directory_table entry,
+// moved on when a delete frees the entry, so handles do not follow a file created in the entry afterwards
+// byte 0 of the sidecar is locked while a process mounts the volume, and byte 1 by every process with it mounted,
+// with open file description locks, which are let go of when a process exits however it exits
+#define SHARED_MOUNT_SUFFIX ".mount"
+#define SHARED_MOUNT_MAGIC 0x32544e554f4d5346ULL
+#define SHARED_MOUNT_HEADER_SIZE 4096
+
+// helper function to get the generation of the directory_table entry at file_index, 0 if the volume is not shared
+static uint32_t entry_generation(helper_node * node_pointer, int file_index){
+	
+	if (node_pointer->shared == NULL || file_index < 0 || file_index / 72 >= node_pointer->shared_entries){
+		return 0;
+	}
+	return node_pointer->entry_generations[file_index / 72];
+}
+
+// helper function to load the file lists again after another process changed the volume, with the shared lock held
+// handles follow their file by its directory_table entry, and are left without a file if it was deleted,
+// even if another file has been created in the entry since
+// returns 0 if successful, returns 1 if unsuccessful (malloc error)
+static int shared_mount_reload(helper_node * node_pointer){
+	
+	int * handle_entries = malloc((node_pointer->handle_capacity + 1) * sizeof(int));
+	if (handle_entries == NULL){ // malloc error
+		return 1;
+	}
+	for (int i = 0; i < node_pointer->handle_capacity; i++){
+		offset_node * file = node_pointer->handles[i].file;
+		handle_entries[i] = (file != NULL) ? file->file_index : -1;
+	}
+	
+	free_file_list(node_pointer, node_pointer->offset_node->next);
+	node_pointer->offset_node->next = NULL;
+	node_pointer->name_count = 0;
+	node_pointer->space_count = 0;
+	node_pointer->filled_space = 0;
+	
+	// drop what stdio buffered before the other process wrote
+	fflush(node_pointer->file_data);
+	fflush(node_pointer->directory_table);
+	fflush(node_pointer->hash_data);
+	
+	size_t block_size;
+	int hash_algorithm;
+	int features;
+	int return_value = load_directory_table(node_pointer, &block_size, &hash_algorithm, &features);
+	
+	for (int i = 0; i < node_pointer->handle_capacity; i++){
+		node_pointer->handles[i].file = NULL;
+		offset_node * file = node_pointer->offset_node->next;
+		if (entry_generation(node_pointer, handle_entries[i]) != node_pointer->handles[i].generation){
+			continue;
+		}
+		while (handle_entries[i] >= 0 && file != NULL){
+			if (file->file_index == handle_entries[i]){
+				node_pointer->handles[i].file = file;
+				break;
+			}
+			file = file->next;
+		}
+	}
+	free(handle_entries);
+	node_pointer->changes++;
+	return return_value;
+}
+
+// helper function to take the lock shared by every process with the volume mounted, after the list lock
+// the file lists are loaded again only if another process wrote directory_table since this one last held the lock,
+// other changes just drop what stdio and read-ahead hold of file_data and hash_data,
+// and the hash tree is rebuilt from file_data if a process died holding the lock part way through a change
+static void shared_mount_lock(helper_node * node_pointer){
+	
+	shared_mount_header * shared = node_pointer->shared;
+	if (pthread_mutex_lock(&shared->lock) == EOWNERDEAD){
+		pthread_mutex_consistent(&shared->lock);
+		shared_mount_reload(node_pointer);
+		rebuild_hash_tree(node_pointer);
+		shared->generation++;
+		shared->metadata_generation++;
+		node_pointer->shared_generation = shared->generation;
+		node_pointer->shared_metadata_generation = shared->metadata_generation;
+		return;
+	}
+	if (node_pointer->shared_metadata_generation != shared->metadata_generation){
+		shared_mount_reload(node_pointer);
+		node_pointer->shared_metadata_generation = shared->metadata_generation;
+		node_pointer->shared_generation = shared->generation;
+	}
+	else if (node_pointer->shared_generation != shared->generation){
+		// drop what stdio buffered before the other process wrote
+		fflush(node_pointer->file_data);
+		fflush(node_pointer->hash_data);
+		node_pointer->changes++;
+		node_pointer->shared_generation = shared->generation;
+	}
+}
+
+// helper function to give up the lock taken by shared_mount_lock
+// a call that may have changed the volume moves the generation on, so other processes read it again,
+// and one that wrote directory_table moves the metadata generation on too, so they load their file lists again
+static void shared_mount_unlock(helper_node * node_pointer){
+	
+	shared_mount_header * shared = node_pointer->shared;
+	if (node_pointer->io_changing){
+		fflush(node_pointer->file_data);
+		fflush(node_pointer->directory_table);
+		fflush(node_pointer->hash_data);
+		shared->generation++;
+		node_pointer->shared_generation = shared->generation;
+	}
+	if (node_pointer->io_metadata){
+		shared->metadata_generation++;
+		node_pointer->shared_metadata_generation = shared->metadata_generation;
+	}
+	pthread_mutex_unlock(&shared->lock);
+}
+
+// helper function to map the sidecar of a volume opened with shared_mount, once its geometry and tree layout are known
+// the first process to mount the volume sets up the shared lock and loads the hash tree from hash_data into the sidecar,
+// later ones use the hash tree already there, and load their file lists again on their first call
+// returns 0 if successful, returns 1 if the sidecar cannot be used or the volume is mounted with another tree layout
+static int shared_mount_attach(helper_node * helper, char * directory_table_path){
+	
+	char path[64 + sizeof(SHARED_MOUNT_SUFFIX)];
+	snprintf(path, sizeof(path), "%s%s", directory_table_path, SHARED_MOUNT_SUFFIX);
+	int fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (fd < 0){
+		return 1;
+	}
+	
+	struct flock mounting = {.l_type = F_WRLCK, .l_whence = SEEK_SET, .l_start = 0, .l_len = 1};
+	struct flock mounted = {.l_type = F_WRLCK, .l_whence = SEEK_SET, .l_start = 1, .l_len = 1};
+	if (fcntl(fd, F_OFD_SETLKW, &mounting) != 0){
+		close(fd);
+		return 1;
+	}
+	
+	// no other process has the volume mounted if byte 1 can be locked for writing
+	int first = (fcntl(fd, F_OFD_SETLK, &mounted) == 0);
+	fseek(helper->directory_table, 0, SEEK_END);
+	long entries = ftell(helper->directory_table) / 72;
+	size_t size = SHARED_MOUNT_HEADER_SIZE + (size_t)helper->tree_slots * 16 + (size_t)entries * sizeof(uint32_t);
+	struct stat sidecar;
+	if ((first && (ftruncate(fd, 0) != 0 || ftruncate(fd, size) != 0)) || fstat(fd, &sidecar) != 0 || (size_t)sidecar.st_size != size){
+		close(fd);
+		return 1;
+	}
+	void * map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED){
+		close(fd);
+		return 1;
+	}
+	
+	shared_mount_header * shared = map;
+	helper->hash_tree = (uint8_t *) map + SHARED_MOUNT_HEADER_SIZE;
+	if (first){
+		pthread_mutexattr_t attributes;
+		pthread_mutexattr_init(&attributes);
+		pthread_mutexattr_setpshared(&attributes, PTHREAD_PROCESS_SHARED);
+		pthread_mutexattr_setrobust(&attributes, PTHREAD_MUTEX_ROBUST);
+		pthread_mutex_init(&shared->lock, &attributes);
+		pthread_mutexattr_destroy(&attributes);
+		shared->generation = 0;
+		shared->metadata_generation = 0;
+		shared->tree_slots = helper->tree_slots;
+		shared->tree_layout = helper->tree_layout;
+		load_hash_tree(helper);
+		shared->magic = SHARED_MOUNT_MAGIC;
+	}
+	else if (shared->magic != SHARED_MOUNT_MAGIC || shared->tree_slots != helper->tree_slots || shared->tree_layout != helper->tree_layout){
+		munmap(map, size);
+		close(fd);
+		return 1;
+	}
+	
+	mounted.l_type = F_RDLCK;
+	fcntl(fd, F_OFD_SETLK, &mounted);
+	mounting.l_type = F_UNLCK;
+	fcntl(fd, F_OFD_SETLK, &mounting);
+	
+	helper->shared = shared;
+	helper->shared_fd = fd;
+	helper->shared_size = size;
+	helper->entry_generations = (uint32_t *)(helper->hash_tree + (size_t)helper->tree_slots * 16);
+	helper->shared_entries = entries;
+	
+	// lists read before the shared lock was taken are loaded again, no generation is ~0
+	helper->shared_generation = shared->generation;
+	helper->shared_metadata_generation = first ? shared->metadata_generation : ~(uint64_t)0;
+	return 0;
+}
+
+// helper function to take the list lock for a call of io_class
+// waits until no call holds it and no call of a class handed it out first is queued
+static void io_begin(helper_node * node_pointer, int io_class){
+	
+	SPAN_BEGIN("lock wait");
+	pthread_mutex_lock(&node_pointer->io_lock);
+	node_pointer->io_waiting[io_class]++;
+	while (1){
+		int queued_before = 0;
+		for (int i = 0; i < io_class; i++){
+			queued_before += node_pointer->io_waiting[i];
+		}
+		if (!node_pointer->io_busy && queued_before == 0){
+			break;
+		}
+		pthread_cond_wait(&node_pointer->io_turn, &node_pointer->io_lock);
+	}
+	node_pointer->io_waiting[io_class]--;
+	node_pointer->io_busy = 1;
+	pthread_mutex_unlock(&node_pointer->io_lock);
+	
+	pthread_mutex_lock(&node_pointer->list_lock);
+	node_pointer->io_changing = (io_class != IO_FOREGROUND_READ);
+	node_pointer->io_metadata = 0;
+	if (node_pointer->shared != NULL){
+		shared_mount_lock(node_pointer);
+	}
+	SPAN_END("lock wait");
+}
+
+// helper function to give up the list lock taken by io_begin
+static void io_end(helper_node * node_pointer){
+	
+	direct_hash_flush(node_pointer);
+	if (node_pointer->io_changing){
+		node_pointer->changes++;
+	}
+	if (node_pointer->shared != NULL){
+		shared_mount_unlock(node_pointer);
+	}
+	pthread_mutex_unlock(&node_pointer->list_lock);
+	
+	pthread_mutex_lock(&node_pointer->io_lock);
+	node_pointer->io_busy = 0;
+	pthread_cond_broadcast(&node_pointer->io_turn);
+	pthread_mutex_unlock(&node_pointer->io_lock);
+}
+
+// helper function called by background work between slices, with the list lock held
+// queued foreground calls take the list lock first, and a slice of bytes of file_data
+// is made to take at least as long as background_rate allows
+// on a shared mount the lock is always given up, as calls queued in other processes cannot be seen
+static void io_pace(helper_node * node_pointer, size_t bytes){
+	
+	pthread_mutex_lock(&node_pointer->io_lock);
+	int queued = node_pointer->io_waiting[IO_FOREGROUND_READ] + node_pointer->io_waiting[IO_FOREGROUND_WRITE];
+	pthread_mutex_unlock(&node_pointer->io_lock);
+	if (queued == 0 && node_pointer->background_rate == 0 && node_pointer->shared == NULL){
+		return;
+	}
+	
+	io_end(node_pointer);
+	if (node_pointer->background_rate > 0){
+		uint64_t wait = (uint64_t)bytes * 1000000000ULL / node_pointer->background_rate;
+		struct timespec pause = {wait / 1000000000ULL, wait % 1000000000ULL};
+		nanosleep(&pause, NULL);
+	}
+	io_begin(node_pointer, IO_BACKGROUND);
+}
+
+// scrubber thread started by init_fs when scrub_rate is set, walks the hash tree in order one subtree at a time
+// the list lock is only held while a subtree is verified, as background work, and close_fs wakes the thread to stop it
+static void * scrub_worker(void * arg){
+	
+	helper_node * node_pointer = arg;
+	int number_of_subtrees = (node_pointer->number_of_blocks + SCRUB_SUBTREE_BLOCKS - 1) / SCRUB_SUBTREE_BLOCKS;
+	
+	pthread_mutex_lock(&node_pointer->io_lock);
+	while (node_pointer->scrub_running){
+		pthread_mutex_unlock(&node_pointer->io_lock);
+		io_begin(node_pointer, IO_BACKGROUND);
+		node_pointer->io_changing = 0; // scrubbing changes nothing
+		int subtree = node_pointer->scrub_next;
+		scrub_subtree(node_pointer, subtree);
+		node_pointer->scrub_next = (subtree + 1) % number_of_subtrees;
+		io_end(node_pointer);
+		
+		// wait as long as verifying the subtree is allowed to take at scrub_rate
+		int blocks = node_pointer->number_of_blocks - subtree * SCRUB_SUBTREE_BLOCKS;
+		if (blocks > SCRUB_SUBTREE_BLOCKS){
+			blocks = SCRUB_SUBTREE_BLOCKS;
+		}
+		uint64_t wait = ((uint64_t)blocks << node_pointer->block_shift) * 1000000000ULL / node_pointer->scrub_rate;
+		struct timespec deadline;
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += wait / 1000000000ULL;
+		deadline.tv_nsec += wait % 1000000000ULL;
+		if (deadline.tv_nsec >= 1000000000L){
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000L;
+		}
+		pthread_mutex_lock(&node_pointer->io_lock);
+		while (node_pointer->scrub_running && pthread_cond_timedwait(&node_pointer->scrub_wake, &node_pointer->io_lock, &deadline) != ETIMEDOUT);
+	}
+	pthread_mutex_unlock(&node_pointer->io_lock);
+	return NULL;
+}
+
+// fills options with the values used by init_fs
+void fs_default_options(fs_options * options) {
+	memset(options, 0, sizeof(fs_options));
+	options->block_size = MIN_BLOCK_SIZE;
+	options->hash_algorithm = FS_HASH_FLETCHER;
+	options->tree_layout = FS_LAYOUT_BREADTH_FIRST;
+	options->features = 0;
+	options->write_back_size = 0;
+	options->write_back_delay = 0;
+	options->hash_consistency = FS_CONSISTENCY_IMMEDIATE;
+	options->scrub_rate = 0;
+	options->scrub_trust = 0;
+	options->background_rate = 0;
+	options->trace_path = NULL;
+	options->span_path = NULL;
+	options->shared_mount = 0;
+	options->read_ahead_size = 0;
+	options->direct_io = 0;
+}
+
+// helper function to close the files of a helper node and free all its memory, for close_fs and init_fs_opts
+// threads must be stopped and held writes written or dropped before, as nothing is flushed
+static void free_helper(helper_node * node_pointer){
+	
+	if (node_pointer->direct_file_data.fd >= 0){
+		close(node_pointer->direct_file_data.fd);
+	}
+	if (node_pointer->direct_hash_data.fd >= 0){
+		close(node_pointer->direct_hash_data.fd);
+	}
+	
+	fclose(node_pointer->file_data);
+	fclose(node_pointer->directory_table);
+	fclose(node_pointer->hash_data);
+	
+	// free offset sorted linked list
+	free_file_list(node_pointer, node_pointer->offset_node);
+	
+	if (node_pointer->shared != NULL){
+		munmap(node_pointer->shared, node_pointer->shared_size);
+		close(node_pointer->shared_fd);
+	}
+	else{
+		free(node_pointer->hash_tree);
+	}
+	free(node_pointer->space_map);
+	free(node_pointer->unwritten_map);
+	free(node_pointer->name_index);
+	free(node_pointer->dirty_leaves);
+	free(node_pointer->direct_hash_dirty);
+	for (int i = 0; i < node_pointer->direct_pool_count; i++){
+		free(node_pointer->direct_pool[i]);
+	}
+	for (int i = 0; i < READ_AHEAD_STREAMS; i++){
+		free(node_pointer->read_ahead_streams[i].current.data);
+		free(node_pointer->read_ahead_streams[i].next.data);
+	}
+	free(node_pointer->handles);
+	free(node_pointer->scrub_times);
+	free(node_pointer->corrupt_blocks);
+	if (node_pointer->trace != NULL){
+		fclose(node_pointer->trace);
+	}
+	free(node_pointer->trace_names);
+#ifdef FS_TRACE_SPANS
+	free(node_pointer->span_path);
+#endif
+	while (node_pointer->name_blocks != NULL){
+		name_block * next_block = node_pointer->name_blocks->next;
+		free(node_pointer->name_blocks);
+		node_pointer->name_blocks = next_block;
+	}
+	free_node_slabs(node_pointer);
+	
+	// the locks go last, once nothing above can take them
+	pthread_cond_destroy(&node_pointer->scrub_wake);
+	pthread_cond_destroy(&node_pointer->read_ahead_wake);
+	pthread_cond_destroy(&node_pointer->io_turn);
+	pthread_mutex_destroy(&node_pointer->io_lock);
+	pthread_mutex_destroy(&node_pointer->list_lock);
+	pthread_mutex_destroy(&node_pointer->trace_lock);
+	free(node_pointer);
+}
+
+// function to initialize all data structures from three files
+// returns pointer to helper node memory address
+// returns NULL if an error is experienced during initialization
+void * init_fs(char * f1, char * f2, char * f3, int n_processors) {
+	return init_fs_opts(f1, f2, f3, n_processors, NULL);
+}
+
+// function to initialize all data structures from three files using the given options
+// volume format options (block size, hash algorithm) only apply to volumes without a volume record,
+// volumes that already have one keep the parameters recorded in it
+// a volume without a volume record that already holds files was made with the default parameters, and is refused other ones
+// shared mounts take no write_back_size and always keep hashes up to date, and snapshots cannot be taken on them
+// returns pointer to helper node memory address
+// returns NULL if an error is experienced during initialization
+void * init_fs_opts(char * f1, char * f2, char * f3, int n_processors, fs_options * options) {
+	
+	fs_options default_options;
+	if (options == NULL){
+		fs_default_options(&default_options);
+		options = &default_options;
+	}
+	
+	//truncate filenames if necessary
+	truncate_filename(f1);
+	truncate_filename(f2);
+	truncate_filename(f3);
+	
+	//return error if any duplicate names
+	if (strcmp(f1, f2) == 0 || strcmp(f1, f3) == 0 || strcmp(f2, f3) == 0){
+		printf("Error: duplicate filenames\n");
+		return NULL;
+	}
+	
+	FILE * file_data_pointer;
+	FILE * directory_table_pointer;
+	FILE * hash_data_pointer;
+	
+	//open files
+	file_data_pointer = fopen(f1, "r+");
+	if (file_data_pointer == NULL){
+		perror("Error");
+		return NULL;
+	}
+		
+	directory_table_pointer = fopen(f2, "r+");
+	if (directory_table_pointer == NULL){
+		perror("Error");
+		fclose(file_data_pointer);
+		return NULL;
+	}
+	
+	hash_data_pointer = fopen(f3, "r+");
+	if (hash_data_pointer == NULL){
+		perror("Error");
+		fclose(file_data_pointer);
+		fclose(directory_table_pointer);
+		return NULL;
+	}
+    
+	// calculate total space;
+	int file_data_size = 0;
+	fseek(file_data_pointer, 0, SEEK_END);
+	file_data_size = ftell(file_data_pointer);
+	
+	//allocate memory for sorted array of file information stored in virtual memory
+	void * helper_address = init_list();
+	helper_node * helper = helper_address;
+	if (helper == NULL){ // malloc error
+		fclose(file_data_pointer);
+		fclose(directory_table_pointer);
+		fclose(hash_data_pointer);
+		return NULL;
+	}
+	
+	helper->file_data = file_data_pointer;
+	helper->directory_table = directory_table_pointer;
+	helper->hash_data = hash_data_pointer;
+	
+	size_t block_size = 0;
+	int hash_algorithm = FS_HASH_FLETCHER;
+	int features = 0;
+	helper->volume_record_index = -1;
+	helper->features = 0;
+	if (load_directory_table(helper, &block_size, &hash_algorithm, &features) != 0){
+		free_helper(helper);
+		return NULL;
+	}
+	
+	// write file space to helper node
+	helper->total_space = file_data_size;
+	
+	// volumes without a volume record are formatted with the given options
+	// unless they already hold files, which were written and hashed with the default parameters
+	int new_volume_record = 0;
+	if (helper->volume_record_index < 0 && helper->offset_node->next != NULL && (options->block_size != MIN_BLOCK_SIZE || options->hash_algorithm != FS_HASH_FLETCHER)){
+		printf("Error: volume holds files made with other parameters\n");
+		free_helper(helper);
+		return NULL;
+	}
+	if (helper->volume_record_index < 0){
+		block_size = options->block_size;
+		hash_algorithm = options->hash_algorithm;
+		features = options->features;
+		new_volume_record = (block_size != MIN_BLOCK_SIZE || hash_algorithm != FS_HASH_FLETCHER || features != 0);
+	}
+	helper->features = features;
+	
+	helper->hash_provider = select_hash_provider(hash_algorithm);
+	if (helper->hash_provider == NULL){
+		printf("Error: unsupported hash algorithm\n");
+		free_helper(helper);
+		return NULL;
+	}
+	
+	if (init_geometry(helper, block_size) != 0){
+		printf("Error: unsupported block size\n");
+		free_helper(helper);
+		return NULL;
+	}
+	if (init_zero_hashes(helper) != 0){ // malloc error
+		free_helper(helper);
+		return NULL;
+	}
+	
+	// writes held back and hashes worked out later would only be seen by this process, so shared mounts do neither
+	if (!options->shared_mount){
+		helper->write_back_size = options->write_back_size;
+		helper->write_back_delay = options->write_back_delay;
+	}
+	helper->n_processors = (n_processors > 1) ? n_processors : 1;
+	
+	// one bit per block for the leaves marked in deferred consistency mode
+	if (options->hash_consistency == FS_CONSISTENCY_DEFERRED && !options->shared_mount){
+		helper->hash_consistency = FS_CONSISTENCY_DEFERRED;
+		helper->dirty_leaves = calloc((helper->number_of_blocks + 63) / 64, sizeof(uint64_t));
+		if (helper->dirty_leaves == NULL){ // malloc error
+			free_helper(helper);
+			return NULL;
+		}
+	}
+	
+	if (init_tree_layout(helper, options->tree_layout) != 0){
+		printf("Error: hash tree too deep for blocked layout\n");
+		free_helper(helper);
+		return NULL;
+	}
+	
+	if (options->direct_io && direct_io_open(helper, f1, f3) != 0){
+		free_helper(helper);
+		return NULL;
+	}
+	
+	// shared mounts keep the hash tree in the sidecar
+	if (options->shared_mount){
+		if (shared_mount_attach(helper, f2) != 0){
+			printf("Error: volume cannot be mounted shared\n");
+			free_helper(helper);
+			return NULL;
+		}
+	}
+	
+	// alloc virtual memory to hold hash_data (one 16 byte slot per node in the tree, plus padding in the blocked layout)
+	// the blocked layout is page aligned so each page group sits in exactly one page
+	void * tmp_hash = NULL;
+	if (helper->shared != NULL){
+		tmp_hash = helper->hash_tree;
+	}
+	else if (helper->tree_layout == FS_LAYOUT_BLOCKED){
+		if (posix_memalign(&tmp_hash, 16 << PAGE_GROUP_LEVELS, helper->tree_slots * 16) == 0){
+			memset(tmp_hash, 0, helper->tree_slots * 16);
+		}
+	}
+	else{
+		tmp_hash = calloc(helper->tree_slots, 16);
+	}
+	if (tmp_hash == NULL){ // malloc error
+		free_helper(helper);
+		return NULL;
+	}
+	if (helper->shared == NULL){
+		helper->hash_tree = tmp_hash;
+		load_hash_tree(helper);
+	}
+	
+	// record the volume parameters and rebuild hash_data for the new geometry
+	if (new_volume_record){
+		if (write_volume_record(helper) != 0){
+			printf("Error: no free directory_table entry for volume record\n");
+			free_helper(helper);
+			return NULL;
+		}
+		hash_tree_changed(helper);
+	}
+	direct_hash_flush(helper);
+	
+	helper->background_rate = options->background_rate;
+	helper->read_ahead_size = options->read_ahead_size;
+	
+	// calls are only traced if the trace can be created
+	if (options->trace_path != NULL){
+		helper->trace = fopen(options->trace_path, "w");
+		if (helper->trace == NULL){
+			perror("Error");
+		}
+		else{
+			fwrite(TRACE_MAGIC, 8, 1, helper->trace);
+			helper->trace_start = trace_clock();
+		}
+	}
+#ifdef FS_TRACE_SPANS
+	helper->span_path = (options->span_path != NULL) ? strdup(options->span_path) : NULL;
+#endif
+	
+	// start the scrubber, a volume still works without one if the thread cannot be started
+	helper->scrub_times = calloc((helper->number_of_blocks + SCRUB_SUBTREE_BLOCKS - 1) / SCRUB_SUBTREE_BLOCKS, sizeof(long));
+	if (helper->scrub_times == NULL){ // malloc error
+		free_helper(helper);
+		return NULL;
+	}
+	helper->scrub_rate = options->scrub_rate;
+	helper->scrub_trust = options->scrub_trust;
+	if (helper->scrub_rate > 0){
+		helper->scrub_running = 1;
+		if (pthread_create(&helper->scrubber, NULL, scrub_worker, helper) != 0){
+			helper->scrub_running = 0;
+		}
+	}
+	
+	return helper_address;
+}
+
+// helper function to append a piece of file_data to a new extent list, merging it with the previous extent if possible
+// the first extent of a file is held by the file's own entry, so a list never starts with an unwritten extent
+static void add_extent_piece(extent * extents, int * number_of_extents, int offset, int length, int flags){
+	
+	if (length <= 0){
+		return;
+	}
+	
+	if (*number_of_extents == 0 && flags != 0){ // empty written first extent
+		extents[0].offset = offset;
+		extents[0].length = 0;
+		extents[0].file_index = -1;
+		extents[0].flags = 0;
+		*number_of_extents = 1;
+	}
+	
+	if (*number_of_extents > 0){
+		extent * previous = &extents[*number_of_extents - 1];
+		if (previous->offset + previous->length == offset && previous->flags == flags && !(flags & EXTENT_COMPRESSED)){
+			previous->length += length;
+			return;
+		}
+	}
+	
+	extents[*number_of_extents].offset = offset;
+	extents[*number_of_extents].length = length;
+	extents[*number_of_extents].file_index = -1;
+	extents[*number_of_extents].flags = flags;
+	(*number_of_extents)++;
+}
+
+// helper function to copy a whole extent to a new extent list, merging it with the previous extent if possible
+// an empty first extent is kept as it is, and compressed extents are never merged or split
+static void keep_extent(extent * extents, int * number_of_extents, extent * extent_pointer){
+	
+	if (extent_pointer->length == 0 && *number_of_extents == 0){ // keep empty first extent
+		extents[0] = *extent_pointer;
+		*number_of_extents = 1;
+		return;
+	}
+	
+	if (!(extent_pointer->flags & EXTENT_COMPRESSED)){
+		add_extent_piece(extents, number_of_extents, extent_pointer->offset, extent_pointer->length, extent_pointer->flags);
+		return;
+	}
+	
+	if (*number_of_extents == 0){ // empty written first extent
+		extents[0].offset = extent_pointer->offset;
+		extents[0].length = 0;
+		extents[0].file_index = -1;
+		extents[0].flags = 0;
+		*number_of_extents = 1;
+	}
+	extents[*number_of_extents] = *extent_pointer;
+	extents[*number_of_extents].file_index = -1;
+	(*number_of_extents)++;
+}
+
+// helper function to replace the extent list of a file with new_extents (allocated by the caller, capacity extents long)
+// the file's directory_table entries are reused in order, free entries are taken for extra extents
+// and unused entries are freed
+// returns 0 if successful, returns 1 if there are not enough free directory_table entries (the file is unchanged)
+static int replace_file_extents(helper_node * node_pointer, offset_node * file, extent * new_extents, int number_of_new_extents, int capacity){
+	
+	int * file_indexes = NULL;
+	int extra_extents = number_of_new_extents - file->number_of_extents;
+	if (extra_extents > 0){
+		file_indexes = malloc(extra_extents * sizeof(int));
+		if (file_indexes == NULL || find_free_file_indexes(node_pointer, extra_extents, file_indexes) != 0){
+			free(file_indexes);
+			return 1;
+		}
+	}
+	
+	for (int i = 0; i < number_of_new_extents; i++){
+		if (i < file->number_of_extents){
+			new_extents[i].file_index = file->extents[i].file_index;
+		}
+		else{
+			new_extents[i].file_index = file_indexes[i - file->number_of_extents];
+		}
+	}
+	for (int i = number_of_new_extents; i < file->number_of_extents; i++){
+		clear_record(node_pointer, file->extents[i].file_index);
+	}
+	
+	free(file->extents);
+	file->extents = new_extents;
+	file->extent_capacity = capacity;
+	file->number_of_extents = number_of_new_extents;
+	file->offset = new_extents[0].offset;
+	
+	for (int i = 0; i < number_of_new_extents; i++){
+		write_extent_record(node_pointer, file, i);
+	}
+	
+	free(file_indexes);
+	return 0;
+}
+
+// helper function to add the replacement extents of splice_file_extents to a new extent list
+static void add_replacement(extent * extents, int * number_of_extents, extent * replacement, int number_of_replacements, int * replaced){
+	
+	if (*replaced){
+		return;
+	}
+	for (int i = 0; i < number_of_replacements; i++){
+		keep_extent(extents, number_of_extents, &replacement[i]);
+	}
+	*replaced = 1;
+}
+
+// helper function to replace the bytes [start, stop) of a file with the given extents
+// extents partly in the range keep their parts outside it, the range always covers compressed extents completely
+// the ranges of file_data the file stops using are written to released, which has room for every extent of the file
+// no space is referenced or released, the caller does that once the new extents are in place
+// returns number of released ranges if successful,
+// returns -1 if there are not enough free directory_table entries or malloc error (the file is unchanged)
+static int splice_file_extents(helper_node * node_pointer, offset_node * file, size_t start, size_t stop, extent * replacement, int number_of_replacements, extent * released){
+	
+	int capacity = (2 * file->number_of_extents) + number_of_replacements + 2;
+	extent * new_extents = malloc(capacity * sizeof(extent));
+	if (new_extents == NULL){ // malloc error
+		return -1;
+	}
+	int number_of_new_extents = 0;
+	int number_released = 0;
+	int replaced = 0;
+	size_t extent_start = 0;
+	
+	for (int i = 0; i < file->number_of_extents; i++){
+		extent * extent_pointer = &file->extents[i];
+		size_t extent_end = extent_start + extent_pointer->length;
+		
+		if (extent_end <= start || extent_start >= stop){ // outside the range
+			if (extent_start >= stop){
+				add_replacement(new_extents, &number_of_new_extents, replacement, number_of_replacements, &replaced);
+			}
+			keep_extent(new_extents, &number_of_new_extents, extent_pointer);
+			extent_start = extent_end;
+			continue;
+		}
+		
+		// part before the range stays
+		if (extent_start < start){
+			add_extent_piece(new_extents, &number_of_new_extents, extent_pointer->offset, start - extent_start, extent_pointer->flags);
+		}
+		add_replacement(new_extents, &number_of_new_extents, replacement, number_of_replacements, &replaced);
+		
+		// part in the range is released
+		size_t overlap_start = (extent_start > start) ? extent_start : start;
+		size_t overlap_stop = (extent_end < stop) ? extent_end : stop;
+		released[number_released].offset = extent_pointer->offset + (overlap_start - extent_start);
+		released[number_released].length = overlap_stop - overlap_start;
+		if (extent_pointer->flags & EXTENT_COMPRESSED){
+			released[number_released].length = extent_pointer->stored_length;
+		}
+		number_released++;
+		
+		// part after the range stays
+		if (extent_end > stop){
+			add_extent_piece(new_extents, &number_of_new_extents, extent_pointer->offset + (stop - extent_start), extent_end - stop, extent_pointer->flags);
+		}
+		extent_start = extent_end;
+	}
+	add_replacement(new_extents, &number_of_new_extents, replacement, number_of_replacements, &replaced);
+	
+	// reuse the file's directory_table entries, taking free ones for extra extents
+	if (replace_file_extents(node_pointer, file, new_extents, number_of_new_extents, capacity) != 0){
+		free(new_extents);
+		return -1;
+	}
+	return number_released;
+}
+
+// helper function to turn the compressed extents overlapping the bytes [offset, offset + count) of a file back into
+// written extents before they are written, so the write can change file_data in place
+// the data is decompressed to newly allocated space, which also stops it being shared with a snapshot or clone
+// returns 0 if successful, returns 1 if there is not enough free space or directory_table entries
+static int expand_file_range(helper_node * node_pointer, offset_node * file, size_t offset, size_t count){
+	
+	size_t end = offset + count;
+	size_t extent_start = 0;
+	int i = 0;
+	
+	while (i < file->number_of_extents){
+		extent * extent_pointer = &file->extents[i];
+		size_t extent_end = extent_start + extent_pointer->length;
+		
+		if (!(extent_pointer->flags & EXTENT_COMPRESSED) || extent_end <= offset || extent_start >= end){
+			extent_start = extent_end;
+			i++;
+			continue;
+		}
+		
+		extent * gaps = NULL;
+		int number_of_gaps = find_free_gaps(node_pointer, extent_pointer->length, &gaps);
+		if (number_of_gaps < 0){
+			return 1;
+		}
+		uint8_t * buffer = malloc(extent_pointer->length);
+		extent * released = malloc(file->number_of_extents * sizeof(extent));
+		if (buffer == NULL || released == NULL){ // malloc error
+			free(buffer);
+			free(released);
+			free(gaps);
+			return 1;
+		}
+		
+		// write the data to the free space first, it stays free if the extents can not be replaced
+		read_compressed_extent(node_pointer, extent_pointer, 0, extent_pointer->length, buffer);
+		size_t written = 0;
+		int failed = 0;
+		for (int j = 0; j < number_of_gaps && !failed; j++){
+			failed = write_file_data(node_pointer, gaps[j].offset, buffer + written, gaps[j].length);
+			written += gaps[j].length;
+		}
+		free(buffer);
+		if (failed){ // the extents are left as they were
+			free(released);
+			free(gaps);
+			return 1;
+		}
+		
+		int number_released = splice_file_extents(node_pointer, file, extent_start, extent_end, gaps, number_of_gaps, released);
+		if (number_released < 0){
+			free(released);
+			free(gaps);
+			return 1;
+		}
+		
+		// reference the new space before releasing the compressed data
+		for (int j = 0; j < number_of_gaps; j++){
+			space_adjust(node_pointer, gaps[j].offset, gaps[j].length, 1);
+		}
+		for (int j = 0; j < number_released; j++){
+			space_adjust(node_pointer, released[j].offset, released[j].length, -1);
+		}
+		free(released);
+		free(gaps);
+		
+		// the extent list changed, look again from the start
+		extent_start = 0;
+		i = 0;
+	}
+	return 0;
+}
+
+// helper function to check if the bytes [start, stop) of a file should be compressed
+// returns 0 if they are already one compressed extent or are all unwritten, returns 1 otherwise
+static int chunk_needs_compressing(offset_node * file, size_t start, size_t stop){
+	
+	size_t extent_start = 0;
+	
+	for (int i = 0; i < file->number_of_extents; i++){
+		extent * extent_pointer = &file->extents[i];
+		size_t extent_end = extent_start + extent_pointer->length;
+		
+		if (extent_start < stop && start < extent_end){
+			if (extent_pointer->flags & EXTENT_COMPRESSED){
+				return !(extent_start == start && extent_end == stop);
+			}
+			if (!(extent_pointer->flags & EXTENT_UNWRITTEN)){
+				return 1;
+			}
+		}
+		extent_start = extent_end;
+	}
+	return 0;
+}
+
+// helper function to compress the chunks of a file overlapping the bytes [offset, offset + count)
+// in volumes with FS_FEATURE_COMPRESSION
+// each chunk that shrinks by at least an eighth becomes one compressed extent in newly allocated space,
+// and the file_data it was in is released
+// chunks are left as they are if there is no free space or directory_table entry for them
+static void compress_file_range(helper_node * node_pointer, offset_node * file, size_t offset, size_t count){
+	
+	if (!(node_pointer->features & FS_FEATURE_COMPRESSION) || count == 0){
+		return;
+	}
+	
+	scratch_mark mark = scratch_save();
+	uint8_t * chunk = scratch_alloc(COMPRESSION_CHUNK_SIZE);
+	uint8_t * compressed = scratch_alloc(lz_compress_bound(COMPRESSION_CHUNK_SIZE));
+	if (chunk == NULL || compressed == NULL){ // malloc error
+		scratch_release(mark);
+		return;
+	}
+	
+	size_t end = offset + count;
+	for (size_t chunk_start = offset - (offset % COMPRESSION_CHUNK_SIZE); chunk_start < end && chunk_start < (size_t)file->length; chunk_start += COMPRESSION_CHUNK_SIZE){
+		size_t chunk_length = file->length - chunk_start;
+		if (chunk_length > COMPRESSION_CHUNK_SIZE){
+			chunk_length = COMPRESSION_CHUNK_SIZE;
+		}
+		if (!chunk_needs_compressing(file, chunk_start, chunk_start + chunk_length)){
+			continue;
+		}
+		
+		file_data_io(node_pointer, file, chunk_start, chunk_length, chunk, 0);
+		size_t compressed_length = lz_compress(chunk, chunk_length, compressed);
+		if (compressed_length + (chunk_length / 8) > chunk_length){ // not worth it
+			continue;
+		}
+		
+		int stored_offset = find_free_space(node_pointer, compressed_length);
+		if (stored_offset < 0){
+			continue;
+		}
+		if (write_file_data(node_pointer, stored_offset, compressed, compressed_length) != 0){ // the chunk stays as it was
+			continue;
+		}
+		
+		extent replacement;
+		replacement.offset = stored_offset;
+		replacement.length = chunk_length;
+		replacement.file_index = -1;
+		replacement.flags = EXTENT_COMPRESSED;
+		replacement.stored_length = compressed_length;
+		
+		extent * released = malloc(file->number_of_extents * sizeof(extent));
+		int number_released = -1;
+		if (released != NULL){
+			number_released = splice_file_extents(node_pointer, file, chunk_start, chunk_start + chunk_length, &replacement, 1, released);
+		}
+		if (number_released < 0){
+			free(released);
+			continue;
+		}
+		
+		space_adjust(node_pointer, stored_offset, compressed_length, 1);
+		for (int i = 0; i < number_released; i++){
+			space_adjust(node_pointer, released[i].offset, released[i].length, -1);
+		}
+		free(released);
+	}
+	
+	scratch_release(mark);
+}
+
+// helper function to add the free range [offset, offset + length) to the end of a file and reference it
+// the range is left unwritten if flags has EXTENT_UNWRITTEN, left as it is for the caller to write
+// if flags has EXTENT_FILLED, otherwise it is zero filled
+// it is merged into the file's last extent when they are next to each other with the same flags,
+// otherwise it becomes a new extent recorded at file_index
+// the caller writes the directory_table entries
+// returns 1 if file_index was used, returns 0 otherwise
+// returns -1 if unsuccessful (malloc error), leaving the file and its space as they were
+static int append_file_range(helper_node * node_pointer, offset_node * file, int offset, int length, int file_index, int flags){
+	
+	if (length <= 0){
+		return 0;
+	}
+	
+	if (space_adjust(node_pointer, offset, length, 1) != 0){ // malloc error
+		return -1;
+	}
+	
+	int used = 0;
+	int extent_flags = flags & ~EXTENT_FILLED;
+	extent * last = &file->extents[file->number_of_extents - 1];
+	if (last->offset + last->length == offset && last->flags == extent_flags && !(extent_flags & EXTENT_COMPRESSED)){
+		last->length += length;
+	}
+	else{
+		if (append_extent(file, offset, length, file_index, extent_flags) != 0){ // malloc error
+			space_adjust(node_pointer, offset, length, -1);
+			return -1;
+		}
+		used = 1;
+	}
+	
+	if (!(flags & (EXTENT_UNWRITTEN | EXTENT_FILLED))){
+		zero_file_data(node_pointer, offset, length);
+	}
+	file->length += length;
+	return used;
+}
+
+// helper function for creating files
+// the file is made of the given ranges of free space, which are zero filled and referenced
+// volumes with FS_FEATURE_UNWRITTEN leave the ranges unwritten instead, which takes one more directory_table
+// entry as the file's own entry always holds a written extent, and fall back to zero filling without it
+// if filled is 1 the caller writes every byte of the file straight afterwards, so the ranges are neither
+// zero filled nor left unwritten
+// returns 0 if successful, returns 1 if there are not enough free directory_table entries (or malloc error)
+static int create_file_helper(void * helper, char * filename, size_t length, extent * ranges, int number_of_ranges, int filled){
+	
+	helper_node * node_pointer = helper;
+	
+	int flags = 0;
+	int number_of_entries = number_of_ranges;
+	if ((node_pointer->features & FS_FEATURE_UNWRITTEN) && length > 0 && !filled){
+		flags = EXTENT_UNWRITTEN;
+		number_of_entries++;
+	}
+	
+	int * file_indexes = malloc(number_of_entries * sizeof(int));
+	if (file_indexes == NULL){ // malloc error
+		return 1;
+	}
+	if (find_free_file_indexes(helper, number_of_entries, file_indexes) != 0){
+		if (flags == 0 || find_free_file_indexes(helper, number_of_ranges, file_indexes) != 0){
+			free(file_indexes);
+			return 1;
+		}
+		flags = 0;
+	}
+	
+	if (add_node(helper, filename, ranges[0].offset, 0, file_indexes[0]) != 0){ // malloc error
+		free(file_indexes);
+		return 1;
+	}
+	offset_node * file = get_offset_node(helper, filename);
+	int used_entries = 1;
+	for (int i = 0; i < number_of_ranges; i++){
+		int file_index = (used_entries < number_of_entries) ? file_indexes[used_entries] : -1;
+		int used = append_file_range(node_pointer, file, ranges[i].offset, ranges[i].length, file_index, filled ? EXTENT_FILLED : flags);
+		if (used < 0){ // malloc error, nothing is in directory_table yet so the ranges taken so far are let go
+			reference_file_space(node_pointer, file, -1);
+			remove_node(helper, filename);
+			free(file_indexes);
+			return 1;
+		}
+		used_entries += used;
+	}
+	
+	// write to directory_table
+	for (int i = 0; i < file->number_of_extents; i++){
+		write_extent_record(node_pointer, file, i);
+	}
+	
+	// flush buffers for multithreading
+	fflush(node_pointer->file_data);
+	fflush(node_pointer->directory_table);
+	fflush(node_pointer->hash_data);			
+	
+	free(file_indexes);
+	return 0;
+}
+
+// helper function to find space for a new file and add it, repacking if needed
+// filled is passed on to create_file_helper, the caller updates the hash tree
+// returns 0 if file is created successfully
+// returns 1 if filename already exists or is reserved
+// returns 2 if there is insufficient space in the virtual disk overall
+static int allocate_file(void * helper, char * filename, size_t length, int filled){
+	helper_node * node_pointer = helper;
+	
+	if (reserved_filename(filename) || does_filename_exist(helper, filename) == 0){
+		return 1;
+	}
+	
+	// space held writes grow their files by is kept for them
+	if (length > node_pointer->total_space - node_pointer->filled_space - node_pointer->write_back_growth){ // insufficient space in file_data
+		return 2;
+	}
+	
+	// search for contiguous memory space >= length
+	extent range;
+	extent * ranges = &range;
+	int number_of_ranges = 1;
+	range.offset = find_free_space(node_pointer, length);
+	range.length = length;
+	
+	// if space exists after repack
+	// volumes with FS_FEATURE_EXTENTS use several smaller gaps instead
+	if (range.offset < 0 && (node_pointer->features & FS_FEATURE_EXTENTS)){
+		number_of_ranges = find_free_gaps(node_pointer, length, &ranges);
+		if (number_of_ranges < 0){
+			ranges = &range;
+			number_of_ranges = 1;
+		}
+	}
+	if (range.offset < 0 && ranges == &range){
+		repack_helper(helper);
+		range.offset = find_free_space(node_pointer, length);
+	}
+	
+	int return_value = create_file_helper(helper, filename, length, ranges, number_of_ranges, filled);
+	
+	// not enough directory_table entries for several extents, fall back to one after repacking
+	if (return_value != 0 && ranges != &range){
+		repack_helper(helper);
+		range.offset = find_free_space(node_pointer, length);
+		return_value = create_file_helper(helper, filename, length, &range, 1, filled);
+	}
+	if (ranges != &range){
+		free(ranges);
+	}
+	
+	if (return_value != 0){ // no free directory_table entry
+		return 2;
+	}
+	return 0;
+}
+
+// function to create files
+// returns 0 if file is created successfully
+// returns 1 if filename already exists or is reserved
+// returns 2 if there is insufficient space in the virtual disk overall
+static int create_file_untraced(char * filename, size_t length, void * helper) {
+	helper_node * node_pointer = helper;
+	
+	io_begin(node_pointer, IO_FOREGROUND_WRITE);
+	
+	truncate_filename(filename);
+	
+	int return_value = allocate_file(helper, filename, length, 0);
+	if (return_value != 0){
+		io_end(node_pointer);
+		return return_value;
+	}
+	
+	// the zero filled file compresses to almost nothing
+	compress_file_range(node_pointer, get_offset_node(helper, filename), 0, length);
+	hash_tree_changed(helper);
+	
+	// flush buffers for multithreading
+	fflush(node_pointer->file_data);
+	fflush(node_pointer->directory_table);
+	fflush(node_pointer->hash_data);
+	
+	io_end(node_pointer);
+	return 0;
+}
+
+// helper function to shrink a file to length, shortening or dropping extents from the end
+// the first extent is always kept, even if it becomes empty
+static void truncate_file_extents(helper_node * node_pointer, offset_node * file, size_t length){
+	
+	size_t extent_start = 0;
+	int number_kept = 0;
+	
+	for (int i = 0; i < file->number_of_extents; i++){
+		extent * extent_pointer = &file->extents[i];
+		
+		size_t keep_bytes = 0;
+		if (length > extent_start){
+			keep_bytes = length - extent_start;
+			if (keep_bytes > (size_t)extent_pointer->length){
+				keep_bytes = extent_pointer->length;
+			}
+		}
+		extent_start += extent_pointer->length;
+		
+		if (keep_bytes == 0 && i > 0){ // extent no longer needed
+			space_adjust(node_pointer, extent_pointer->offset, extent_stored_length(extent_pointer), -1);
+			clear_record(node_pointer, extent_pointer->file_index);
+			continue;
+		}
+		
+		if (keep_bytes < (size_t)extent_pointer->length){
+			// compressed extents keep all of their file_data, only the start of it is read
+			if (!(extent_pointer->flags & EXTENT_COMPRESSED)){
+				space_adjust(node_pointer, extent_pointer->offset + keep_bytes, extent_pointer->length - keep_bytes, -1);
+			}
+			extent_pointer->length = keep_bytes;
+			if (i > 0){
+				write_extent_record(node_pointer, file, i);
+			}
+		}
+		number_kept = i + 1;
+	}
+	
+	file->number_of_extents = number_kept;
+	file->length = length;
+	write_file_record(node_pointer, file);
+}
+
+// helper function to grow a file with new extents taken from free space, without moving any data
+// new extents next to the file's last extent are merged into it
+// returns 0 if successful, returns 1 if there is not enough free space or directory_table entries
+static int grow_file_extents(helper_node * node_pointer, offset_node * file, size_t growth){
+	
+	extent * gaps = NULL;
+	int number_of_gaps = find_free_gaps(node_pointer, growth, &gaps);
+	if (number_of_gaps < 0){
+		return 1;
+	}
+	
+	int * file_indexes = malloc(number_of_gaps * sizeof(int));
+	if (file_indexes == NULL || find_free_file_indexes(node_pointer, number_of_gaps, file_indexes) != 0){
+		free(file_indexes);
+		free(gaps);
+		return 1;
+	}
+	
+	int flags = (node_pointer->features & FS_FEATURE_UNWRITTEN) ? EXTENT_UNWRITTEN : 0;
+	int first_changed = file->number_of_extents - 1;
+	int last_length = file->extents[first_changed].length;
+	int used_entries = 0;
+	for (int i = 0; i < number_of_gaps; i++){
+		int file_index = (used_entries < number_of_gaps) ? file_indexes[used_entries] : -1;
+		int used = append_file_range(node_pointer, file, gaps[i].offset, gaps[i].length, file_index, flags);
+		if (used < 0){ // malloc error, the gaps taken so far are let go and the file is as it was
+			for (int j = 0; j < i; j++){
+				space_adjust(node_pointer, gaps[j].offset, gaps[j].length, -1);
+				file->length -= gaps[j].length;
+			}
+			file->number_of_extents = first_changed + 1;
+			file->extents[first_changed].length = last_length;
+			free(file_indexes);
+			free(gaps);
+			return 1;
+		}
+		used_entries += used;
+	}
+	
+	for (int i = first_changed; i < file->number_of_extents; i++){
+		write_extent_record(node_pointer, file, i);
+	}
+	write_file_record(node_pointer, file);
+	
+	free(file_indexes);
+	free(gaps);
+	return 0;
+}
+
+// helper function to give a file its own copy of the bytes [offset, offset + count) before they are written
+// the part of each extent overlapping the range which shares file_data with a snapshot or another file moves to newly
+// allocated space, which the write then fills, so no data is copied
+// compressed extents are expanded before this, so they are never shared ranges to move
+// returns 0 if successful, returns 1 if there is not enough free space or directory_table entries
+static int unshare_file_range(helper_node * node_pointer, offset_node * file, size_t offset, size_t count){
+	
+	size_t end = offset + count;
+	size_t needed = 0;
+	size_t extent_start = 0;
+	
+	// work out how much of the range is shared
+	for (int i = 0; i < file->number_of_extents; i++){
+		extent * extent_pointer = &file->extents[i];
+		size_t start = (extent_start > offset) ? extent_start : offset;
+		size_t stop = (extent_start + extent_pointer->length < end) ? extent_start + extent_pointer->length : end;
+		
+		if (start < stop && !(extent_pointer->flags & EXTENT_COMPRESSED) && space_shared(node_pointer, extent_pointer->offset + (start - extent_start), stop - start)){
+			needed += stop - start;
+		}
+		extent_start += extent_pointer->length;
+	}
+	
+	if (needed == 0){ // nothing shared
+		return 0;
+	}
+	
+	extent * gaps = NULL;
+	int number_of_gaps = find_free_gaps(node_pointer, needed, &gaps);
+	if (number_of_gaps < 0){
+		return 1;
+	}
+	
+	// build the new extent list, and the list of shared ranges the file stops referencing
+	int capacity = (3 * file->number_of_extents) + number_of_gaps + 1;
+	extent * new_extents = malloc(capacity * sizeof(extent));
+	extent * released = malloc(file->number_of_extents * sizeof(extent));
+	if (new_extents == NULL || released == NULL){ // malloc error
+		free(new_extents);
+		free(released);
+		free(gaps);
+		return 1;
+	}
+	int number_of_new_extents = 0;
+	int number_released = 0;
+	int gap = 0;
+	int gap_used = 0;
+	extent_start = 0;
+	
+	for (int i = 0; i < file->number_of_extents; i++){
+		extent * extent_pointer = &file->extents[i];
+		size_t extent_end = extent_start + extent_pointer->length;
+		size_t start = (extent_start > offset) ? extent_start : offset;
+		size_t stop = (extent_end < end) ? extent_end : end;
+		
+		if (start >= stop || (extent_pointer->flags & EXTENT_COMPRESSED) || !space_shared(node_pointer, extent_pointer->offset + (start - extent_start), stop - start)){
+			keep_extent(new_extents, &number_of_new_extents, extent_pointer);
+			extent_start = extent_end;
+			continue;
+		}
+		
+		// part before the range stays
+		add_extent_piece(new_extents, &number_of_new_extents, extent_pointer->offset, start - extent_start, extent_pointer->flags);
+		
+		// part in the range moves to the free gaps
+		size_t remaining = stop - start;
+		while (remaining > 0){
+			size_t piece = gaps[gap].length - gap_used;
+			if (piece > remaining){
+				piece = remaining;
+			}
+			add_extent_piece(new_extents, &number_of_new_extents, gaps[gap].offset + gap_used, piece, 0);
+			gap_used += piece;
+			remaining -= piece;
+			if (gap_used == gaps[gap].length){
+				gap++;
+				gap_used = 0;
+			}
+		}
+		released[number_released].offset = extent_pointer->offset + (start - extent_start);
+		released[number_released].length = stop - start;
+		number_released++;
+		
+		// part after the range stays
+		add_extent_piece(new_extents, &number_of_new_extents, extent_pointer->offset + (stop - extent_start), extent_end - stop, extent_pointer->flags);
+		extent_start = extent_end;
+	}
+	
+	// reuse the file's directory_table entries, taking free ones for extra extents
+	if (replace_file_extents(node_pointer, file, new_extents, number_of_new_extents, capacity) != 0){
+		free(new_extents);
+		free(released);
+		free(gaps);
+		return 1;
+	}
+	
+	// reference the new space before releasing the shared space
+	for (int i = 0; i < number_of_gaps; i++){
+		space_adjust(node_pointer, gaps[i].offset, gaps[i].length, 1);
+	}
+	for (int i = 0; i < number_released; i++){
+		space_adjust(node_pointer, released[i].offset, released[i].length, -1);
+	}
+	
+	free(released);
+	free(gaps);
+	return 0;
+}
+
+// helper function to make the bytes [offset, offset + count) of a file written before they are written
+// unwritten extents overlapping the range are split so only the range becomes written, without writing file_data
+// if there are not enough directory_table entries for the split, the overlapping extents are zero filled instead
+// returns 0 if successful, returns 1 if unsuccessful (malloc error)
+static int materialize_file_range(helper_node * node_pointer, offset_node * file, size_t offset, size_t count){
+	
+	size_t end = offset + count;
+	size_t extent_start = 0;
+	int overlapping = 0;
+	
+	for (int i = 0; i < file->number_of_extents; i++){
+		size_t extent_end = extent_start + file->extents[i].length;
+		if ((file->extents[i].flags & EXTENT_UNWRITTEN) && extent_start < end && offset < extent_end){
+			overlapping = 1;
+		}
+		extent_start = extent_end;
+	}
+	
+	if (!overlapping){ // nothing to do
+		return 0;
+	}
+	
+	int capacity = (3 * file->number_of_extents) + 1;
+	extent * new_extents = malloc(capacity * sizeof(extent));
+	if (new_extents == NULL){ // malloc error
+		return 1;
+	}
+	int number_of_new_extents = 0;
+	extent_start = 0;
+	
+	for (int i = 0; i < file->number_of_extents; i++){
+		extent * extent_pointer = &file->extents[i];
+		size_t extent_end = extent_start + extent_pointer->length;
+		size_t start = (extent_start > offset) ? extent_start : offset;
+		size_t stop = (extent_end < end) ? extent_end : end;
+		
+		if (start >= stop || !(extent_pointer->flags & EXTENT_UNWRITTEN)){
+			keep_extent(new_extents, &number_of_new_extents, extent_pointer);
+		}
+		else{
+			add_extent_piece(new_extents, &number_of_new_extents, extent_pointer->offset, start - extent_start, EXTENT_UNWRITTEN);
+			add_extent_piece(new_extents, &number_of_new_extents, extent_pointer->offset + (start - extent_start), stop - start, 0);
+			add_extent_piece(new_extents, &number_of_new_extents, extent_pointer->offset + (stop - extent_start), extent_end - stop, EXTENT_UNWRITTEN);
+		}
+		extent_start = extent_end;
+	}
+	
+	if (replace_file_extents(node_pointer, file, new_extents, number_of_new_extents, capacity) == 0){
+		return 0;
+	}
+	free(new_extents);
+	
+	// no directory_table entries for the split, write the zeros
+	extent_start = 0;
+	for (int i = 0; i < file->number_of_extents; i++){
+		extent * extent_pointer = &file->extents[i];
+		size_t extent_end = extent_start + extent_pointer->length;
+		if ((extent_pointer->flags & EXTENT_UNWRITTEN) && extent_start < end && offset < extent_end){
+			zero_file_data(node_pointer, extent_pointer->offset, extent_pointer->length);
+			extent_pointer->flags = 0;
+			write_extent_record(node_pointer, file, i);
+		}
+		extent_start = extent_end;
+	}
+	return 0;
+}
+
+// helper method for resizing file
+// returns 1 if file does not exist
+// returns 2 if not enough space in file system
+// returns 0 if file resized successfully
+static int resize_file_helper(char * filename, size_t length, void * helper){
+
+	helper_node * node_pointer = helper;
+	
+	offset_node * offset_tmp_node = get_offset_node(helper, filename);
+	
+	if (offset_tmp_node == NULL){ // file does not exist
+		return 1;
+	}
+	
+	// bytes shared with a snapshot or clone stay in use if the file has to move,
+	// and growing cannot take the space kept free for held writes
+	size_t reserved = (length > (size_t)offset_tmp_node->length) ? node_pointer->write_back_growth : 0;
+	if (node_pointer->filled_space - file_owned_space(node_pointer, offset_tmp_node) + length + reserved > node_pointer->total_space){ // if not enough space in disk
+		return 2;
+	}
+	
+	if (length <= (size_t)offset_tmp_node->length){ // truncate file
+		truncate_file_extents(node_pointer, offset_tmp_node, length);
+		fflush(node_pointer->directory_table);
+		return 0;
+	}
+	
+	size_t growth = length - offset_tmp_node->length;
+	extent * last = &offset_tmp_node->extents[offset_tmp_node->number_of_extents - 1];
+	int last_end = last->offset + extent_stored_length(last);
+	
+	// pad with zeros, or leave unwritten if there is a directory_table entry for it
+	int flags = (node_pointer->features & FS_FEATURE_UNWRITTEN) ? EXTENT_UNWRITTEN : 0;
+	int file_index = -1;
+	if ((size_t)(space_gap_end(node_pointer, last_end) - last_end) >= growth && flags != last->flags){
+		file_index = find_free_file_index(helper);
+		if (file_index < 0){
+			flags = last->flags;
+		}
+	}
+	
+	// compressed extents can not grow, the space after one needs a directory_table entry of its own
+	if ((size_t)(space_gap_end(node_pointer, last_end) - last_end) >= growth && !(flags & EXTENT_COMPRESSED)){ // space exists so just resize
+		if (append_file_range(node_pointer, offset_tmp_node, last_end, growth, file_index, flags) < 0){ // malloc error
+			return 2;
+		}
+		
+		//update directory_table
+		write_extent_record(node_pointer, offset_tmp_node, offset_tmp_node->number_of_extents - 1);
+		if (offset_tmp_node->number_of_extents > 1){
+			write_file_record(node_pointer, offset_tmp_node);
+		}
+		
+		// flush buffers for multithreading
+		fflush(node_pointer->file_data);
+		fflush(node_pointer->directory_table);
+		return 0;
+	}
+	
+	// volumes with FS_FEATURE_EXTENTS grow into free space wherever it is instead of relocating the file
+	if ((node_pointer->features & FS_FEATURE_EXTENTS) && grow_file_extents(node_pointer, offset_tmp_node, growth) == 0){
+		fflush(node_pointer->file_data);
+		fflush(node_pointer->directory_table);
+		return 0;
+	}
+
+	// take node out of list
+	
+	int original_size = offset_tmp_node->length;
+	//assuming we keep the file index the same
+	int original_file_index = offset_tmp_node->file_index;
+	
+	// pad the memory with 0s
+	void * file_data_buffer = calloc(1, length);
+	if (file_data_buffer == NULL){ // malloc error
+		return 2;
+	}
+	file_data_io(node_pointer, offset_tmp_node, 0, original_size, file_data_buffer, 0);
+	
+	// handles follow the file to its new node
+	int * handles = NULL;
+	int number_of_handles = take_handles(node_pointer, offset_tmp_node, &handles);
+	if (number_of_handles < 0){ // malloc error, nothing has changed yet
+		free(file_data_buffer);
+		return 2;
+	}
+	delete_file_helper(filename, helper);
+	
+	//repack
+	repack_helper(helper);
+	
+	int new_offset = find_free_space(node_pointer, length);
+	
+	// add the node
+	add_node(helper, filename, new_offset, length, original_file_index);
+	offset_tmp_node = get_offset_node(helper, filename);
+	reference_file_space(node_pointer, offset_tmp_node, 1);
+	give_handles(node_pointer, offset_tmp_node, handles, number_of_handles);
+	
+	// add the file data
+	write_file_data(node_pointer, new_offset, file_data_buffer, length);
+			
+	//update directory_table
+	write_file_record(node_pointer, offset_tmp_node);
+	
+	free(file_data_buffer);	
+    return 0;
+}
+
+// helper function to check if the bytes [offset, offset + count) of a file can be written in place
+// returns 1 if they are inside the file, in written extents not shared with a snapshot or clone
+// and the volume does not compress, returns 0 otherwise
+static int is_plain_overwrite(helper_node * node_pointer, offset_node * file, size_t offset, size_t count){
+	
+	if ((node_pointer->features & FS_FEATURE_COMPRESSION) || offset + count > (size_t)file->length){
+		return 0;
+	}
+	
+	size_t end = offset + count;
+	size_t extent_start = 0;
+	for (int i = 0; i < file->number_of_extents; i++){
+		extent * extent_pointer = &file->extents[i];
+		size_t extent_end = extent_start + extent_pointer->length;
+		size_t start = (extent_start > offset) ? extent_start : offset;
+		size_t stop = (extent_end < end) ? extent_end : end;
+		
+		if (start < stop && (extent_pointer->flags != 0 || space_shared(node_pointer, extent_pointer->offset + (start - extent_start), stop - start))){
+			return 0;
+		}
+		extent_start = extent_end;
+	}
+	return 1;
+}
+
+// helper function to hash again the blocks holding the bytes [offset, offset + count) of a file
+// used instead of rebuilding the whole hash tree after a write in place
+static void update_file_hashes(helper_node * node_pointer, offset_node * file, size_t offset, size_t count){
+	
+	size_t end = offset + count;
+	size_t extent_start = 0;
+	
+	for (int i = 0; i < file->number_of_extents; i++){
+		extent * extent_pointer = &file->extents[i];
+		size_t extent_end = extent_start + extent_pointer->length;
+		size_t start = (extent_start > offset) ? extent_start : offset;
+		size_t stop = (extent_end < end) ? extent_end : end;
+		
+		if (start < stop){
+			update_hash_range(node_pointer, extent_pointer->offset + (start - extent_start), stop - start);
+		}
+		extent_start = extent_end;
+	}
+}
+
+// helper function to write count bytes to a file at offset, within the file's length
+// compressed data is expanded, data shared with a snapshot or clone is copied on write,
+// unwritten data becomes written, and the bytes are compressed again afterwards
+// returns 0 if the bytes were written in place so only their hashes changed,
+// returns 1 if extents changed so the whole hash tree has to be rebuilt,
+// returns -1 if there is not enough free space or directory_table entries (nothing is written)
+static int write_file_range(helper_node * node_pointer, offset_node * file, size_t offset, size_t count, void * buf){
+	
+	if (is_plain_overwrite(node_pointer, file, offset, count)){
+		file_data_io(node_pointer, file, offset, count, buf, 1);
+		return 0;
+	}
+	
+	if (expand_file_range(node_pointer, file, offset, count) != 0 || unshare_file_range(node_pointer, file, offset, count) != 0 || materialize_file_range(node_pointer, file, offset, count) != 0){
+		return -1;
+	}
+	
+	file_data_io(node_pointer, file, offset, count, buf, 1);
+	compress_file_range(node_pointer, file, offset, count);
+	return 1;
+}
+
+// helper function to add a write to the held back writes of a file, merging it with the runs it overlaps or touches
+// the new bytes replace older held bytes, and a run extended at its end grows in place
+// returns 0 if successful, returns 1 if unsuccessful (malloc error)
+static int add_write_back_run(write_back * write_back_pointer, size_t offset, size_t count, void * buf){
+	
+	size_t start = offset;
+	size_t end = offset + count;
+	
+	// find the first run that ends at or after start, then every run up to end merges with the write
+	write_back_run ** link = &write_back_pointer->runs;
+	while (*link != NULL && (*link)->offset + (*link)->length < start){
+		link = &(*link)->next;
+	}
+	size_t new_start = start;
+	size_t new_end = end;
+	int number_merged = 0;
+	write_back_run * run = *link;
+	while (run != NULL && run->offset <= end){
+		if (run->offset < new_start){
+			new_start = run->offset;
+		}
+		if (run->offset + run->length > new_end){
+			new_end = run->offset + run->length;
+		}
+		number_merged++;
+		run = run->next;
+	}
+	
+	// one run starting at or before the write, such as an append, grows in place
+	if (number_merged == 1 && (*link)->offset == new_start){
+		run = *link;
+		size_t new_length = new_end - new_start;
+		if (new_length > run->capacity){
+			size_t new_capacity = run->capacity * 2;
+			if (new_capacity < new_length){
+				new_capacity = new_length;
+			}
+			uint8_t * new_data = realloc(run->data, new_capacity);
+			if (new_data == NULL){ // malloc error
+				return 1;
+			}
+			run->data = new_data;
+			run->capacity = new_capacity;
+		}
+		memcpy(run->data + (start - new_start), buf, count);
+		write_back_pointer->bytes += new_length - run->length;
+		run->length = new_length;
+		return 0;
+	}
+	
+	write_back_run * new_run = malloc(sizeof(write_back_run));
+	uint8_t * data = malloc(new_end - new_start);
+	if (new_run == NULL || data == NULL){ // malloc error
+		free(new_run);
+		free(data);
+		return 1;
+	}
+	
+	// copy the merged runs, then the new bytes over them
+	run = *link;
+	while (run != NULL && run->offset <= end){
+		write_back_run * next_run = run->next;
+		memcpy(data + (run->offset - new_start), run->data, run->length);
+		write_back_pointer->bytes -= run->length;
+		free(run->data);
+		free(run);
+		run = next_run;
+	}
+	memcpy(data + (start - new_start), buf, count);
+	
+	new_run->offset = new_start;
+	new_run->length = new_end - new_start;
+	new_run->capacity = new_run->length;
+	new_run->data = data;
+	new_run->next = run;
+	*link = new_run;
+	write_back_pointer->bytes += new_run->length;
+	return 0;
+}
+
+// helper function to write the held back writes of a file to file_data
+// the file grows once to its new length, then each run is written in offset order
+// and the hash tree is updated once for all of them
+// returns 0 if successful, returns 1 if unsuccessful (not enough space or malloc error, the held writes stay held)
+static int flush_write_back(helper_node * node_pointer, offset_node * file){
+	
+	write_back * write_back_pointer = file->write_back;
+	if (write_back_pointer == NULL){
+		return 0;
+	}
+	file->write_back = NULL;
+	node_pointer->write_back_files--;
+	node_pointer->changes++; // read-ahead may hold what file_data had before
+	node_pointer->write_back_growth -= write_back_pointer->reserved;
+	
+	// growing can move the file to a new node
+	char filename[64];
+	strncpy(filename, file->filename, 64);
+	
+	int return_value = 0;
+	int rebuild = 0;
+	if (write_back_pointer->length > (size_t)file->length){
+		if (resize_file_helper(filename, write_back_pointer->length, node_pointer) != 0){
+			return_value = 1;
+		}
+		file = get_offset_node(node_pointer, filename);
+		rebuild = 1;
+	}
+	
+	write_back_run * run = write_back_pointer->runs;
+	while (run != NULL && return_value == 0){
+		int written = write_file_range(node_pointer, file, run->offset, run->length, run->data);
+		if (written < 0){
+			return_value = 1;
+		}
+		rebuild |= (written != 0);
+		run = run->next;
+	}
+	
+	// one hash update for every run, only the blocks written need hashing if no extent changed
+	run = write_back_pointer->runs;
+	if (rebuild){
+		hash_tree_changed(node_pointer);
+	}
+	while (run != NULL){
+		write_back_run * next_run = run->next;
+		if (!rebuild){
+			update_file_hashes(node_pointer, file, run->offset, run->length);
+		}
+		if (return_value == 0){
+			free(run->data);
+			free(run);
+		}
+		run = next_run;
+	}
+	
+	// runs that could not all be written are held again, and written in full by a later flush
+	if (return_value != 0){
+		file->write_back = write_back_pointer;
+		node_pointer->write_back_files++;
+		node_pointer->write_back_growth += write_back_pointer->reserved;
+	}
+	else{
+		free(write_back_pointer);
+	}
+	
+	// flush buffers for multithreading
+	fflush(node_pointer->file_data);
+	fflush(node_pointer->directory_table);
+	fflush(node_pointer->hash_data);
+	return return_value;
+}
+
+// helper function to write the held back writes of every file to file_data
+// returns 0 if successful, returns 1 if any of them could not be written
+static int flush_all_write_back(helper_node * node_pointer){
+	
+	int return_value = 0;
+	
+	// flushing keeps every name, so each file keeps its place in the name index
+	for (int i = 0; i < node_pointer->name_count && node_pointer->write_back_files > 0; i++){
+		return_value |= flush_write_back(node_pointer, node_pointer->name_index[i]);
+	}
+	return return_value;
+}
+
+// helper function to write the held back writes that have waited longer than write_back_delay
+// held writes that cannot be written stay held for the next call that needs them
+static void flush_expired_write_back(helper_node * node_pointer){
+	
+	if (node_pointer->write_back_files == 0 || node_pointer->write_back_delay <= 0){
+		return;
+	}
+	
+	long now = current_milliseconds();
+	if (now - node_pointer->write_back_oldest < node_pointer->write_back_delay){
+		return;
+	}
+	
+	long oldest = now;
+	for (int i = 0; i < node_pointer->name_count; i++){
+		write_back * write_back_pointer = node_pointer->name_index[i]->write_back;
+		if (write_back_pointer == NULL){
+			continue;
+		}
+		if (now - write_back_pointer->since >= node_pointer->write_back_delay){
+			flush_write_back(node_pointer, node_pointer->name_index[i]);
+		}
+		else if (write_back_pointer->since < oldest){
+			oldest = write_back_pointer->since;
+		}
+	}
+	node_pointer->write_back_oldest = oldest;
+}
+
+// helper function to check if reading the bytes [offset, offset + count) of a file needs its held writes
+// returns 1 if a held write overlaps the range or the range goes past the file_data written so far, returns 0 otherwise
+static int write_back_overlaps(offset_node * file, size_t offset, size_t count){
+	
+	if (offset + count > (size_t)file->length){
+		return 1;
+	}
+	
+	write_back_run * run = file->write_back->runs;
+	while (run != NULL && run->offset < offset + count){
+		if (offset < run->offset + run->length){
+			return 1;
+		}
+		run = run->next;
+	}
+	return 0;
+}
+
+// helper function to hold back a small write to a file instead of writing it to file_data
+// the part of the write inside the file has to be a plain overwrite, and growth has to fit in the free space
+// left by other held writes, counted as resize_file_helper counts it so the file can always be resized once flushed
+// returns 0 if the write is held, returns 1 if it has to be written straight away
+static int hold_write_back(helper_node * node_pointer, offset_node * file, size_t offset, size_t count, void * buf){
+	
+	if (count == 0 || count >= node_pointer->write_back_size){
+		return 1;
+	}
+	
+	size_t length = (file->write_back != NULL) ? file->write_back->length : (size_t)file->length;
+	size_t stored_end = (offset + count < (size_t)file->length) ? offset + count : (size_t)file->length;
+	if (offset < stored_end && !is_plain_overwrite(node_pointer, file, offset, stored_end - offset)){
+		return 1;
+	}
+	
+	// a file that may have to move needs room for all of its bytes, less those only it uses
+	size_t new_length = (offset + count > length) ? offset + count : length;
+	size_t reserved = 0;
+	if (new_length > (size_t)file->length){
+		size_t owned_space = file_owned_space(node_pointer, file);
+		reserved = (new_length > owned_space) ? new_length - owned_space : 0;
+	}
+	size_t held_reserved = (file->write_back != NULL) ? file->write_back->reserved : 0;
+	if (node_pointer->filled_space + node_pointer->write_back_growth - held_reserved + reserved > node_pointer->total_space){
+		return 1;
+	}
+	
+	if (file->write_back == NULL){
+		file->write_back = calloc(1, sizeof(write_back));
+		if (file->write_back == NULL){ // malloc error
+			return 1;
+		}
+		file->write_back->length = file->length;
+		file->write_back->since = current_milliseconds();
+		if (node_pointer->write_back_files == 0){
+			node_pointer->write_back_oldest = file->write_back->since;
+		}
+		node_pointer->write_back_files++;
+	}
+	
+	if (add_write_back_run(file->write_back, offset, count, buf) != 0){
+		return 1;
+	}
+	file->write_back->length = new_length;
+	file->write_back->reserved = reserved;
+	node_pointer->write_back_growth += reserved - held_reserved;
+	
+	// held writes that cannot be written yet stay held
+	if (file->write_back->bytes >= node_pointer->write_back_size){
+		flush_write_back(node_pointer, file);
+	}
+	return 0;
+}
+
+// function to close all files and free all memory
+void close_fs(void * helper) {
+	helper_node * node_pointer = helper;
+	
+	// stop the scrubber before anything it uses is freed
+	if (node_pointer->scrub_running){
+		pthread_mutex_lock(&node_pointer->io_lock);
+		node_pointer->scrub_running = 0;
+		pthread_cond_signal(&node_pointer->scrub_wake);
+		pthread_mutex_unlock(&node_pointer->io_lock);
+		pthread_join(node_pointer->scrubber, NULL);
+	}
+	
+	// and the read-ahead thread
+	if (node_pointer->read_ahead_running){
+		pthread_mutex_lock(&node_pointer->io_lock);
+		node_pointer->read_ahead_running = 0;
+		pthread_cond_signal(&node_pointer->read_ahead_wake);
+		pthread_mutex_unlock(&node_pointer->io_lock);
+		pthread_join(node_pointer->read_ahead_thread, NULL);
+	}
+	if (flush_all_write_back(node_pointer) != 0){
+		printf("Error: held writes could not be written\n");
+	}
+	
+	// snapshots end with the session
+	// hash_data must match the unwritten ranges init_fs finds, which no longer include those of snapshots
+	int unwritten_snapshots = 0;
+	while (node_pointer->snapshots != NULL){
+		snapshot * next_snapshot = node_pointer->snapshots->next;
+		unwritten_snapshots |= list_has_unwritten_extents(node_pointer->snapshots->files);
+		free_file_list(node_pointer, node_pointer->snapshots->files);
+		free(node_pointer->snapshots);
+		node_pointer->snapshots = next_snapshot;
+	}
+	if (unwritten_snapshots){
+		node_pointer->tree_stale = 1;
+	}
+	sync_hash_tree(node_pointer);
+	direct_hash_flush(node_pointer);
+	
+	fseek(node_pointer->file_data, 0, SEEK_END);
+#ifdef FS_TRACE_SPANS
+	if (node_pointer->span_path != NULL && dump_spans_since(node_pointer->span_path, node_pointer->span_start) != 0){
+		perror("Error");
+	}
+#endif
+	free_helper(node_pointer);
+    return;
+}
+
+// computes hash tree of file_data and stores it in hash_data
+// calls recursive hash calculation function
+static void compute_hash_tree_untraced(void * helper) {
+	helper_node * node_pointer = helper;
+	io_begin(node_pointer, IO_BACKGROUND);
+	rebuild_hash_tree(helper);
+	
+	// flush buffers for multithreading
+	fflush(node_pointer->file_data);
+	fflush(node_pointer->directory_table);
+	fflush(node_pointer->hash_data);		
+	
+	io_end(node_pointer);
+    return;
+}
+
+// function to write every held back write to file_data and bring hash_data up to date
+// held writes that cannot be written stay held
+static void sync_fs_untraced(void * helper) {
+	helper_node * node_pointer = helper;
+	io_begin(node_pointer, IO_FOREGROUND_WRITE);
+	flush_all_write_back(node_pointer);
+	sync_hash_tree(node_pointer);
+	
+	// flush buffers for multithreading
+	fflush(node_pointer->file_data);
+	fflush(node_pointer->directory_table);
+	fflush(node_pointer->hash_data);
+	
+	io_end(node_pointer);
+}
+
+// function to verify every block of file_data against hash_data now, recording the results as the scrubber does
+// returns the number of corrupt blocks
+static int scrub_fs_untraced(void * helper) {
+	helper_node * node_pointer = helper;
+	io_begin(node_pointer, IO_BACKGROUND);
+	
+	int corrupt_blocks = 0;
+	int number_of_subtrees = (node_pointer->number_of_blocks + SCRUB_SUBTREE_BLOCKS - 1) / SCRUB_SUBTREE_BLOCKS;
+	for (int subtree = 0; subtree < number_of_subtrees; subtree++){
+		corrupt_blocks += scrub_subtree(node_pointer, subtree);
+	}
+	
+	// flush buffers for multithreading
+	fflush(node_pointer->file_data);
+	fflush(node_pointer->hash_data);
+	
+	io_end(node_pointer);
+	return corrupt_blocks;
+}
+
+// function to list the blocks the scrubber found corrupt and has not found correct since, in order
+// writes up to max block offsets to blocks
+// returns the number of corrupt blocks
+static int scrub_corrupt_blocks_untraced(size_t * blocks, int max, void * helper) {
+	helper_node * node_pointer = helper;
+	io_begin(node_pointer, IO_FOREGROUND_READ);
+	
+	for (int i = 0; i < node_pointer->corrupt_count && i < max; i++){
+		blocks[i] = node_pointer->corrupt_blocks[i];
+	}
+	int corrupt_count = node_pointer->corrupt_count;
+	
+	io_end(node_pointer);
+	return corrupt_count;
+}
+
+// returns the milliseconds since the scrubber last found every block in the subtree holding block_offset correct
+// returns -1 if it never has, if a block in the subtree is corrupt or if there is no such block
+static long scrub_age_untraced(size_t block_offset, void * helper) {
+	helper_node * node_pointer = helper;
+	io_begin(node_pointer, IO_FOREGROUND_READ);
+	
+	long age = -1;
+	if (block_offset < (size_t)node_pointer->number_of_blocks && node_pointer->scrub_times[block_offset / SCRUB_SUBTREE_BLOCKS] != 0){
+		age = current_milliseconds() - node_pointer->scrub_times[block_offset / SCRUB_SUBTREE_BLOCKS];
+	}
+	
+	io_end(node_pointer);
+	return age;
+}
+
+// function to resize a file
+// returns 0 if file is successfully resized
+// returns 1 if the file does not exist
+// returns 2 if there is insufficient space in the virtual disk overall for the new file size, or held writes cannot be written
+static int resize_file_untraced(char * filename, size_t length, void * helper) {
+	truncate_filename(filename);
+	helper_node * node_pointer = helper;
+	
+	io_begin(node_pointer, IO_FOREGROUND_WRITE);
+	if (flush_all_write_back(node_pointer) != 0){
+		io_end(node_pointer);
+		return 2;
+	}
+	offset_node * offset_tmp_node = get_offset_node(helper, filename);
+	size_t original_length = (offset_tmp_node != NULL) ? offset_tmp_node->length : 0;
+	SPAN_BEGIN("resize_file_helper");
+	int return_value = resize_file_helper(filename, length, helper);
+	SPAN_END("resize_file_helper");
+	
+	// the zero filled growth compresses to almost nothing
+	if (return_value == 0 && length > original_length){
+		compress_file_range(node_pointer, get_offset_node(helper, filename), original_length, length - original_length);
+	}
+	hash_tree_changed(helper);
+	
+	// flush buffers for multithreading
+	fflush(node_pointer->file_data);
+	fflush(node_pointer->directory_table);
+	fflush(node_pointer->hash_data);
+	
+	io_end(node_pointer);
+	return return_value;
+};
+
+// function to repack the files in the file system
+static void repack_untraced(void * helper) {
+	helper_node * node_pointer = helper;
+	io_begin(node_pointer, IO_BACKGROUND);
+	
+	// repack a slice at a time, giving way to foreground calls in between
+	while (1){
+		SPAN_BEGIN("repack_slice");
+		long moved_bytes = repack_slice(helper, REPACK_SLICE_SIZE);
+		SPAN_END("repack_slice");
+		if (moved_bytes <= 0){
+			break;
+		}
+		SPAN_BEGIN("io_pace");
+		io_pace(node_pointer, moved_bytes);
+		SPAN_END("io_pace");
+	}
+	
+	// flush buffers for multithreading
+	fflush(node_pointer->file_data);
+	fflush(node_pointer->directory_table);
+	fflush(node_pointer->hash_data);
+	
+	io_end(node_pointer);
+	return;
+}
+
+// function to delete files from file system
+// returns 0 if file is susccessfull deleted
+// returns 1 if error occurs, such as file not existing
+static int delete_file_untraced(char * filename, void * helper) {
+	truncate_filename(filename);
+	
+	helper_node * node_pointer = helper;
+	io_begin(node_pointer, IO_FOREGROUND_WRITE);
+	
+	// unwritten ranges of the file are hashed as zeros, so the hash tree changes if they are freed
+	offset_node * tmp = get_offset_node(helper, filename);
+	int rehash = (tmp != NULL && has_unwritten_extents(tmp));
+	int file_index = (tmp != NULL) ? tmp->file_index : -1;
+	int return_value = delete_file_helper(filename, helper);
+	if (rehash){
+		hash_tree_changed(helper);
+	}
+	
+	// handles other processes have to the file are dropped when they load their file lists again
+	if (return_value == 0 && node_pointer->shared != NULL && file_index / 72 < node_pointer->shared_entries){
+		node_pointer->entry_generations[file_index / 72]++;
+	}
+	
+	// flush buffers for multithreading
+	fflush(node_pointer->file_data);
+	fflush(node_pointer->directory_table);
+	fflush(node_pointer->hash_data);	
+	
+	io_end(node_pointer);
+	return return_value;
+	
+}
+
+// function to rename a file
+// returns 0 if file is successfully renamed
+// returns 1 if error occurs, such as file not existing or the new name being reserved
+static int rename_file_untraced(char * oldname, char * newname, void * helper) {
+	helper_node * node_pointer = helper;
+	io_begin(node_pointer, IO_FOREGROUND_WRITE);
+	truncate_filename(newname);
+	int newname_length = strlen(newname) + 1;
+	
+	if (reserved_filename(newname) || does_filename_exist(helper, newname) == 0){ //if the newname already exists or is reserved
+		io_end(node_pointer);
+		return 1;
+	}
+	
+	if (does_filename_exist(helper, oldname) != 0){ //if the oldname doesn't exist
+		io_end(node_pointer);
+		return 1;
+	}
+	
+	// thread this plz its gonna be so slow
+	offset_node * tmp_offset_node = get_offset_node(helper, oldname);
+	
+	if (tmp_offset_node == NULL){
+		io_end(node_pointer);
+		return 1;
+	}
+	
+	char * interned_name = intern_name(node_pointer, newname);
+	if (interned_name == NULL){ // malloc error
+		io_end(node_pointer);
+		return 1;
+	}
+	
+	// the file moves to its new place in the name index
+	name_index_remove(node_pointer, tmp_offset_node);
+	release_name(node_pointer, tmp_offset_node->filename);
+	tmp_offset_node->filename = interned_name;
+	name_index_insert(node_pointer, tmp_offset_node);
+	fseek(node_pointer->directory_table, tmp_offset_node->file_index, SEEK_SET);
+	fwrite(newname, newname_length, 1, node_pointer->directory_table);
+	node_pointer->io_metadata = 1;
+	
+	// flush buffers for multithreading
+	fflush(node_pointer->file_data);	
+	fflush(node_pointer->directory_table);
+	fflush(node_pointer->hash_data);
+	
+    io_end(node_pointer);
+	return 0;
+}
 
-// function to close all files and free all memory
-void close_fs(void * helper) {
+// helper function to verify blocks start_block to end_block of file_data
+// returns the total number of nodes within hash tree that are incorrect
+static int verify_blocks(helper_node * node_pointer, int start_block, int end_block){
+	
+	int hash_fails = 0;
+	
+	// hashes deferred for these blocks are worked out before they are checked,
+	// blocks the scrubber found correct recently are trusted
+	sync_hash_blocks(node_pointer, start_block, end_block);
+	for (int j = start_block; j <= end_block; j++){
+		if (!scrub_trusted(node_pointer, j)){
+			hash_fails += verify_hash_block(j, node_pointer);
+		}
+	}
+	return hash_fails;
+}
+
+// helper function to verify every block holding data of an extent
+// returns the total number of nodes within hash tree that are incorrect
+static int verify_extent_blocks(helper_node * node_pointer, extent * extent_pointer){
+	
+	int start_block = extent_pointer->offset >> node_pointer->block_shift;
+	int end_block = start_block;
+	if (extent_stored_length(extent_pointer) > 0){
+		end_block = (extent_pointer->offset + extent_stored_length(extent_pointer) - 1) >> node_pointer->block_shift;
+	}
+	return verify_blocks(node_pointer, start_block, end_block);
+}
+
+// helper function to verify every block holding data of a file
+// returns the total number of nodes within hash tree that are incorrect
+static int verify_file_blocks(helper_node * node_pointer, offset_node * file){
+	
+	int hash_fails = 0;
+	
+	for (int i = 0; i < file->number_of_extents; i++){
+		if (file->extents[i].length == 0 && i > 0){
+			continue;
+		}
+		hash_fails += verify_extent_blocks(node_pointer, &file->extents[i]);
+	}
+	return hash_fails;
+}
+
+// helper function to verify the blocks holding bytes offset to offset + count of a file
+// compressed extents are verified whole, as any of their bytes can be needed to expand the range
+// returns the total number of nodes within hash tree that are incorrect
+static int verify_file_range(helper_node * node_pointer, offset_node * file, size_t offset, size_t count){
+	
+	int hash_fails = 0;
+	size_t end = offset + count;
+	size_t extent_start = 0;
+	
+	for (int i = 0; i < file->number_of_extents && extent_start < end; i++){
+		extent * extent_pointer = &file->extents[i];
+		size_t extent_end = extent_start + extent_pointer->length;
+		
+		if (offset < extent_end){
+			if (extent_pointer->flags & EXTENT_COMPRESSED){
+				hash_fails += verify_extent_blocks(node_pointer, extent_pointer);
+			}
+			else{
+				size_t start = (offset > extent_start) ? offset : extent_start;
+				size_t stop = (end < extent_end) ? end : extent_end;
+				hash_fails += verify_blocks(node_pointer, (extent_pointer->offset + (start - extent_start)) >> node_pointer->block_shift,
+					(extent_pointer->offset + (stop - extent_start) - 1) >> node_pointer->block_shift);
+			}
+		}
+		extent_start = extent_end;
+	}
+	return hash_fails;
+}
+
+// function to clone a file
+// the new file shares every extent of the source file, so no file_data is copied or hashed
+// shared file_data is copied on write, and init_fs counts the references again from the extents
+// returns 0 if file is successfully cloned
+// returns 1 if error occurs, such as the source not existing, the new name already existing or being reserved,
+// or held writes to the source that cannot be written
+// returns 2 if there are not enough free directory_table entries, or if unsuccessful (malloc error)
+static int clone_file_untraced(char * src, char * dst, void * helper) {
 	helper_node * node_pointer = helper;
+	io_begin(node_pointer, IO_FOREGROUND_WRITE);
+	truncate_filename(src);
+	truncate_filename(dst);
+	
+	offset_node * source = get_offset_node(helper, src);
+	if (source != NULL && source->write_back != NULL){
+		if (flush_write_back(node_pointer, source) != 0){
+			io_end(node_pointer);
+			return 1;
+		}
+		source = get_offset_node(helper, src);
+	}
+	if (source == NULL || reserved_filename(dst) || does_filename_exist(helper, dst) == 0){
+		io_end(node_pointer);
+		return 1;
+	}
 	
-	fseek(node_pointer->file_data, 0, SEEK_END);
+	int * file_indexes = malloc(source->number_of_extents * sizeof(int));
+	if (file_indexes == NULL || find_free_file_indexes(helper, source->number_of_extents, file_indexes) != 0){
+		free(file_indexes);
+		io_end(node_pointer);
+		return 2;
+	}
 	
-	fclose(node_pointer->file_data);
-	fclose(node_pointer->directory_table);
-	fclose(node_pointer->hash_data);
+	if (add_node(helper, dst, source->offset, source->extents[0].length, file_indexes[0]) != 0){ // malloc error
+		free(file_indexes);
+		io_end(node_pointer);
+		return 2;
+	}
+	offset_node * clone = get_offset_node(helper, dst);
+	for (int i = 1; i < source->number_of_extents; i++){
+		if (append_extent(clone, source->extents[i].offset, source->extents[i].length, file_indexes[i], source->extents[i].flags) != 0){
+			// malloc error, nothing is referenced or in directory_table yet
+			remove_node(helper, dst);
+			free(file_indexes);
+			io_end(node_pointer);
+			return 2;
+		}
+		clone->extents[i].stored_length = source->extents[i].stored_length;
+	}
+	clone->length = source->length;
+	reference_file_space(node_pointer, clone, 1);
 	
-	// free offset sorted linked list
-	offset_node * prev_offset_node = node_pointer->offset_node;
-	offset_node * next_offset_node = NULL;
+	// write to directory_table
+	for (int i = 0; i < clone->number_of_extents; i++){
+		write_extent_record(node_pointer, clone, i);
+	}
 	
-	while (prev_offset_node->next != NULL){
-		next_offset_node = prev_offset_node->next;
-		free(prev_offset_node);
-		prev_offset_node = next_offset_node;
+	// flush buffers for multithreading
+	fflush(node_pointer->directory_table);
+	
+	free(file_indexes);
+	io_end(node_pointer);
+	return 0;
+}
+
+// define a whole block of file_data holding part of a file, with its leaf hash as a fingerprint
+typedef struct dedup_block{
+	uint8_t hash[16];
+	int block;
+} dedup_block;
+
+// orders blocks by leaf hash, then by position in file_data
+static int compare_dedup_blocks(const void * a, const void * b){
+	const dedup_block * first = a;
+	const dedup_block * second = b;
+	
+	int compared = memcmp(first->hash, second->hash, 16);
+	if (compared != 0){
+		return compared;
 	}
-	free(prev_offset_node);
-	free(node_pointer->hash_tree);
-	free(helper);
-    return;
+	return (first->block > second->block) - (first->block < second->block);
 }
 
-// helper function for creating files
-static void create_file_helper(void * helper, char * filename, size_t length, int previous_free_offset){
-	void * buff = calloc(1, length);
-			
-	helper_node * node_pointer = helper;
+// helper function to list every whole block of file_data inside a written, uncompressed extent of a file
+// blocks shared by several files are listed once for each of them
+// returns number of blocks written to blocks (allocated by this function), returns -1 if malloc error
+static int collect_dedup_blocks(helper_node * node_pointer, dedup_block ** blocks){
+	
+	int number_of_blocks = 0;
+	int capacity = 0;
+	*blocks = NULL;
+	
+	offset_node * offset_tmp_pointer = node_pointer->offset_node->next;
+	while (offset_tmp_pointer != NULL){
+		for (int i = 0; i < offset_tmp_pointer->number_of_extents; i++){
+			extent * extent_pointer = &offset_tmp_pointer->extents[i];
+			if (extent_pointer->flags != 0){
+				continue;
+			}
 			
-	// create record in directory_table
-	char directory_table_record[72] = {0};
-	strncpy(directory_table_record, filename, 64);
-	memcpy(directory_table_record + 64, &previous_free_offset, 4);
-	memcpy(directory_table_record + 68, &length, 4);
+			int first_block = (extent_pointer->offset + node_pointer->block_size - 1) >> node_pointer->block_shift;
+			int end_block = (extent_pointer->offset + extent_pointer->length) >> node_pointer->block_shift;
+			for (int block = first_block; block < end_block; block++){
+				if (number_of_blocks == capacity){
+					capacity = (capacity == 0) ? 64 : capacity * 2;
+					dedup_block * new_blocks = realloc(*blocks, capacity * sizeof(dedup_block));
+					if (new_blocks == NULL){ // malloc error
+						free(*blocks);
+						*blocks = NULL;
+						return -1;
+					}
+					*blocks = new_blocks;
+				}
+				memcpy((*blocks)[number_of_blocks].hash, tree_node(node_pointer, node_pointer->leaf_start + block), 16);
+				(*blocks)[number_of_blocks].block = block;
+				number_of_blocks++;
+			}
+		}
+		offset_tmp_pointer = offset_tmp_pointer->next;
+	}
+	return number_of_blocks;
+}
+
+// helper function to point every file using block source of file_data at block target, which holds the same bytes
+// source is released by each file as it moves, and is freed once nothing else references it
+// files keep their copy if there are not enough directory_table entries to split their extents
+// returns the number of extents moved
+static int remap_dedup_block(helper_node * node_pointer, int source, int target){
+	
+	int source_offset = source << node_pointer->block_shift;
+	int block_size = node_pointer->block_size;
+	int moved = 0;
+	
+	extent replacement;
+	replacement.offset = target << node_pointer->block_shift;
+	replacement.length = block_size;
+	replacement.file_index = -1;
+	replacement.flags = 0;
+	replacement.stored_length = block_size;
+	
+	offset_node * offset_tmp_pointer = node_pointer->offset_node->next;
+	while (offset_tmp_pointer != NULL){
+		size_t extent_start = 0;
+		int i = 0;
 		
-	// write to file_data
-	fseek(node_pointer->file_data, previous_free_offset, SEEK_SET);
-	fwrite(buff, length, 1, node_pointer->file_data);
+		while (i < offset_tmp_pointer->number_of_extents){
+			extent * extent_pointer = &offset_tmp_pointer->extents[i];
+			if (extent_pointer->flags != 0 || extent_pointer->offset > source_offset || extent_pointer->offset + extent_pointer->length < source_offset + block_size){
+				extent_start += extent_pointer->length;
+				i++;
+				continue;
+			}
 			
-	// write to directory_table
-	int file_index = find_free_file_index(helper);
-	fseek(node_pointer->directory_table, file_index, SEEK_SET);
-	fwrite(directory_table_record, 72, 1, node_pointer->directory_table);
+			size_t position = extent_start + (source_offset - extent_pointer->offset);
+			extent * released = malloc(offset_tmp_pointer->number_of_extents * sizeof(extent));
+			int number_released = -1;
+			if (released != NULL){
+				number_released = splice_file_extents(node_pointer, offset_tmp_pointer, position, position + block_size, &replacement, 1, released);
+			}
+			if (number_released < 0){
+				free(released);
+				break;
+			}
 			
-	// flush buffers for multithreading
-	fflush(node_pointer->file_data);
-	fflush(node_pointer->directory_table);
-	fflush(node_pointer->hash_data);			
+			space_adjust(node_pointer, replacement.offset, block_size, 1);
+			for (int j = 0; j < number_released; j++){
+				space_adjust(node_pointer, released[j].offset, released[j].length, -1);
+			}
+			free(released);
+			moved++;
 			
-	free(buff);
-	add_node(helper, filename, previous_free_offset, length, file_index);
+			// the extent list changed, look again from the start
+			extent_start = 0;
+			i = 0;
+		}
+		offset_tmp_pointer = offset_tmp_pointer->next;
+	}
+	return moved;
 }
 
-// function to create files
-// returns 0 if file is created successfully
-// returns 1 if filename already exists
-// returns 2 if there is insufficient space in the virtual disk overall
-int create_file(char * filename, size_t length, void * helper) {
-	// search for contiguous memory space >= length
+// function to share identical blocks of file_data between files
+// blocks with the same leaf hash are compared byte by byte, as the hash is not collision resistant,
+// and every file using a duplicate block is pointed at the first copy, which is reference counted like a clone
+// only whole blocks inside written, uncompressed extents are deduplicated, and snapshots keep the blocks they use
+// file_data is not changed so the hash tree stays valid
+// fills report (if not NULL) with what was found
+// returns 0 if successful, returns 1 if unsuccessful (malloc error or held writes that cannot be written)
+static int deduplicate_untraced(fs_dedup_report * report, void * helper) {
 	helper_node * node_pointer = helper;
+	io_begin(node_pointer, IO_BACKGROUND);
+	if (flush_all_write_back(node_pointer) != 0){
+		io_end(node_pointer);
+		return 1;
+	}
+	sync_hash_tree(node_pointer);
+	
+	size_t filled_space = node_pointer->filled_space;
+	
+	dedup_block * blocks = NULL;
+	int number_of_blocks = collect_dedup_blocks(node_pointer, &blocks);
+	uint8_t * candidate = malloc(node_pointer->block_size);
+	uint8_t * original = malloc(node_pointer->block_size);
+	if (number_of_blocks < 0 || candidate == NULL || original == NULL){ // malloc error
+		free(blocks);
+		free(candidate);
+		free(original);
+		io_end(node_pointer);
+		return 1;
+	}
+	if (number_of_blocks > 0){ // an empty volume has no blocks to sort
+		qsort(blocks, number_of_blocks, sizeof(dedup_block), compare_dedup_blocks);
+	}
 	
-	pthread_mutex_lock(&(node_pointer->list_lock));
+	// blocks with the same hash are next to each other, the first copy of each distinct block stays
+	// blocks found to be duplicates are marked with -1
+	size_t blocks_scanned = 0;
+	size_t duplicate_blocks = 0;
+	int group_start = 0;
+	int previous_block = -1;
+	for (int i = 0; i < number_of_blocks; i++){
+		if (i > 0 && memcmp(blocks[i].hash, blocks[i - 1].hash, 16) != 0){
+			group_start = i;
+			previous_block = -1;
+		}
+		if (blocks[i].block == previous_block){ // listed by another file
+			blocks[i].block = -1;
+			continue;
+		}
+		previous_block = blocks[i].block;
+		blocks_scanned++;
+		
+		if (i == group_start){
+			continue;
+		}
+		
+		read_file_data(node_pointer, (size_t)blocks[i].block << node_pointer->block_shift, candidate, node_pointer->block_size);
+		
+		for (int j = group_start; j < i; j++){
+			if (blocks[j].block < 0){
+				continue;
+			}
+			read_file_data(node_pointer, (size_t)blocks[j].block << node_pointer->block_shift, original, node_pointer->block_size);
+			
+			if (memcmp(candidate, original, node_pointer->block_size) == 0){
+				if (remap_dedup_block(node_pointer, blocks[i].block, blocks[j].block) > 0){
+					duplicate_blocks++;
+				}
+				blocks[i].block = -1;
+				break;
+			}
+		}
+	}
 	
-	truncate(filename);
+	if (report != NULL){
+		// bytes the files' extents refer to, against the bytes of file_data in use
+		size_t referenced_bytes = 0;
+		offset_node * offset_tmp_pointer = node_pointer->offset_node->next;
+		while (offset_tmp_pointer != NULL){
+			for (int i = 0; i < offset_tmp_pointer->number_of_extents; i++){
+				referenced_bytes += extent_stored_length(&offset_tmp_pointer->extents[i]);
+			}
+			offset_tmp_pointer = offset_tmp_pointer->next;
+		}
+		
+		report->blocks_scanned = blocks_scanned;
+		report->duplicate_blocks = duplicate_blocks;
+		report->bytes_reclaimed = filled_space - node_pointer->filled_space;
+		report->dedup_ratio = 1.0;
+		if (node_pointer->filled_space > 0){
+			report->dedup_ratio = (double) referenced_bytes / node_pointer->filled_space;
+		}
+	}
 	
-	if (does_filename_exist(helper, filename) == 0){
-		pthread_mutex_unlock(&(node_pointer->list_lock));
-		return 1;
+	// flush buffers for multithreading
+	fflush(node_pointer->directory_table);
+	
+	free(blocks);
+	free(candidate);
+	free(original);
+	io_end(node_pointer);
+	return 0;
+}
+
+// helper function to find the read-ahead stream of a file, taking the least recently used stream if it has none
+// a stream taken for another file starts empty, its windows keep their memory
+static read_ahead_stream * read_ahead_stream_for(helper_node * node_pointer, char * filename){
+	
+	read_ahead_stream * stream = &node_pointer->read_ahead_streams[0];
+	for (int i = 0; i < READ_AHEAD_STREAMS; i++){
+		read_ahead_stream * candidate = &node_pointer->read_ahead_streams[i];
+		if (candidate->name[0] != '\0' && strncmp(candidate->name, filename, 64) == 0){
+			stream = candidate;
+			break;
+		}
+		if (candidate->last_used < stream->last_used){
+			stream = candidate;
+		}
 	}
 	
-	offset_node * offset_tmp_pointer = node_pointer->offset_node;
+	if (strncmp(stream->name, filename, 64) != 0){
+		strncpy(stream->name, filename, 64);
+		stream->advice = FS_ADVICE_NORMAL;
+		stream->next_offset = 0;
+		stream->sequential = 0;
+		stream->current.length = 0;
+		stream->next.length = 0;
+		stream->prefetch = 0;
+	}
+	stream->last_used = ++node_pointer->read_ahead_uses;
+	return stream;
+}
 
-	if (offset_tmp_pointer->next == NULL){ // no files exist
+// helper function to read up to length bytes of a file from offset into a window, verifying them first
+// returns 0 if successful, returns 1 if the range is corrupt or if malloc error
+static int fill_read_ahead_window(helper_node * node_pointer, offset_node * file, read_ahead_window * window, size_t offset, size_t length){
 	
-		if (length <= (node_pointer->total_space - node_pointer->filled_space)){ // create first file if space available	
-			create_file_helper(helper, filename, length, 0);
-			calculate_hash(helper, 0, 0);
-			
-			// flush buffers for multithreading
-			fflush(node_pointer->file_data);
-			fflush(node_pointer->directory_table);
-			fflush(node_pointer->hash_data);			
-			
-			pthread_mutex_unlock(&(node_pointer->list_lock));
-			return 0;	
+	window->length = 0;
+	if (offset >= (size_t)file->length){
+		return 0;
+	}
+	if (length > node_pointer->read_ahead_size){
+		length = node_pointer->read_ahead_size;
+	}
+	if (length > (size_t)file->length - offset){
+		length = file->length - offset;
+	}
+	if (window->data == NULL){
+		window->data = malloc(node_pointer->read_ahead_size);
+		if (window->data == NULL){ // malloc error
+			return 1;
 		}
-		else{ // insufficient space in file_data
-			pthread_mutex_unlock(&(node_pointer->list_lock));
-			return 2;
+	}
+	
+	SPAN_BEGIN("fill_read_ahead_window");
+	int hash_fails = verify_file_range(node_pointer, file, offset, length);
+	if (hash_fails == 0){
+		file_data_io(node_pointer, file, offset, length, window->data, 0);
+		window->offset = offset;
+		window->length = length;
+		window->changes = node_pointer->changes;
+	}
+	SPAN_END("fill_read_ahead_window");
+	return hash_fails != 0;
+}
+
+// helper function to check if a window holds bytes offset to offset + count of the volume as it is now
+static int read_ahead_covers(helper_node * node_pointer, read_ahead_window * window, size_t offset, size_t count){
+	return window->length > 0 && window->changes == node_pointer->changes && offset >= window->offset && offset + count <= window->offset + window->length;
+}
+
+// read-ahead thread started by the first stream that reads ahead, fills the next window of each stream that asks
+// works as background work so reads queued meanwhile go first, and close_fs wakes the thread to stop it
+static void * read_ahead_worker(void * arg){
+	
+	helper_node * node_pointer = arg;
+	
+	pthread_mutex_lock(&node_pointer->io_lock);
+	while (node_pointer->read_ahead_running){
+		if (!node_pointer->read_ahead_pending){
+			pthread_cond_wait(&node_pointer->read_ahead_wake, &node_pointer->io_lock);
+			continue;
+		}
+		node_pointer->read_ahead_pending = 0;
+		pthread_mutex_unlock(&node_pointer->io_lock);
+		
+		io_begin(node_pointer, IO_BACKGROUND);
+		node_pointer->io_changing = 0; // reading ahead changes nothing
+		for (int i = 0; i < READ_AHEAD_STREAMS; i++){
+			read_ahead_stream * stream = &node_pointer->read_ahead_streams[i];
+			if (!stream->prefetch){
+				continue;
+			}
+			stream->prefetch = 0;
+			offset_node * file = get_offset_node(node_pointer, stream->name);
+			if (file != NULL && file->write_back == NULL){
+				fill_read_ahead_window(node_pointer, file, &stream->next, stream->prefetch_offset, stream->prefetch_length);
+			}
+		}
+		io_end(node_pointer);
+		
+		pthread_mutex_lock(&node_pointer->io_lock);
+	}
+	pthread_mutex_unlock(&node_pointer->io_lock);
+	return NULL;
+}
+
+// helper function to have the read-ahead thread fill the next window of a stream with length bytes from offset
+// starts the thread if it is not running, reads are only served from windows already filled if it cannot be started
+static void read_ahead_request(helper_node * node_pointer, read_ahead_stream * stream, size_t offset, size_t length){
+	
+	stream->next.length = 0;
+	stream->prefetch = 1;
+	stream->prefetch_offset = offset;
+	stream->prefetch_length = length;
+	
+	pthread_mutex_lock(&node_pointer->io_lock);
+	node_pointer->read_ahead_pending = 1;
+	if (!node_pointer->read_ahead_running){
+		node_pointer->read_ahead_running = 1;
+		if (pthread_create(&node_pointer->read_ahead_thread, NULL, read_ahead_worker, node_pointer) != 0){
+			node_pointer->read_ahead_running = 0;
 		}
 	}
+	pthread_cond_signal(&node_pointer->read_ahead_wake);
+	pthread_mutex_unlock(&node_pointer->io_lock);
+}
 
-	int previous_free_offset = 0;
-	int contiguous_space = 0;
+// helper function to serve a read from what has been read ahead of its file, for read_file_helper
+// a file read in order is read a window at a time, verifying only the window, while the window after it is read ahead
+// returns 1 if buf holds bytes offset to offset + count of the file, returns 0 if read_file_helper has to read them
+static int read_ahead_serve(helper_node * node_pointer, offset_node * file, size_t offset, size_t count, void * buf){
 	
-	offset_tmp_pointer = offset_tmp_pointer->next;
-	contiguous_space = offset_tmp_pointer->offset - previous_free_offset;
+	if (node_pointer->read_ahead_size == 0 || file->write_back != NULL || offset + count > (size_t)file->length){
+		return 0;
+	}
+	if (count == 0){ // nothing to copy, and the stream does not move
+		return 1;
+	}
 	
-	while (offset_tmp_pointer->next != NULL){
-		if (length <= contiguous_space){ // add file
-			create_file_helper(helper, filename, length, previous_free_offset);
-			calculate_hash(helper, 0, 0);
-			
+	read_ahead_stream * stream = read_ahead_stream_for(node_pointer, file->filename);
+	stream->sequential = (offset == stream->next_offset) ? stream->sequential + 1 : 0;
+	stream->next_offset = offset + count;
+	if (stream->advice == FS_ADVICE_RANDOM){
+		return 0;
+	}
+	int active = (stream->advice == FS_ADVICE_SEQUENTIAL || stream->sequential >= READ_AHEAD_TRIGGER);
+	
+	// the window read ahead becomes the current one once reads reach it
+	if (!read_ahead_covers(node_pointer, &stream->current, offset, count) && read_ahead_covers(node_pointer, &stream->next, offset, count)){
+		read_ahead_window window = stream->current;
+		stream->current = stream->next;
+		stream->next = window;
+		stream->next.length = 0;
+	}
+	
+	int served = read_ahead_covers(node_pointer, &stream->current, offset, count);
+	if (!served && active && count <= node_pointer->read_ahead_size){
+		served = (fill_read_ahead_window(node_pointer, file, &stream->current, offset, node_pointer->read_ahead_size) == 0);
+	}
+	if (!served){
+		return 0;
+	}
+	memcpy(buf, stream->current.data + (offset - stream->current.offset), count);
+	
+	// the window after the current one is read ahead, unless it has been already
+	size_t next_offset = stream->current.offset + stream->current.length;
+	int next_ready = read_ahead_covers(node_pointer, &stream->next, next_offset, 0) && stream->next.offset == next_offset;
+	int next_asked = stream->prefetch && stream->prefetch_offset == next_offset;
+	if (active && next_offset < (size_t)file->length && !next_ready && !next_asked){
+		read_ahead_request(node_pointer, stream, next_offset, node_pointer->read_ahead_size);
+	}
+	return 1;
+}
+
+// helper function to read file data into buffer, for read_file and fs_read
+// returns 0 if successfully completed
+// returns 1 if file is NULL
+// returns 2 if the provided offset makes it impossible to read count bytes given the file size
+// returns 3 if hash verification fails or held writes to the range cannot be written
+static int read_file_helper(offset_node * tmp, size_t offset, size_t count, void * buf, void * helper){
+	
+	helper_node * node_pointer = helper;
+	if (tmp != NULL && tmp->write_back != NULL && write_back_overlaps(tmp, offset, count)){ // held writes to the range go first
+		char filename[64];
+		strncpy(filename, tmp->filename, 64);
+		if (flush_write_back(node_pointer, tmp) != 0){
+			return 3;
+		}
+		tmp = get_offset_node(helper, filename);
+	}
+	if (tmp != NULL){
+		
+		// reads of a file being read in order are served a window at a time
+		if (read_ahead_serve(node_pointer, tmp, offset, count, buf)){
+			return 0;
+		}
+		
+		SPAN_BEGIN("verify_file_blocks");
+		int hash_fails = verify_file_blocks(node_pointer, tmp);
+		SPAN_END("verify_file_blocks");
+		
+		if (hash_fails != 0){
+			return 3;
+		}
+		
+		 if ((offset + count) > (size_t)tmp->length){
+			return 2;
+		 }
+		 else{
+			 file_data_io(node_pointer, tmp, offset, count, buf, 0);
+			 
 			// flush buffers for multithreading
+			SPAN_BEGIN("fflush");
 			fflush(node_pointer->file_data);
 			fflush(node_pointer->directory_table);
-			fflush(node_pointer->hash_data);			
+			fflush(node_pointer->hash_data);
+			SPAN_END("fflush");
+			 return 0;
+		 }
+	}
+	else{
+		return 1;
+	}
+}
+
+// function to read file data into buffer
+// returns 0 if successfully completed
+// returns 1 if file does not exist
+// returns 2 if the provided offset makes it impossible to read count bytes given the file size
+// returns 3 if hash verification fails or held writes to the range cannot be written
+static int read_file_untraced(char * filename, size_t offset, size_t count, void * buf, void * helper) {
+	
+	helper_node * node_pointer = helper;
+	io_begin(node_pointer, IO_FOREGROUND_READ);
+    truncate_filename(filename);	
+	flush_expired_write_back(node_pointer);
+	
+	int return_value = read_file_helper(get_offset_node(helper, filename), offset, count, buf, helper);
+	io_end(node_pointer);
+	return return_value;
+}
+
+// helper function to write to file, for write_file and fs_write
+// returns 0 if file is successfully written to
+// returns 1 if file is NULL
+// returns 2 if offset is greater than the current size of the file
+// returns 3 if insufficient space exists in the virtual disk overall
+static int write_file_helper(offset_node * tmp_offset_node, size_t offset, size_t count, void * buf, void * helper){
+	
+	helper_node * node_pointer = helper;
+	if (tmp_offset_node != NULL) { //node exists
+		
+		// resizing and flushing held writes can move the file to a new node
+		char filename[64];
+		strncpy(filename, tmp_offset_node->filename, 64);
+	
+		size_t length = (tmp_offset_node->write_back != NULL) ? tmp_offset_node->write_back->length : (size_t)tmp_offset_node->length;
+		if (offset > length){
+			return 2;
+		}
+		
+		// small writes are held back in volumes opened with a write_back_size
+		if (node_pointer->write_back_size > 0){
+			if (hold_write_back(node_pointer, tmp_offset_node, offset, count, buf) == 0){
+				return 0;
+			}
 			
-			pthread_mutex_unlock(&(node_pointer->list_lock));
-			return 0;
+			// held writes to the file go first, and every held write goes first if this write takes space
+			int flushed = 0;
+			if (is_plain_overwrite(node_pointer, tmp_offset_node, offset, count)){
+				flushed = flush_write_back(node_pointer, tmp_offset_node);
+			}
+			else{
+				flushed = flush_all_write_back(node_pointer);
+			}
+			if (flushed != 0){
+				return 3;
+			}
+			tmp_offset_node = get_offset_node(helper, filename);
+		}
+	
+		size_t original_length = tmp_offset_node->length;
+		int rebuild = 0;
+		if ((offset + count) > original_length){ // need to resize
+			SPAN_BEGIN("resize_file_helper");
+			int resized = resize_file_helper(filename, (offset + count), helper);
+			SPAN_END("resize_file_helper");
+			if (resized == 2){
+				return 3;
+			}
+			tmp_offset_node = get_offset_node(helper, filename);
+			rebuild = 1;
+		}
+		
+		int written = write_file_range(node_pointer, tmp_offset_node, offset, count, buf);
+		if (written < 0){
+			resize_file_helper(filename, original_length, helper);
+			hash_tree_changed(helper);
+			return 3;
+		}
+		
+		// writes in place only change the hashes of the blocks written
+		if (rebuild || written){
+			hash_tree_changed(helper);
+		}
+		else{
+			update_file_hashes(node_pointer, tmp_offset_node, offset, count);
 		}
-		previous_free_offset = offset_tmp_pointer->offset + offset_tmp_pointer->length;
-		offset_tmp_pointer = offset_tmp_pointer->next;
-		contiguous_space = offset_tmp_pointer->offset - previous_free_offset;
-	}
-	
-	previous_free_offset = offset_tmp_pointer->offset + offset_tmp_pointer->length;
-	contiguous_space = node_pointer->total_space - previous_free_offset;
-	
-	if (length <= contiguous_space){ // add file
-		create_file_helper(helper, filename, length, previous_free_offset);
-		calculate_hash(helper, 0, 0);
 		
 		// flush buffers for multithreading
+		SPAN_BEGIN("fflush");
 		fflush(node_pointer->file_data);
 		fflush(node_pointer->directory_table);
 		fflush(node_pointer->hash_data);
-		
-		pthread_mutex_unlock(&(node_pointer->list_lock));
+		SPAN_END("fflush");
 		return 0;
 	}
+	else{ //file doesn't exist
+		return 1;
+	}
+}
 
-	// if space exists after repack
-	if (node_pointer->total_space - node_pointer->filled_space >= length){
-		repack_helper(helper);
-		
-		offset_tmp_pointer = node_pointer->offset_node;
-	
-		previous_free_offset = 0;
-		contiguous_space = 0;
+// function to write to file
+// returns 0 if file is successfully written to
+// returns 1 if file does not exist
+// returns 2 if offset is greater than the current size of the file
+// returns 3 if insufficient space exists in the virtual disk overall
+static int write_file_untraced(char * filename, size_t offset, size_t count, void * buf, void * helper) {
+	helper_node * node_pointer = helper;
+	io_begin(node_pointer, IO_FOREGROUND_WRITE);
+	truncate_filename(filename);
+	flush_expired_write_back(node_pointer);
 	
-		offset_tmp_pointer = offset_tmp_pointer->next;
-		contiguous_space = offset_tmp_pointer->offset - previous_free_offset;
-	
-		while (offset_tmp_pointer->next != NULL){
-			if (length <= contiguous_space){ // add file
-				create_file_helper(helper, filename, length, previous_free_offset);
-				calculate_hash(helper, 0, 0);
-				
-				// flush buffers for multithreading
-				fflush(node_pointer->file_data);
-				fflush(node_pointer->directory_table);
-				fflush(node_pointer->hash_data);
-				
-				pthread_mutex_unlock(&(node_pointer->list_lock));
-				return 0;
-			}
-			previous_free_offset = offset_tmp_pointer->offset + offset_tmp_pointer->length;
-			offset_tmp_pointer = offset_tmp_pointer->next;
-			contiguous_space = offset_tmp_pointer->offset - previous_free_offset;
+	int return_value = write_file_helper(get_offset_node(helper, filename), offset, count, buf, helper);
+	io_end(node_pointer);
+	return return_value;
+}
+
+// function to create a file holding the contents of a file on the host
+// the data is copied by the kernel straight from the host file into file_data where it can,
+// then only the hashes of the blocks it was copied into are worked out
+// returns 0 if file is imported successfully
+// returns 1 if filename already exists or is reserved
+// returns 2 if there is insufficient space in the virtual disk overall
+// returns 3 if the host file cannot be read
+static int import_file_untraced(char * host_path, char * filename, void * helper) {
+	helper_node * node_pointer = helper;
+	io_begin(node_pointer, IO_FOREGROUND_WRITE);
+	truncate_filename(filename);
+	
+	int host_fd = open(host_path, O_RDONLY);
+	struct stat host_stat;
+	if (host_fd < 0 || fstat(host_fd, &host_stat) != 0 || host_stat.st_size > INT32_MAX){
+		if (host_fd >= 0){
+			close(host_fd);
 		}
+		io_end(node_pointer);
+		return 3;
+	}
+	size_t length = host_stat.st_size;
+	
+	// the new file's space is not zero filled as all of it is copied over
+	int return_value = allocate_file(helper, filename, length, 1);
+	if (return_value != 0){
+		close(host_fd);
+		io_end(node_pointer);
+		return return_value;
+	}
+	offset_node * file = get_offset_node(helper, filename);
+	
+	// stdio buffers must not hold data copied underneath them
+	fflush(node_pointer->file_data);
+	uint8_t * buffer = malloc(REPACK_CHUNK_SIZE);
+	off_t host_offset = 0;
+	for (int i = 0; i < file->number_of_extents && return_value == 0; i++){
+		return_value = copy_fd_range(host_fd, host_offset, fileno(node_pointer->file_data), file->extents[i].offset, file->extents[i].length, buffer, 1);
+		host_offset += file->extents[i].length;
+	}
+	free(buffer);
+	close(host_fd);
+	fflush(node_pointer->file_data);
 	
-		previous_free_offset = offset_tmp_pointer->offset + offset_tmp_pointer->length;
-		contiguous_space = node_pointer->total_space - previous_free_offset;
+	if (return_value != 0){ // host file shorter than it was, or a read error
+		delete_file_helper(filename, helper);
+		hash_tree_changed(helper);
+		io_end(node_pointer);
+		return 3;
+	}
 	
-		if (length <= contiguous_space){ // add file
-			create_file_helper(helper, filename, length, previous_free_offset);
-			calculate_hash(helper, 0, 0);
-			
-			// flush buffers for multithreading
-			fflush(node_pointer->file_data);
-			fflush(node_pointer->directory_table);
-			fflush(node_pointer->hash_data);
-			
-			pthread_mutex_unlock(&(node_pointer->list_lock));
-			return 0;
-		}
+	// hash the imported blocks unless a repack or compression moved data elsewhere as well
+	compress_file_range(node_pointer, file, 0, length);
+	if (node_pointer->tree_stale || (node_pointer->features & FS_FEATURE_COMPRESSION)){
+		hash_tree_changed(helper);
 	}
 	else{
-		pthread_mutex_unlock(&(node_pointer->list_lock));
-		return 2;
+		update_file_hashes(node_pointer, file, 0, length);
 	}
 	
-	// should never reach here
-	pthread_mutex_unlock(&(node_pointer->list_lock));
-	return -1;
+	// flush buffers for multithreading
+	fflush(node_pointer->file_data);
+	fflush(node_pointer->directory_table);
+	fflush(node_pointer->hash_data);
+	
+	io_end(node_pointer);
+	return 0;
 }
 
-// helper method for resizing file
+// function to write the contents of a file to a file on the host, replacing it
+// the data is copied by the kernel straight from file_data where it can,
+// unwritten extents are left as holes in the host file and compressed extents are expanded
+// if verify is 1 the blocks of each extent are checked against the hash tree before it is copied
+// returns 0 if file is exported successfully
 // returns 1 if file does not exist
-// returns 2 if not enough space in file system
-// returns 0 if file resized successfully
-static int resize_file_helper(char * filename, size_t length, void * helper){
-
+// returns 2 if the host file cannot be written
+// returns 3 if hash verification fails (the host file is left incomplete) or held writes cannot be written
+static int export_file_untraced(char * filename, char * host_path, int verify, void * helper) {
 	helper_node * node_pointer = helper;
+	io_begin(node_pointer, IO_FOREGROUND_READ);
+	truncate_filename(filename);
 	
-	offset_node * offset_tmp_node = get_offset_node(helper, filename);
-	
-	if (offset_tmp_node == NULL){ // file does not exist
+	offset_node * file = get_offset_node(helper, filename);
+	if (file != NULL && file->write_back != NULL){ // held writes go first
+		if (flush_write_back(node_pointer, file) != 0){
+			io_end(node_pointer);
+			return 3;
+		}
+		file = get_offset_node(helper, filename);
+	}
+	if (file == NULL){
+		io_end(node_pointer);
 		return 1;
 	}
 	
-	if (node_pointer->filled_space - offset_tmp_node->length + length > node_pointer->total_space){ // if not enough space in disk
+	int host_fd = open(host_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (host_fd < 0 || ftruncate(host_fd, file->length) != 0){
+		if (host_fd >= 0){
+			close(host_fd);
+		}
+		io_end(node_pointer);
 		return 2;
 	}
 	
-	offset_node * offset_next_node = offset_tmp_node->next;
-	if (offset_next_node == NULL){ // file is at last offset
-		if (offset_tmp_node->offset + length <= node_pointer->total_space){ // space exists
-			if (length > offset_tmp_node->length){ // pad with zeros
-				int num_bytes = length - offset_tmp_node->length;
-			
-				node_pointer->filled_space += length - offset_tmp_node->length;
-		
-				// update file_data file
-				void * buffer = calloc(1, num_bytes);
-				fseek(node_pointer->file_data, offset_tmp_node->offset + offset_tmp_node->length, SEEK_SET);
-				fwrite(buffer, num_bytes, 1, node_pointer->file_data);
-			
-				offset_tmp_node->length = length;
-			
-				//update directory_table
-				fseek(node_pointer->directory_table, offset_tmp_node->file_index + 68, SEEK_SET);
-				fwrite(&length, 4, 1, node_pointer->directory_table);
-				free(buffer);
-				// flush buffers for multithreading
-				fflush(node_pointer->file_data);
-				fflush(node_pointer->directory_table);
-				fflush(node_pointer->hash_data);
-
-				return 0;
-			}
-			else{ // truncate file
-				//update directory_table
-				
-				node_pointer->filled_space += length - offset_tmp_node->length;
-				
-				fseek(node_pointer->directory_table, offset_tmp_node->file_index + 68, SEEK_SET);
-				fwrite(&length, 4, 1, node_pointer->directory_table);
-				
-				offset_tmp_node->length = length;
-				
-				fflush(node_pointer->directory_table);
-				return 0;
-			}
+	// stdio buffers must not hold data the kernel has not seen
+	fflush(node_pointer->file_data);
+	uint8_t * buffer = malloc(REPACK_CHUNK_SIZE);
+	int return_value = 0;
+	off_t host_offset = 0;
+	for (int i = 0; i < file->number_of_extents && return_value == 0; i++){
+		extent * extent_pointer = &file->extents[i];
+		if (extent_pointer->length == 0){
+			continue;
 		}
-	}
-	
-	if (offset_next_node != NULL && (offset_next_node->offset - offset_tmp_node->offset) >= length){ // space exists so just resize
-		if (length > offset_tmp_node->length){ // pad with zeros
-			int num_bytes = length - offset_tmp_node->length;
-		
-			node_pointer->filled_space += length - offset_tmp_node->length;
 		
-			// update file_data file
-			void * buffer = calloc(1, num_bytes);
-			fseek(node_pointer->file_data, offset_tmp_node->offset + offset_tmp_node->length, SEEK_SET);
-			fwrite(buffer, num_bytes, 1, node_pointer->file_data);
-			
-			//update directory_table
-			fseek(node_pointer->directory_table, offset_tmp_node->file_index + 68, SEEK_SET);
-			fwrite(&length, 4, 1, node_pointer->directory_table);
-			
-			offset_tmp_node->length = length;
-			
-			free(buffer);
-			fflush(node_pointer->directory_table);
-			return 0;
+		if (verify && verify_extent_blocks(node_pointer, extent_pointer) != 0){
+			return_value = 3;
 		}
-		else{ // truncate file
-			//update directory_table
-			
-			node_pointer->filled_space += length - offset_tmp_node->length;
-			
-			fseek(node_pointer->directory_table, offset_tmp_node->file_index + 68, SEEK_SET);
-			fwrite(&length, 4, 1, node_pointer->directory_table);
-			fflush(node_pointer->directory_table);
-			
-			offset_tmp_node->length = length;
-			
-			return 0;
+		else if (extent_pointer->flags & EXTENT_UNWRITTEN){
+			// already zeros in the host file
+		}
+		else if (extent_pointer->flags & EXTENT_COMPRESSED){
+			if (buffer == NULL || read_compressed_extent(node_pointer, extent_pointer, 0, extent_pointer->length, buffer) != 0 ||
+					pwrite(host_fd, buffer, extent_pointer->length, host_offset) != extent_pointer->length){
+				return_value = 2;
+			}
 		}
+		else if (copy_fd_range(fileno(node_pointer->file_data), extent_pointer->offset, host_fd, host_offset, extent_pointer->length, buffer, 1) != 0){
+			return_value = 2;
+		}
+		host_offset += extent_pointer->length;
+	}
+	free(buffer);
+	if (close(host_fd) != 0 && return_value == 0){
+		return_value = 2;
 	}
-
-	// take node out of list
-	
-	int original_size = offset_tmp_node->length;
-	//assuming we keep the file index the same
-	int original_file_index = offset_tmp_node->file_index;
-	
-	void * file_data_buffer = malloc(original_size);
-	fseek(node_pointer->file_data, offset_tmp_node->offset, SEEK_SET);
-	fread(file_data_buffer, original_size, 1, node_pointer->file_data);
 	
-	delete_file_helper(filename, helper);
+	// flush buffers for multithreading
+	fflush(node_pointer->file_data);
+	fflush(node_pointer->hash_data);
 	
-	//repack
-	repack_helper(helper);
+	io_end(node_pointer);
+	return return_value;
+}
+
+// returns file size of the file with the given filename
+// returns -1 if there is an error, such as the file not existing
+static ssize_t file_size_untraced(char * filename, void * helper) {
+	helper_node * node_pointer = helper;
+	io_begin(node_pointer, IO_FOREGROUND_READ);
 	
-	offset_tmp_node = node_pointer->offset_node;
-	while (offset_tmp_node->next != NULL){
-		offset_tmp_node = offset_tmp_node->next;
+	truncate_filename(filename);
+	offset_node * tmp = get_offset_node(helper, filename);
+	if (tmp != NULL){
+		// held writes can make the file longer
+		ssize_t length = (tmp->write_back != NULL) ? (ssize_t)tmp->write_back->length : tmp->length;
+		io_end(node_pointer);
+		return length;
 	}
-	
-	int new_offset = offset_tmp_node->offset + offset_tmp_node->length;
+	else{
+		io_end(node_pointer);
+		return -1;
+	}
+}
 
-	if (length > original_size){
-		// pad the memory with 0s
-		void * new_buffer = calloc(1, length);
-		memcpy(new_buffer, file_data_buffer, original_size);
-		free(file_data_buffer);
-		file_data_buffer = new_buffer;		
+// function to list files in filename order, a page at a time
+// names starting with prefix (every name if prefix is NULL or empty) that come after cursor
+// (from the first name if cursor is NULL or empty) are copied to out, at most max of them
+// passing the last name returned as cursor gives the next page
+// returns the number of names written to out
+static int list_files_untraced(char * prefix, char * cursor, char (* out)[64], int max, void * helper) {
+	helper_node * node_pointer = helper;
+	io_begin(node_pointer, IO_FOREGROUND_READ);
+	
+	size_t prefix_length = 0;
+	int i = 0;
+	if (prefix != NULL){
+		prefix_length = strlen(prefix);
+		if (prefix_length > 63){
+			prefix_length = 63;
+		}
+		i = name_search(node_pointer, prefix);
 	}
 	
-	// add the node
-	add_node(helper, filename, new_offset, length, original_file_index);
-	
-	// add the file data
-	fseek(node_pointer->file_data, new_offset, SEEK_SET);
-	fwrite(file_data_buffer, length, 1, node_pointer->file_data);
-			
-	//update directory_table
-	fseek(node_pointer->directory_table, original_file_index, SEEK_SET);
-	fwrite(filename, strnlen(filename, 64), 1, node_pointer->directory_table);
-	
-	fseek(node_pointer->directory_table, original_file_index + 64, SEEK_SET);
-	fwrite(&new_offset, 4, 1, node_pointer->directory_table);	
-	
-	fseek(node_pointer->directory_table, original_file_index + 68, SEEK_SET);
-	fwrite(&length, 4, 1, node_pointer->directory_table);
+	if (cursor != NULL && cursor[0] != '\0'){
+		int after_cursor = name_search(node_pointer, cursor);
+		if (after_cursor < node_pointer->name_count && strncmp(node_pointer->name_index[after_cursor]->filename, cursor, 64) == 0){
+			after_cursor++;
+		}
+		if (after_cursor > i){
+			i = after_cursor;
+		}
+	}
 	
+	int number_of_names = 0;
+	while (i < node_pointer->name_count && number_of_names < max){
+		char * filename = node_pointer->name_index[i]->filename;
+		if (prefix_length > 0 && strncmp(filename, prefix, prefix_length) != 0){ // past the names with prefix
+			break;
+		}
+		strncpy(out[number_of_names], filename, 64);
+		number_of_names++;
+		i++;
+	}
 	
-	free(file_data_buffer);	
-    return 0;
+	io_end(node_pointer);
+	return number_of_names;
 }
 
-// function to resize a file
-// returns 0 if file is successfully resized
-// returns 1 if the file does not exist
-// returns 2 if there is insufficient space in the virtual disk overall for the new file size
-int resize_file(char * filename, size_t length, void * helper) {
-	truncate(filename);
+// function to open a handle to a file, so later calls skip looking up its name
+// filename is not changed, names longer than 63 characters are truncated in a copy
+// returns the handle, or -1 if the file does not exist (or malloc error)
+static int fs_open_untraced(char * filename, void * helper) {
 	helper_node * node_pointer = helper;
+	io_begin(node_pointer, IO_FOREGROUND_READ);
+	
+	char name[64];
+	strncpy(name, filename, 63);
+	name[63] = '\0';
+	offset_node * file = get_offset_node(helper, name);
+	if (file == NULL){
+		io_end(node_pointer);
+		return -1;
+	}
 	
-	pthread_mutex_lock(&(node_pointer->list_lock));
-	int return_value = resize_file_helper(filename, length, helper);
-	calculate_hash(helper, 0, 0);
-	
-	// flush buffers for multithreading
-	fflush(node_pointer->file_data);
-	fflush(node_pointer->directory_table);
-	fflush(node_pointer->hash_data);
+	// reuse a closed handle, or grow the table
+	int handle = 0;
+	while (handle < node_pointer->handle_capacity && node_pointer->handles[handle].open){
+		handle++;
+	}
+	if (handle == node_pointer->handle_capacity){
+		int new_capacity = (node_pointer->handle_capacity == 0) ? 16 : node_pointer->handle_capacity * 2;
+		open_handle * new_handles = realloc(node_pointer->handles, new_capacity * sizeof(open_handle));
+		if (new_handles == NULL){ // malloc error
+			io_end(node_pointer);
+			return -1;
+		}
+		memset(&new_handles[handle], 0, (new_capacity - handle) * sizeof(open_handle));
+		node_pointer->handles = new_handles;
+		node_pointer->handle_capacity = new_capacity;
+	}
 	
-	pthread_mutex_unlock(&(node_pointer->list_lock));
-	return return_value;
-};
+	node_pointer->handles[handle].file = file;
+	node_pointer->handles[handle].open = 1;
+	node_pointer->handles[handle].generation = entry_generation(node_pointer, file->file_index);
+	io_end(node_pointer);
+	return handle;
+}
 
-// function to repack the files in the file system
-void repack(void * helper) {
+// function to read file data into buffer through a handle
+// returns the same values as read_file, 1 if the handle is not open or its file was deleted
+static int fs_read_untraced(int handle, size_t offset, size_t count, void * buf, void * helper) {
 	helper_node * node_pointer = helper;
-	pthread_mutex_lock(&(node_pointer->list_lock));
-	repack_helper(helper);
-	calculate_hash(helper, 0, 0);
-	
-	// flush buffers for multithreading
-	fflush(node_pointer->file_data);
-	fflush(node_pointer->directory_table);
-	fflush(node_pointer->hash_data);
+	io_begin(node_pointer, IO_FOREGROUND_READ);
+	flush_expired_write_back(node_pointer);
 	
-	pthread_mutex_unlock(&(node_pointer->list_lock));
-	return;
+	int return_value = read_file_helper(handle_file(node_pointer, handle), offset, count, buf, helper);
+	io_end(node_pointer);
+	return return_value;
 }
 
-// function to delete files from file system
-// returns 0 if file is susccessfull deleted
-// returns 1 if error occurs, such as file not existing
-int delete_file(char * filename, void * helper) {
-	truncate(filename);
-	
+// function to write to file through a handle
+// returns the same values as write_file, 1 if the handle is not open or its file was deleted
+static int fs_write_untraced(int handle, size_t offset, size_t count, void * buf, void * helper) {
 	helper_node * node_pointer = helper;
-	pthread_mutex_lock(&(node_pointer->list_lock));
-	int return_value = delete_file_helper(filename, helper);
-	
-	// flush buffers for multithreading
-	fflush(node_pointer->file_data);
-	fflush(node_pointer->directory_table);
-	fflush(node_pointer->hash_data);	
+	io_begin(node_pointer, IO_FOREGROUND_WRITE);
+	flush_expired_write_back(node_pointer);
 	
-	pthread_mutex_unlock(&(node_pointer->list_lock));
+	int return_value = write_file_helper(handle_file(node_pointer, handle), offset, count, buf, helper);
+	io_end(node_pointer);
 	return return_value;
-	
 }
 
-// function to rename a file
-// returns 0 if file is successfully renamed
-// returns 1 if error occurs, such as file not existing
-int rename_file(char * oldname, char * newname, void * helper) {
+// returns file size of the file a handle refers to
+// returns -1 if the handle is not open or its file was deleted
+static ssize_t fs_size_untraced(int handle, void * helper) {
 	helper_node * node_pointer = helper;
-	pthread_mutex_lock(&(node_pointer->list_lock));
-	truncate(newname);
-	int newname_length = strlen(newname) + 1;
+	io_begin(node_pointer, IO_FOREGROUND_READ);
 	
-	if (does_filename_exist(helper, newname) == 0){ //if the newname already exists
-		pthread_mutex_unlock(&(node_pointer->list_lock));
-		return 1;
+	offset_node * tmp = handle_file(node_pointer, handle);
+	ssize_t length = -1;
+	if (tmp != NULL){
+		// held writes can make the file longer
+		length = (tmp->write_back != NULL) ? (ssize_t)tmp->write_back->length : tmp->length;
 	}
+	io_end(node_pointer);
+	return length;
+}
+
+// function to close a handle, which fs_open may then return again
+// returns 0 if successful, returns 1 if the handle is not open
+static int fs_close_handle_untraced(int handle, void * helper) {
+	helper_node * node_pointer = helper;
+	io_begin(node_pointer, IO_FOREGROUND_WRITE);
 	
-	if (does_filename_exist(helper, oldname) != 0){ //if the oldname doesn't exist
-		pthread_mutex_unlock(&(node_pointer->list_lock));
+	if (handle < 0 || handle >= node_pointer->handle_capacity || !node_pointer->handles[handle].open){
+		io_end(node_pointer);
 		return 1;
 	}
+	node_pointer->handles[handle].file = NULL;
+	node_pointer->handles[handle].open = 0;
+	io_end(node_pointer);
+	return 0;
+}
+
+// function to say how a file is going to be read, in volumes opened with a read_ahead_size
+// advice is one of the FS_ADVICE_ values, offset and count give the range for FS_ADVICE_WILLNEED,
+// and FS_ADVICE_SEQUENTIAL starts reading ahead from offset
+// returns 0 if successful, returns 1 if the file does not exist or advice is not known
+static int fs_advise_untraced(char * filename, size_t offset, size_t count, int advice, void * helper) {
+	helper_node * node_pointer = helper;
+	io_begin(node_pointer, IO_FOREGROUND_READ);
+	truncate_filename(filename);
 	
-	// thread this plz its gonna be so slow
-	offset_node * tmp_offset_node = get_offset_node(helper, oldname);
-	
-	if (tmp_offset_node == NULL){
-		pthread_mutex_unlock(&(node_pointer->list_lock));
+	offset_node * file = get_offset_node(helper, filename);
+	if (file == NULL || advice < FS_ADVICE_NORMAL || advice > FS_ADVICE_DONTNEED){
+		io_end(node_pointer);
 		return 1;
 	}
+	if (node_pointer->read_ahead_size == 0){
+		io_end(node_pointer);
+		return 0;
+	}
 	
-	strncpy(tmp_offset_node->filename, newname, 64);
-	fseek(node_pointer->directory_table, tmp_offset_node->file_index, SEEK_SET);
-	fwrite(newname, newname_length, 1, node_pointer->directory_table);
+	read_ahead_stream * stream = read_ahead_stream_for(node_pointer, file->filename);
+	switch (advice){
+		case FS_ADVICE_SEQUENTIAL:
+			stream->advice = advice;
+			stream->next_offset = offset;
+			if (file->write_back == NULL && offset < (size_t)file->length){
+				read_ahead_request(node_pointer, stream, offset, node_pointer->read_ahead_size);
+			}
+			break;
+		case FS_ADVICE_WILLNEED:
+			if (file->write_back == NULL && offset < (size_t)file->length && count > 0){
+				read_ahead_request(node_pointer, stream, offset, count);
+			}
+			break;
+		case FS_ADVICE_DONTNEED:
+			stream->current.length = 0;
+			stream->next.length = 0;
+			stream->prefetch = 0;
+			stream->sequential = 0;
+			break;
+		default: // FS_ADVICE_NORMAL and FS_ADVICE_RANDOM
+			stream->advice = advice;
+			stream->sequential = 0;
+			break;
+	}
+	io_end(node_pointer);
+	return 0;
+}
+
+// helper function to find a snapshot from its id
+static snapshot * get_snapshot(helper_node * node_pointer, int snapshot_id){
 	
-	// flush buffers for multithreading
-	fflush(node_pointer->file_data);	
-	fflush(node_pointer->directory_table);
-	fflush(node_pointer->hash_data);
+	snapshot * snapshot_pointer = node_pointer->snapshots;
 	
-    pthread_mutex_unlock(&(node_pointer->list_lock));
-	return 0;
+	while (snapshot_pointer != NULL && snapshot_pointer->id != snapshot_id){
+		snapshot_pointer = snapshot_pointer->next;
+	}
+	return snapshot_pointer;
 }
 
-// function to read file data into buffer
-// returns 0 if successfully completed
-// returns 1 if file does not exist
-// returns 2 if the provided offset makes it impossible to read count bytes given the file size
-// returns 3 if hash verification fails
-int read_file(char * filename, size_t offset, size_t count, void * buf, void * helper) {
+// helper function to find a file in a snapshot from its filename
+static offset_node * get_snapshot_file(snapshot * snapshot_pointer, char * filename){
 	
-	helper_node * node_pointer = helper;
-	pthread_mutex_lock(&(node_pointer->list_lock));
-    truncate(filename);	
+	offset_node * offset_tmp_pointer = snapshot_pointer->files->next;
 	
-	offset_node * tmp = get_offset_node(helper, filename);
-	if (tmp != NULL){
-		
-		int start_block = floor((tmp->offset)/256);
-		int end_block = floor((tmp->offset + tmp->length)/256);
-		int hash_fails = 0;
-		
-		for (int i = start_block; i <= end_block; i++){
-			hash_fails += verify_hash_block(i, helper);
-		}
-		
-		if (hash_fails != 0){
-			return 3;
+	while (offset_tmp_pointer != NULL){
+		if (strncmp(offset_tmp_pointer->filename, filename, 64) == 0){
+			return offset_tmp_pointer;
 		}
-		
-		 if ((offset + count) > tmp->length){
-			pthread_mutex_unlock(&(node_pointer->list_lock));
-			return 2;
-		 }
-		 else{
-			 fseek(node_pointer->file_data, ((tmp->offset) + offset), SEEK_SET);
-			 fread(buf, 1, count, node_pointer->file_data);
-			 
-			// flush buffers for multithreading
-			fflush(node_pointer->file_data);
-			fflush(node_pointer->directory_table);
-			fflush(node_pointer->hash_data);
-			 
-			 pthread_mutex_unlock(&(node_pointer->list_lock));
-			 return 0;
-		 }
-	}
-	else{
-		pthread_mutex_unlock(&(node_pointer->list_lock));
-		return 1;
+		offset_tmp_pointer = offset_tmp_pointer->next;
 	}
+	return NULL;
 }
 
-// function to write to file
-// returns 0 if file is successfully written to
-// returns 1 if file does not exist
-// returns 2 if offset is greater than the current size of the file
-// returns 3 if insufficient space exists in the virtual disk overall
-int write_file(char * filename, size_t offset, size_t count, void * buf, void * helper) {
+// function to take a snapshot of every file
+// the snapshot copies the file list and references the file_data of every extent, so it takes no
+// time proportional to the data, and later writes to shared data are copied on write
+// snapshots are kept in memory until they are deleted or the file system is closed
+// returns id of the snapshot, returns -1 if unsuccessful (malloc error, held writes that cannot be written,
+// or the volume is mounted shared, as other processes would not know the snapshot's data is still in use)
+static int create_snapshot_untraced(void * helper) {
 	helper_node * node_pointer = helper;
-	pthread_mutex_lock(&(node_pointer->list_lock));
-
-	offset_node * tmp_offset_node = get_offset_node(helper, filename);
-	if (tmp_offset_node != NULL) { //node exists
+	if (node_pointer->shared != NULL){
+		return -1;
+	}
+	io_begin(node_pointer, IO_FOREGROUND_WRITE);
+	if (flush_all_write_back(node_pointer) != 0){ // the snapshot would not have the held writes
+		io_end(node_pointer);
+		return -1;
+	}
 	
-		if (offset > tmp_offset_node->length){
-			pthread_mutex_unlock(&(node_pointer->list_lock));
-			return 2;
+	snapshot * new_snapshot = malloc(sizeof(snapshot));
+	offset_node * files = take_node(node_pointer);
+	if (new_snapshot == NULL || files == NULL){ // malloc error
+		free(new_snapshot);
+		if (files != NULL){
+			give_node(node_pointer, files);
 		}
+		io_end(node_pointer);
+		return -1;
+	}
+	new_snapshot->files = files;
 	
-		if ((tmp_offset_node->offset + offset + count) > (tmp_offset_node->offset + tmp_offset_node->length)){ // need to resize
-			int resized = resize_file_helper(filename, (offset + count), helper);
-			if (resized == 2){
-				pthread_mutex_unlock(&(node_pointer->list_lock));
-				return 3;
+	// copy every file node, the copies have no directory_table entries
+	offset_node * offset_tmp_pointer = node_pointer->offset_node->next;
+	offset_node * last_copy = files;
+	while (offset_tmp_pointer != NULL){
+		// the copy keeps the extent array of its node, grown if it is too small
+		offset_node * copy = take_node(node_pointer);
+		extent * extents = (copy != NULL) ? copy->extents : NULL;
+		int extent_capacity = (copy != NULL) ? copy->extent_capacity : 0;
+		if (copy != NULL && extent_capacity < offset_tmp_pointer->number_of_extents){
+			extents = realloc(copy->extents, offset_tmp_pointer->number_of_extents * sizeof(extent));
+			if (extents != NULL){
+				copy->extents = extents;
+				extent_capacity = offset_tmp_pointer->number_of_extents;
+				copy->extent_capacity = extent_capacity;
 			}
-			else{
-				tmp_offset_node = get_offset_node(helper, filename);
-				fseek(node_pointer->file_data, (tmp_offset_node->offset + offset), SEEK_SET);
-				fwrite(buf, count, 1, node_pointer->file_data);
-				
-				fseek(node_pointer->file_data, (tmp_offset_node->offset + offset), SEEK_SET);
-				calculate_hash(helper, 0, 0);
-				pthread_mutex_unlock(&(node_pointer->list_lock));
-				
-				// flush buffers for multithreading
-				fflush(node_pointer->file_data);
-				fflush(node_pointer->directory_table);
-				fflush(node_pointer->hash_data);
-				
-				/**
-				int buffer;
-				fseek(node_pointer->directory_table, 140, SEEK_SET);
-				fread(&buffer, sizeof(int), 1, node_pointer->directory_table);
-				printf("%d ", buffer);**/
-				return 0;
+		}
+		if (copy == NULL || extents == NULL){ // malloc error
+			if (copy != NULL){
+				give_node(node_pointer, copy);
 			}
+			offset_node * copied = files->next;
+			while (copied != NULL){
+				reference_file_space(node_pointer, copied, -1);
+				copied = copied->next;
+			}
+			free_file_list(node_pointer, files);
+			free(new_snapshot);
+			io_end(node_pointer);
+			return -1;
 		}
-		else{ //don't need to resize
-			fseek(node_pointer->file_data, (tmp_offset_node->offset + offset), SEEK_SET);
-			fwrite(buf, count, 1, node_pointer->file_data);
-			calculate_hash(helper, 0, 0);
-			pthread_mutex_unlock(&(node_pointer->list_lock));
-			
-			// flush buffers for multithreading
-			fflush(node_pointer->file_data);
-			fflush(node_pointer->directory_table);
-			fflush(node_pointer->hash_data);
-			return 0;
+		
+		*copy = *offset_tmp_pointer;
+		memcpy(extents, offset_tmp_pointer->extents, offset_tmp_pointer->number_of_extents * sizeof(extent));
+		for (int i = 0; i < copy->number_of_extents; i++){
+			extents[i].file_index = -1;
 		}
+		copy->file_index = -1;
+		copy->filename = share_name(copy->filename);
+		copy->extents = extents;
+		copy->write_back = NULL;
+		copy->extent_capacity = extent_capacity;
+		copy->next = NULL;
+		reference_file_space(node_pointer, copy, 1);
+		
+		last_copy->next = copy;
+		last_copy = copy;
+		offset_tmp_pointer = offset_tmp_pointer->next;
 	}
-	else{ //file doesn't exist
-		pthread_mutex_unlock(&(node_pointer->list_lock));
-		return 1;
-	}
+	
+	new_snapshot->id = node_pointer->next_snapshot_id;
+	node_pointer->next_snapshot_id++;
+	new_snapshot->next = node_pointer->snapshots;
+	node_pointer->snapshots = new_snapshot;
+	
+	io_end(node_pointer);
+	return new_snapshot->id;
 }
 
-// returns file size of the file with the given filename
-// returns -1 if there is an error, such as the file not existing
-ssize_t file_size(char * filename, void * helper) {
+// function to delete a snapshot, file_data no longer shared with any file becomes free
+// returns 0 if successful, returns 1 if the snapshot does not exist
+static int delete_snapshot_untraced(int snapshot_id, void * helper) {
 	helper_node * node_pointer = helper;
-	pthread_mutex_lock(&(node_pointer->list_lock));
+	io_begin(node_pointer, IO_FOREGROUND_WRITE);
 	
-	truncate(filename);
-	offset_node * tmp = get_offset_node(helper, filename);
-	if (tmp != NULL){
-		pthread_mutex_unlock(&(node_pointer->list_lock));
-		return(tmp->length);
+	snapshot ** snapshot_link = &node_pointer->snapshots;
+	while (*snapshot_link != NULL && (*snapshot_link)->id != snapshot_id){
+		snapshot_link = &(*snapshot_link)->next;
 	}
-	else{
-		pthread_mutex_unlock(&(node_pointer->list_lock));
-		return -1;
+	
+	if (*snapshot_link == NULL){ // snapshot does not exist
+		io_end(node_pointer);
+		return 1;
 	}
-}
-
-// function to calculate fletcher hash of given buffer
-// outputs exactly 16 bytes to output
-void fletcher(uint8_t * buf, size_t length, uint8_t * output) {
 	
-	int overflow = length % 4;
-	int length_4_bytes;
+	snapshot * snapshot_pointer = *snapshot_link;
+	*snapshot_link = snapshot_pointer->next;
 	
-	uint32_t * data;
+	offset_node * offset_tmp_pointer = snapshot_pointer->files->next;
+	while (offset_tmp_pointer != NULL){
+		reference_file_space(node_pointer, offset_tmp_pointer, -1);
+		offset_tmp_pointer = offset_tmp_pointer->next;
+	}
 	
-	if (overflow != 0){
-		data = calloc(length + 4 - overflow, 1);
-		length_4_bytes = (length + 4 - overflow)/4;
+	// unwritten ranges only the snapshot held are no longer hashed as zeros
+	int rehash = list_has_unwritten_extents(snapshot_pointer->files);
+	free_file_list(node_pointer, snapshot_pointer->files);
+	free(snapshot_pointer);
+	if (rehash){
+		hash_tree_changed(helper);
 	}
-	else{
-		data = calloc(length, 1);
-		length_4_bytes = length/4;
+	
+	io_end(node_pointer);
+	return 0;
+}
+
+// function to read data of a file as it was when a snapshot was taken
+// shared file_data is never written in place, so the blocks are verified against the hash tree of the volume
+// returns 0 if successfully completed
+// returns 1 if the snapshot or the file in it does not exist
+// returns 2 if the provided offset makes it impossible to read count bytes given the file size
+// returns 3 if hash verification fails
+static int read_snapshot_file_untraced(int snapshot_id, char * filename, size_t offset, size_t count, void * buf, void * helper) {
+	helper_node * node_pointer = helper;
+	io_begin(node_pointer, IO_FOREGROUND_READ);
+	truncate_filename(filename);
+	
+	snapshot * snapshot_pointer = get_snapshot(node_pointer, snapshot_id);
+	offset_node * tmp = NULL;
+	if (snapshot_pointer != NULL){
+		tmp = get_snapshot_file(snapshot_pointer, filename);
 	}
 	
-	memcpy(data, buf, length);
+	if (tmp == NULL){
+		io_end(node_pointer);
+		return 1;
+	}
 	
-	uint64_t a = 0;
-	uint64_t b = 0;
-	uint64_t c = 0;
-	uint64_t d = 0;
+	if (verify_file_blocks(node_pointer, tmp) != 0){
+		io_end(node_pointer);
+		return 3;
+	}
 	
-	for (int i = 0; i < length_4_bytes; i++){
-		a = (a + data[i])%((uint64_t)(pow(2, 32)-1));
-		b = (b + a)%((uint64_t)(pow(2, 32)-1));
-		c = (c + b)%((uint64_t)(pow(2, 32)-1));
-		d = (d + c)%((uint64_t)(pow(2, 32)-1));
+	if ((offset + count) > (size_t)tmp->length){
+		io_end(node_pointer);
+		return 2;
 	}
 	
-	memcpy(output, &a, 4);
-	memcpy(output+4, &b, 4);
-	memcpy(output+8, &c, 4);
-	memcpy(output+12, &d, 4);
+	file_data_io(node_pointer, tmp, offset, count, buf, 0);
 	
-	free(data);
+	io_end(node_pointer);
+	return 0;
+}
+
+// returns file size of the file with the given filename when a snapshot was taken
+// returns -1 if there is an error, such as the snapshot or the file not existing
+static ssize_t snapshot_file_size_untraced(int snapshot_id, char * filename, void * helper) {
+	helper_node * node_pointer = helper;
+	io_begin(node_pointer, IO_FOREGROUND_READ);
+	truncate_filename(filename);
+	
+	ssize_t length = -1;
+	snapshot * snapshot_pointer = get_snapshot(node_pointer, snapshot_id);
+	if (snapshot_pointer != NULL){
+		offset_node * tmp = get_snapshot_file(snapshot_pointer, filename);
+		if (tmp != NULL){
+			length = tmp->length;
+		}
+	}
 	
+	io_end(node_pointer);
+	return length;
+}
+
+// function to calculate fletcher hash of given buffer
+// outputs exactly 16 bytes to output
+void fletcher(uint8_t * buf, size_t length, uint8_t * output) {
+	fletcher_core(buf, length, output);
     return;
 }
 
 // recursive helper function to calculate hash block which traverses up the hash tree
+// returns 0 if successful, returns 1 if unsuccessful (malloc error), leaving the block's hashes as they were
 static int calculate_hash_block_rec(void * helper, int offset, int depth){
 	helper_node * node_pointer = helper;
 	
 	// if only one node, just calculate, no recursion
 	if (node_pointer->number_of_blocks == 1){
 			// read in data from block in file_data and calculate fletcher
-			void * tmp_file_data = malloc(256);
-			int start_offset = (pow(2, node_pointer->max_depth + 1) - 1) - node_pointer->number_of_blocks;
-			int file_data_offset = (offset - start_offset) * 256;
+			scratch_mark mark = scratch_save();
+			void * tmp_file_data = scratch_alloc(node_pointer->block_size);
+			if (tmp_file_data == NULL){ // malloc error
+				scratch_release(mark);
+				return 1;
+			}
+			size_t file_data_offset = (size_t)(offset - node_pointer->leaf_start) << node_pointer->block_shift;
 		
-			fseek(node_pointer->file_data, file_data_offset, SEEK_SET);
-			fread(tmp_file_data, 256, 1, node_pointer->file_data);
+			read_hashed_data(node_pointer, file_data_offset, node_pointer->block_size, tmp_file_data);
 		
-			fletcher(tmp_file_data, 256, node_pointer->hash_tree + (offset * 16));
+			node_pointer->hash_leaf(tmp_file_data, node_pointer->block_size, tree_node(node_pointer, offset));
 	
-			fseek(node_pointer->hash_data, offset * 16, SEEK_SET);
-			fwrite(node_pointer->hash_tree + (offset * 16), 16, 1, node_pointer->hash_data);
+			write_tree_node(node_pointer, offset);
 		
 			// flush buffers for multithreading
 			fflush(node_pointer->hash_data);
 		
-			free(tmp_file_data);
+			scratch_release(mark);
 			return 0;
 		}
 	
 	if (depth == 0){
 		// perform final fletcher
-		fletcher(node_pointer->hash_tree + 16, 32, node_pointer->hash_tree);
-		fseek(node_pointer->hash_data, 0, SEEK_SET);
-		fwrite(node_pointer->hash_tree, 16, 1, node_pointer->hash_data);
+		hash_children(node_pointer, 0, tree_node(node_pointer, 0));
+		write_tree_node(node_pointer, 0);
 		// flush buffers for multithreading
 		fflush(node_pointer->hash_data);
 		return 0;
@@ -1159,31 +7254,32 @@ static int calculate_hash_block_rec(void * helper, int offset, int depth){
 	
 	else if (depth == node_pointer->max_depth){
 		// read in data from block in file_data and calculate fletcher
-		void * tmp_file_data = malloc(256);
-		int start_offset = (pow(2, node_pointer->max_depth + 1) - 1) - node_pointer->number_of_blocks;
-		int file_data_offset = (offset - start_offset) * 256;
+		scratch_mark mark = scratch_save();
+		void * tmp_file_data = scratch_alloc(node_pointer->block_size);
+		if (tmp_file_data == NULL){ // malloc error
+			scratch_release(mark);
+			return 1;
+		}
+		size_t file_data_offset = (size_t)(offset - node_pointer->leaf_start) << node_pointer->block_shift;
 		
-		fseek(node_pointer->file_data, file_data_offset, SEEK_SET);
-		fread(tmp_file_data, 256, 1, node_pointer->file_data);
+		read_hashed_data(node_pointer, file_data_offset, node_pointer->block_size, tmp_file_data);
 		
-		fletcher(tmp_file_data, 256, node_pointer->hash_tree + (offset * 16));
+		node_pointer->hash_leaf(tmp_file_data, node_pointer->block_size, tree_node(node_pointer, offset));
 	
-		fseek(node_pointer->hash_data, offset * 16, SEEK_SET);
-		fwrite(node_pointer->hash_tree + (offset * 16), 16, 1, node_pointer->hash_data);
+		write_tree_node(node_pointer, offset);
 		// flush buffers for multithreading
 		fflush(node_pointer->hash_data);
-		free(tmp_file_data);
+		scratch_release(mark);
 		calculate_hash_block_rec(helper, (int)((offset-1)/2), depth-1);
 		return 0;
 	}
 	else{
 		//fletcher block n + n+1
 		// then go up
-		fletcher(node_pointer->hash_tree + (16 * ((offset * 2) + 1)), 32, node_pointer->hash_tree + (offset * 16));
+		hash_children(node_pointer, offset, tree_node(node_pointer, offset));
 		
 		// update hash_data file
-		fseek(node_pointer->hash_data, offset * 16, SEEK_SET);
-		fwrite(node_pointer->hash_tree + (offset * 16), 16, 1, node_pointer->hash_data);
+		write_tree_node(node_pointer, offset);
 		// flush buffers for multithreading
 		fflush(node_pointer->hash_data);
 		calculate_hash_block_rec(helper, (int)((offset-1)/2), depth-1);
@@ -1192,13 +7288,690 @@ static int calculate_hash_block_rec(void * helper, int offset, int depth){
 }
 
 // function to calculate the hashes for a given block offset and update all affected hashes in the Merkle hash tree
-void compute_hash_block(size_t block_offset, void * helper) {
+static void compute_hash_block_untraced(size_t block_offset, void * helper) {
 	helper_node * node_pointer = helper;
-	pthread_mutex_lock(&node_pointer->list_lock);
-	int start_offset = (pow(2, node_pointer->max_depth + 1) - 1) - node_pointer->number_of_blocks;
-	calculate_hash_block_rec(helper, start_offset + block_offset, node_pointer->max_depth);
-	pthread_mutex_unlock(&node_pointer->list_lock);
+	io_begin(node_pointer, IO_BACKGROUND);
+	sync_hash_tree(node_pointer);
+	calculate_hash_block_rec(helper, node_pointer->leaf_start + block_offset, node_pointer->max_depth);
+	io_end(node_pointer);
 	
     return;
 }
 
+
+// helper function to find the id of a name in the trace, writing a TRACE_NAME record the first time it is seen
+// called with trace_lock held
+// returns the id, or 0 for no name (or malloc error)
+static uint32_t trace_name_id(helper_node * node_pointer, char * name){
+	
+	if (name == NULL){
+		return 0;
+	}
+	
+	int low = 0;
+	int high = node_pointer->trace_name_count;
+	while (low < high){
+		int middle = (low + high) / 2;
+		if (strncmp(node_pointer->trace_names[middle].name, name, 64) < 0){
+			low = middle + 1;
+		}
+		else{
+			high = middle;
+		}
+	}
+	if (low < node_pointer->trace_name_count && strncmp(node_pointer->trace_names[low].name, name, 64) == 0){
+		return node_pointer->trace_names[low].id;
+	}
+	
+	if (node_pointer->trace_name_count == node_pointer->trace_name_capacity){
+		int new_capacity = (node_pointer->trace_name_capacity == 0) ? 64 : node_pointer->trace_name_capacity * 2;
+		trace_name * new_names = realloc(node_pointer->trace_names, new_capacity * sizeof(trace_name));
+		if (new_names == NULL){ // malloc error
+			return 0;
+		}
+		node_pointer->trace_names = new_names;
+		node_pointer->trace_name_capacity = new_capacity;
+	}
+	trace_name * new_name = &node_pointer->trace_names[low];
+	memmove(new_name + 1, new_name, (node_pointer->trace_name_count - low) * sizeof(trace_name));
+	strncpy(new_name->name, name, 64);
+	new_name->name[63] = '\0';
+	new_name->id = node_pointer->trace_name_count + 1;
+	node_pointer->trace_name_count++;
+	
+	uint8_t record[TRACE_RECORD_SIZE] = {TRACE_NAME};
+	uint64_t name_length = strlen(new_name->name);
+	memcpy(record + 4, &new_name->id, 4);
+	memcpy(record + 24, &name_length, 8);
+	fwrite(record, TRACE_RECORD_SIZE, 1, node_pointer->trace);
+	fwrite(new_name->name, name_length, 1, node_pointer->trace);
+	return new_name->id;
+}
+
+// helper function called as a call of operation starts, begins its span
+// returns the start time of the call for trace_call, 0 if the volume is not traced
+static uint64_t trace_begin(helper_node * node_pointer, int operation){
+	(void) operation; // only used by spans
+	SPAN_BEGIN(trace_operation_names[operation]);
+	return (node_pointer->trace != NULL) ? trace_clock() : 0;
+}
+
+// helper function to record a call that started at start in the trace, if the volume is traced, and end its span
+// other is the second name id, handle or snapshot id, other_name is used instead for calls with a second name
+static void trace_call(helper_node * node_pointer, int operation, char * name, char * other_name, uint32_t other, size_t offset, size_t count, long result, uint64_t start){
+	
+	SPAN_END(trace_operation_names[operation]);
+	if (node_pointer->trace == NULL){
+		return;
+	}
+	uint64_t duration = trace_clock() - start;
+	
+	pthread_mutex_lock(&node_pointer->trace_lock);
+	uint8_t record[TRACE_RECORD_SIZE] = {operation};
+	uint32_t name_id = trace_name_id(node_pointer, name);
+	if (other_name != NULL){
+		other = trace_name_id(node_pointer, other_name);
+	}
+	int32_t traced_result = result;
+	uint64_t traced_offset = offset;
+	uint64_t traced_count = count;
+	uint64_t timestamp = start - node_pointer->trace_start;
+	memcpy(record + 4, &name_id, 4);
+	memcpy(record + 8, &other, 4);
+	memcpy(record + 12, &traced_result, 4);
+	memcpy(record + 16, &traced_offset, 8);
+	memcpy(record + 24, &traced_count, 8);
+	memcpy(record + 32, &timestamp, 8);
+	memcpy(record + 40, &duration, 8);
+	fwrite(record, TRACE_RECORD_SIZE, 1, node_pointer->trace);
+	pthread_mutex_unlock(&node_pointer->trace_lock);
+}
+
+// public functions, each runs the call above and records it when the volume was opened with a trace_path
+
+void sync_fs(void * helper) {
+	uint64_t start = trace_begin(helper, TRACE_SYNC_FS);
+	sync_fs_untraced(helper);
+	trace_call(helper, TRACE_SYNC_FS, NULL, NULL, 0, 0, 0, 0, start);
+}
+
+int scrub_fs(void * helper) {
+	uint64_t start = trace_begin(helper, TRACE_SCRUB_FS);
+	int result = scrub_fs_untraced(helper);
+	trace_call(helper, TRACE_SCRUB_FS, NULL, NULL, 0, 0, 0, result, start);
+	return result;
+}
+
+int scrub_corrupt_blocks(size_t * blocks, int max, void * helper) {
+	uint64_t start = trace_begin(helper, TRACE_SCRUB_CORRUPT_BLOCKS);
+	int result = scrub_corrupt_blocks_untraced(blocks, max, helper);
+	trace_call(helper, TRACE_SCRUB_CORRUPT_BLOCKS, NULL, NULL, 0, 0, max, result, start);
+	return result;
+}
+
+long scrub_age(size_t block_offset, void * helper) {
+	uint64_t start = trace_begin(helper, TRACE_SCRUB_AGE);
+	long result = scrub_age_untraced(block_offset, helper);
+	trace_call(helper, TRACE_SCRUB_AGE, NULL, NULL, 0, block_offset, 0, (result < 0) ? -1 : 0, start);
+	return result;
+}
+
+int create_file(char * filename, size_t length, void * helper) {
+	uint64_t start = trace_begin(helper, TRACE_CREATE_FILE);
+	int result = create_file_untraced(filename, length, helper);
+	trace_call(helper, TRACE_CREATE_FILE, filename, NULL, 0, 0, length, result, start);
+	return result;
+}
+
+int resize_file(char * filename, size_t length, void * helper) {
+	uint64_t start = trace_begin(helper, TRACE_RESIZE_FILE);
+	int result = resize_file_untraced(filename, length, helper);
+	trace_call(helper, TRACE_RESIZE_FILE, filename, NULL, 0, 0, length, result, start);
+	return result;
+}
+
+void repack(void * helper) {
+	uint64_t start = trace_begin(helper, TRACE_REPACK);
+	repack_untraced(helper);
+	trace_call(helper, TRACE_REPACK, NULL, NULL, 0, 0, 0, 0, start);
+}
+
+int delete_file(char * filename, void * helper) {
+	uint64_t start = trace_begin(helper, TRACE_DELETE_FILE);
+	int result = delete_file_untraced(filename, helper);
+	trace_call(helper, TRACE_DELETE_FILE, filename, NULL, 0, 0, 0, result, start);
+	return result;
+}
+
+int rename_file(char * oldname, char * newname, void * helper) {
+	uint64_t start = trace_begin(helper, TRACE_RENAME_FILE);
+	int result = rename_file_untraced(oldname, newname, helper);
+	trace_call(helper, TRACE_RENAME_FILE, oldname, newname, 0, 0, 0, result, start);
+	return result;
+}
+
+int clone_file(char * src, char * dst, void * helper) {
+	uint64_t start = trace_begin(helper, TRACE_CLONE_FILE);
+	int result = clone_file_untraced(src, dst, helper);
+	trace_call(helper, TRACE_CLONE_FILE, src, dst, 0, 0, 0, result, start);
+	return result;
+}
+
+int deduplicate(fs_dedup_report * report, void * helper) {
+	uint64_t start = trace_begin(helper, TRACE_DEDUPLICATE);
+	int result = deduplicate_untraced(report, helper);
+	trace_call(helper, TRACE_DEDUPLICATE, NULL, NULL, 0, 0, 0, result, start);
+	return result;
+}
+
+int read_file(char * filename, size_t offset, size_t count, void * buf, void * helper) {
+	uint64_t start = trace_begin(helper, TRACE_READ_FILE);
+	int result = read_file_untraced(filename, offset, count, buf, helper);
+	trace_call(helper, TRACE_READ_FILE, filename, NULL, 0, offset, count, result, start);
+	return result;
+}
+
+int write_file(char * filename, size_t offset, size_t count, void * buf, void * helper) {
+	uint64_t start = trace_begin(helper, TRACE_WRITE_FILE);
+	int result = write_file_untraced(filename, offset, count, buf, helper);
+	trace_call(helper, TRACE_WRITE_FILE, filename, NULL, 0, offset, count, result, start);
+	return result;
+}
+
+int import_file(char * host_path, char * filename, void * helper) {
+	uint64_t start = trace_begin(helper, TRACE_IMPORT_FILE);
+	int result = import_file_untraced(host_path, filename, helper);
+	trace_call(helper, TRACE_IMPORT_FILE, filename, NULL, 0, 0, 0, result, start);
+	return result;
+}
+
+int export_file(char * filename, char * host_path, int verify, void * helper) {
+	uint64_t start = trace_begin(helper, TRACE_EXPORT_FILE);
+	int result = export_file_untraced(filename, host_path, verify, helper);
+	trace_call(helper, TRACE_EXPORT_FILE, filename, NULL, 0, verify, 0, result, start);
+	return result;
+}
+
+ssize_t file_size(char * filename, void * helper) {
+	uint64_t start = trace_begin(helper, TRACE_FILE_SIZE);
+	ssize_t result = file_size_untraced(filename, helper);
+	trace_call(helper, TRACE_FILE_SIZE, filename, NULL, 0, 0, 0, result, start);
+	return result;
+}
+
+int list_files(char * prefix, char * cursor, char (* out)[64], int max, void * helper) {
+	uint64_t start = trace_begin(helper, TRACE_LIST_FILES);
+	int result = list_files_untraced(prefix, cursor, out, max, helper);
+	trace_call(helper, TRACE_LIST_FILES, prefix, cursor, 0, 0, max, result, start);
+	return result;
+}
+
+int fs_open(char * filename, void * helper) {
+	uint64_t start = trace_begin(helper, TRACE_FS_OPEN);
+	int result = fs_open_untraced(filename, helper);
+	trace_call(helper, TRACE_FS_OPEN, filename, NULL, 0, 0, 0, result, start);
+	return result;
+}
+
+int fs_read(int handle, size_t offset, size_t count, void * buf, void * helper) {
+	uint64_t start = trace_begin(helper, TRACE_FS_READ);
+	int result = fs_read_untraced(handle, offset, count, buf, helper);
+	trace_call(helper, TRACE_FS_READ, NULL, NULL, handle, offset, count, result, start);
+	return result;
+}
+
+int fs_write(int handle, size_t offset, size_t count, void * buf, void * helper) {
+	uint64_t start = trace_begin(helper, TRACE_FS_WRITE);
+	int result = fs_write_untraced(handle, offset, count, buf, helper);
+	trace_call(helper, TRACE_FS_WRITE, NULL, NULL, handle, offset, count, result, start);
+	return result;
+}
+
+ssize_t fs_size(int handle, void * helper) {
+	uint64_t start = trace_begin(helper, TRACE_FS_SIZE);
+	ssize_t result = fs_size_untraced(handle, helper);
+	trace_call(helper, TRACE_FS_SIZE, NULL, NULL, handle, 0, 0, result, start);
+	return result;
+}
+
+int fs_close_handle(int handle, void * helper) {
+	uint64_t start = trace_begin(helper, TRACE_FS_CLOSE_HANDLE);
+	int result = fs_close_handle_untraced(handle, helper);
+	trace_call(helper, TRACE_FS_CLOSE_HANDLE, NULL, NULL, handle, 0, 0, result, start);
+	return result;
+}
+
+int fs_advise(char * filename, size_t offset, size_t count, int advice, void * helper) {
+	uint64_t start = trace_begin(helper, TRACE_FS_ADVISE);
+	int result = fs_advise_untraced(filename, offset, count, advice, helper);
+	trace_call(helper, TRACE_FS_ADVISE, filename, NULL, advice, offset, count, result, start);
+	return result;
+}
+
+int create_snapshot(void * helper) {
+	uint64_t start = trace_begin(helper, TRACE_CREATE_SNAPSHOT);
+	int result = create_snapshot_untraced(helper);
+	trace_call(helper, TRACE_CREATE_SNAPSHOT, NULL, NULL, 0, 0, 0, result, start);
+	return result;
+}
+
+int delete_snapshot(int snapshot_id, void * helper) {
+	uint64_t start = trace_begin(helper, TRACE_DELETE_SNAPSHOT);
+	int result = delete_snapshot_untraced(snapshot_id, helper);
+	trace_call(helper, TRACE_DELETE_SNAPSHOT, NULL, NULL, snapshot_id, 0, 0, result, start);
+	return result;
+}
+
+int read_snapshot_file(int snapshot_id, char * filename, size_t offset, size_t count, void * buf, void * helper) {
+	uint64_t start = trace_begin(helper, TRACE_READ_SNAPSHOT_FILE);
+	int result = read_snapshot_file_untraced(snapshot_id, filename, offset, count, buf, helper);
+	trace_call(helper, TRACE_READ_SNAPSHOT_FILE, filename, NULL, snapshot_id, offset, count, result, start);
+	return result;
+}
+
+ssize_t snapshot_file_size(int snapshot_id, char * filename, void * helper) {
+	uint64_t start = trace_begin(helper, TRACE_SNAPSHOT_FILE_SIZE);
+	ssize_t result = snapshot_file_size_untraced(snapshot_id, filename, helper);
+	trace_call(helper, TRACE_SNAPSHOT_FILE_SIZE, filename, NULL, snapshot_id, 0, 0, result, start);
+	return result;
+}
+
+void compute_hash_tree(void * helper) {
+	uint64_t start = trace_begin(helper, TRACE_COMPUTE_HASH_TREE);
+	compute_hash_tree_untraced(helper);
+	trace_call(helper, TRACE_COMPUTE_HASH_TREE, NULL, NULL, 0, 0, 0, 0, start);
+}
+
+void compute_hash_block(size_t block_offset, void * helper) {
+	uint64_t start = trace_begin(helper, TRACE_COMPUTE_HASH_BLOCK);
+	compute_hash_block_untraced(block_offset, helper);
+	trace_call(helper, TRACE_COMPUTE_HASH_BLOCK, NULL, NULL, 0, block_offset, 0, 0, start);
+}
+
+// define a call of a trace loaded by replay_trace
+typedef struct trace_entry{
+	int operation;
+	uint32_t name_id;
+	uint32_t other;
+	int32_t result;
+	uint64_t offset;
+	uint64_t count;
+	uint64_t timestamp;
+} trace_entry;
+
+// define a trace being replayed, shared by the threads replaying it
+// handles and snapshot ids in the trace are mapped to the ones the replay gets for the same calls
+typedef struct replay_state{
+	void * helper;
+	trace_entry * entries;
+	int number_of_entries;
+	char (* names)[64]; // indexed by name id
+	uint32_t number_of_names;
+	int original_speed;
+	uint64_t start;
+	int next; // next entry to be taken by a thread
+	int * handles;
+	int handle_capacity;
+	int * snapshots;
+	int snapshot_capacity;
+	double * latencies; // for each entry, -1 for entries that are skipped
+	size_t mismatches;
+	size_t bytes;
+	pthread_mutex_t lock;
+} replay_state;
+
+// helper function to load a trace written with trace_path
+// returns 0 if successful, returns 1 if the trace cannot be read or is not a trace (or malloc error)
+static int load_trace(char * trace_path, replay_state * state){
+	
+	FILE * trace = fopen(trace_path, "r");
+	if (trace == NULL){
+		return 1;
+	}
+	
+	char magic[8];
+	if (fread(magic, 8, 1, trace) != 1 || memcmp(magic, TRACE_MAGIC, 8) != 0){
+		fclose(trace);
+		return 1;
+	}
+	
+	int entry_capacity = 0;
+	uint8_t record[TRACE_RECORD_SIZE];
+	while (fread(record, TRACE_RECORD_SIZE, 1, trace) == 1){
+		trace_entry entry;
+		entry.operation = record[0];
+		memcpy(&entry.name_id, record + 4, 4);
+		memcpy(&entry.other, record + 8, 4);
+		memcpy(&entry.result, record + 12, 4);
+		memcpy(&entry.offset, record + 16, 8);
+		memcpy(&entry.count, record + 24, 8);
+		memcpy(&entry.timestamp, record + 32, 8);
+		
+		// names are given once, in order of their ids
+		if (entry.operation == TRACE_NAME){
+			if (entry.name_id != state->number_of_names + 1 || entry.count > 63){
+				fclose(trace);
+				return 1;
+			}
+			char (* new_names)[64] = realloc(state->names, (entry.name_id + 1) * 64);
+			if (new_names == NULL){ // malloc error
+				fclose(trace);
+				return 1;
+			}
+			state->names = new_names;
+			memset(state->names[entry.name_id], 0, 64);
+			if (entry.count > 0 && fread(state->names[entry.name_id], entry.count, 1, trace) != 1){
+				fclose(trace);
+				return 1;
+			}
+			state->number_of_names = entry.name_id;
+			continue;
+		}
+		if (entry.name_id > state->number_of_names || ((entry.operation == TRACE_RENAME_FILE || entry.operation == TRACE_CLONE_FILE || entry.operation == TRACE_LIST_FILES) && entry.other > state->number_of_names)){
+			fclose(trace);
+			return 1;
+		}
+		
+		if (state->number_of_entries == entry_capacity){
+			entry_capacity = (entry_capacity == 0) ? 256 : entry_capacity * 2;
+			trace_entry * new_entries = realloc(state->entries, entry_capacity * sizeof(trace_entry));
+			if (new_entries == NULL){ // malloc error
+				fclose(trace);
+				return 1;
+			}
+			state->entries = new_entries;
+		}
+		state->entries[state->number_of_entries] = entry;
+		state->number_of_entries++;
+	}
+	
+	fclose(trace);
+	return 0;
+}
+
+// helper function to map a handle or snapshot id of the trace to the one the replay got, or to look one up
+// with value -2 the mapped value is returned, -1 if there is none
+static int replay_map(replay_state * state, int ** map, int * capacity, int key, int value){
+	
+	pthread_mutex_lock(&state->lock);
+	int return_value = -1;
+	if (key >= 0 && value == -2){
+		return_value = (key < *capacity) ? (*map)[key] : -1;
+	}
+	else if (key >= 0){
+		if (key >= *capacity){
+			int new_capacity = (key + 1) * 2;
+			int * new_map = realloc(*map, new_capacity * sizeof(int));
+			if (new_map != NULL){
+				for (int i = *capacity; i < new_capacity; i++){
+					new_map[i] = -1;
+				}
+				*map = new_map;
+				*capacity = new_capacity;
+			}
+		}
+		if (key < *capacity){
+			(*map)[key] = value;
+		}
+	}
+	pthread_mutex_unlock(&state->lock);
+	return return_value;
+}
+
+// helper function to make the call of one entry of a trace
+// buffer has room for the bytes the call reads or writes, and for list_files and scrub_corrupt_blocks output
+// returns the result of the call
+static long replay_entry(replay_state * state, trace_entry * entry, uint8_t * buffer){
+	
+	void * helper = state->helper;
+	char name[64];
+	char other_name[64];
+	strncpy(name, state->names[entry->name_id], 64);
+	strncpy(other_name, state->names[(entry->operation == TRACE_RENAME_FILE || entry->operation == TRACE_CLONE_FILE || entry->operation == TRACE_LIST_FILES) ? entry->other : 0], 64);
+	int handle = replay_map(state, &state->handles, &state->handle_capacity, entry->other, -2);
+	int snapshot_id = replay_map(state, &state->snapshots, &state->snapshot_capacity, entry->other, -2);
+	fs_dedup_report dedup_report;
+	long result = 0;
+	
+	switch (entry->operation){
+		case TRACE_CREATE_FILE:
+			return create_file(name, entry->count, helper);
+		case TRACE_RESIZE_FILE:
+			return resize_file(name, entry->count, helper);
+		case TRACE_REPACK:
+			repack(helper);
+			return 0;
+		case TRACE_DELETE_FILE:
+			return delete_file(name, helper);
+		case TRACE_RENAME_FILE:
+			return rename_file(name, other_name, helper);
+		case TRACE_CLONE_FILE:
+			return clone_file(name, other_name, helper);
+		case TRACE_DEDUPLICATE:
+			return deduplicate(&dedup_report, helper);
+		case TRACE_READ_FILE:
+			return read_file(name, entry->offset, entry->count, buffer, helper);
+		case TRACE_WRITE_FILE:
+			return write_file(name, entry->offset, entry->count, buffer, helper);
+		case TRACE_FILE_SIZE:
+			return file_size(name, helper);
+		case TRACE_LIST_FILES:
+			return list_files((entry->name_id != 0) ? name : NULL, (entry->other != 0) ? other_name : NULL, (char (*)[64]) buffer, entry->count, helper);
+		case TRACE_FS_OPEN:
+			result = fs_open(name, helper);
+			if (result >= 0){
+				replay_map(state, &state->handles, &state->handle_capacity, entry->result, result);
+			}
+			return result;
+		case TRACE_FS_READ:
+			return fs_read(handle, entry->offset, entry->count, buffer, helper);
+		case TRACE_FS_WRITE:
+			return fs_write(handle, entry->offset, entry->count, buffer, helper);
+		case TRACE_FS_SIZE:
+			return fs_size(handle, helper);
+		case TRACE_FS_CLOSE_HANDLE:
+			return fs_close_handle(handle, helper);
+		case TRACE_CREATE_SNAPSHOT:
+			result = create_snapshot(helper);
+			if (result >= 0){
+				replay_map(state, &state->snapshots, &state->snapshot_capacity, entry->result, result);
+			}
+			return result;
+		case TRACE_DELETE_SNAPSHOT:
+			return delete_snapshot(snapshot_id, helper);
+		case TRACE_READ_SNAPSHOT_FILE:
+			return read_snapshot_file(snapshot_id, name, entry->offset, entry->count, buffer, helper);
+		case TRACE_SNAPSHOT_FILE_SIZE:
+			return snapshot_file_size(snapshot_id, name, helper);
+		case TRACE_COMPUTE_HASH_TREE:
+			compute_hash_tree(helper);
+			return 0;
+		case TRACE_COMPUTE_HASH_BLOCK:
+			compute_hash_block(entry->offset, helper);
+			return 0;
+		case TRACE_SYNC_FS:
+			sync_fs(helper);
+			return 0;
+		case TRACE_SCRUB_FS:
+			return scrub_fs(helper);
+		case TRACE_SCRUB_CORRUPT_BLOCKS:
+			return scrub_corrupt_blocks((size_t *) buffer, entry->count, helper);
+		case TRACE_SCRUB_AGE:
+			return (scrub_age(entry->offset, helper) < 0) ? -1 : 0;
+		case TRACE_FS_ADVISE:
+			return fs_advise(name, entry->offset, entry->count, entry->other, helper);
+	}
+	return 0;
+}
+
+// helper function to check if an entry of a trace can be replayed
+// returns 1 if it can, returns 0 otherwise
+static int replayable(trace_entry * entry){
+	return entry->operation != TRACE_IMPORT_FILE && entry->operation != TRACE_EXPORT_FILE && entry->operation <= TRACE_FS_ADVISE;
+}
+
+// helper function to work out the bytes of buffer an entry of a trace needs
+static size_t replay_buffer_size(trace_entry * entry){
+	
+	switch (entry->operation){
+		case TRACE_READ_FILE:
+		case TRACE_WRITE_FILE:
+		case TRACE_FS_READ:
+		case TRACE_FS_WRITE:
+		case TRACE_READ_SNAPSHOT_FILE:
+			return entry->count;
+		case TRACE_LIST_FILES:
+			return entry->count * 64;
+		case TRACE_SCRUB_CORRUPT_BLOCKS:
+			return entry->count * sizeof(size_t);
+	}
+	return 0;
+}
+
+// helper function run by each thread replaying a trace, takes entries in order until none are left
+// at original speed each call waits until as long after the replay started as it was made after the trace started
+static void * replay_worker(void * arg){
+	
+	replay_state * state = arg;
+	uint8_t * buffer = NULL;
+	size_t buffer_size = 0;
+	
+	while (1){
+		pthread_mutex_lock(&state->lock);
+		int i = state->next++;
+		pthread_mutex_unlock(&state->lock);
+		if (i >= state->number_of_entries){
+			break;
+		}
+		
+		trace_entry * entry = &state->entries[i];
+		state->latencies[i] = -1;
+		if (!replayable(entry)){
+			continue;
+		}
+		
+		size_t needed = replay_buffer_size(entry);
+		if (needed > buffer_size){
+			uint8_t * new_buffer = realloc(buffer, needed);
+			if (new_buffer == NULL){ // malloc error
+				continue;
+			}
+			memset(new_buffer + buffer_size, 0xa5, needed - buffer_size);
+			buffer = new_buffer;
+			buffer_size = needed;
+		}
+		
+		if (state->original_speed){
+			uint64_t now = trace_clock();
+			if (state->start + entry->timestamp > now){
+				uint64_t wait = state->start + entry->timestamp - now;
+				struct timespec pause = {wait / 1000000000ULL, wait % 1000000000ULL};
+				nanosleep(&pause, NULL);
+			}
+		}
+		
+		uint64_t start = trace_clock();
+		long result = replay_entry(state, entry, buffer);
+		state->latencies[i] = (trace_clock() - start) / 1000.0;
+		
+		// handles and snapshot ids only have to agree on whether the call succeeded
+		int mismatch = (entry->operation == TRACE_FS_OPEN || entry->operation == TRACE_CREATE_SNAPSHOT) ? ((result < 0) != (entry->result < 0)) : (result != entry->result);
+		pthread_mutex_lock(&state->lock);
+		state->mismatches += mismatch;
+		state->bytes += (entry->operation != TRACE_LIST_FILES && entry->operation != TRACE_SCRUB_CORRUPT_BLOCKS) ? replay_buffer_size(entry) : 0;
+		pthread_mutex_unlock(&state->lock);
+	}
+	free(buffer);
+	return NULL;
+}
+
+// orders latencies from shortest to longest
+static int compare_latencies(const void * a, const void * b){
+	
+	double first = *(const double *) a;
+	double second = *(const double *) b;
+	return (first < second) ? -1 : (first > second);
+}
+
+// function to replay a trace written with trace_path against a volume, normally a copy of the traced volume
+// as it was when the trace started, with n_threads threads taking calls in trace order, and at the pace the calls
+// were traced if original_speed is set or as fast as possible otherwise
+// written data is not traced, so writes replay with filler bytes
+// returns 0 if successful and fills report
+// returns 1 if the trace cannot be read (or malloc error)
+int replay_trace(char * trace_path, int n_threads, int original_speed, fs_replay_report * report, void * helper) {
+	
+	replay_state state;
+	memset(&state, 0, sizeof(replay_state));
+	state.helper = helper;
+	state.original_speed = original_speed;
+	
+	// name id 0 is the empty name
+	state.names = calloc(1, 64);
+	if (state.names == NULL || load_trace(trace_path, &state) != 0){
+		free(state.names);
+		free(state.entries);
+		return 1;
+	}
+	state.latencies = malloc((state.number_of_entries + 1) * sizeof(double));
+	pthread_t * threads = malloc(((n_threads > 1) ? n_threads : 1) * sizeof(pthread_t));
+	if (state.latencies == NULL || threads == NULL){ // malloc error
+		free(state.names);
+		free(state.entries);
+		free(state.latencies);
+		free(threads);
+		return 1;
+	}
+	pthread_mutex_init(&state.lock, NULL);
+	
+	// this thread replays calls too
+	state.start = trace_clock();
+	int number_of_threads = 0;
+	while (number_of_threads < n_threads - 1){
+		if (pthread_create(&threads[number_of_threads], NULL, replay_worker, &state) != 0){
+			break;
+		}
+		number_of_threads++;
+	}
+	replay_worker(&state);
+	for (int i = 0; i < number_of_threads; i++){
+		pthread_join(threads[i], NULL);
+	}
+	double seconds = (trace_clock() - state.start) / 1e9;
+	
+	// latencies of the calls replayed, in order
+	memset(report, 0, sizeof(fs_replay_report));
+	double total_latency = 0;
+	for (int i = 0; i < state.number_of_entries; i++){
+		if (state.latencies[i] >= 0){
+			state.latencies[report->operations] = state.latencies[i];
+			total_latency += state.latencies[i];
+			report->operations++;
+		}
+	}
+	qsort(state.latencies, report->operations, sizeof(double), compare_latencies);
+	
+	report->skipped = state.number_of_entries - report->operations;
+	report->mismatches = state.mismatches;
+	report->bytes = state.bytes;
+	report->seconds = seconds;
+	if (seconds > 0){
+		report->operations_per_second = report->operations / seconds;
+		report->bytes_per_second = report->bytes / seconds;
+	}
+	if (report->operations > 0){
+		report->mean_latency = total_latency / report->operations;
+		report->p50_latency = state.latencies[(report->operations - 1) / 2];
+		report->p99_latency = state.latencies[((report->operations - 1) * 99) / 100];
+		report->max_latency = state.latencies[report->operations - 1];
+	}
+	
+	pthread_mutex_destroy(&state.lock);
+	free(state.names);
+	free(state.entries);
+	free(state.latencies);
+	free(state.handles);
+	free(state.snapshots);
+	free(threads);
+	return 0;
+}
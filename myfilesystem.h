@@ -3,10 +3,88 @@
 #include <sys/types.h>
 #include <stdint.h>
 
+// hash algorithms for fs_options.hash_algorithm
+#define FS_HASH_FLETCHER 0 // fletcher, the original format
+#define FS_HASH_CRC32C 1 // CRC32C, SSE4.2 accelerated where available, 32 bits of strength
+#define FS_HASH_FAST128 2 // fast 128 bit non-cryptographic hash
+
+// in-memory hash tree layouts for fs_options.tree_layout
+#define FS_LAYOUT_BREADTH_FIRST 0 // same order as hash_data
+#define FS_LAYOUT_BLOCKED 1 // subtrees packed into page and cache line sized groups
+
+// optional volume features for fs_options.features, combined with |
+#define FS_FEATURE_EXTENTS 0x1 // files can be split over several ranges of file_data instead of repacking
+#define FS_FEATURE_UNWRITTEN 0x2 // space for new files and growth reads as zeros without being written
+#define FS_FEATURE_COMPRESSION 0x4 // file_data is stored in independently compressed chunks where that saves space
+
+// when hash_data is brought up to date, for fs_options.hash_consistency
+#define FS_CONSISTENCY_IMMEDIATE 0 // every call leaves hash_data matching file_data
+#define FS_CONSISTENCY_DEFERRED 1 // calls only mark changed blocks, which are hashed when a read verifies them, by compute_hash_tree, sync_fs or close_fs
+
+// how a file is going to be read, for fs_advise
+#define FS_ADVICE_NORMAL 0 // read ahead once reads follow each other
+#define FS_ADVICE_SEQUENTIAL 1 // read ahead from the first read
+#define FS_ADVICE_RANDOM 2 // never read ahead
+#define FS_ADVICE_WILLNEED 3 // read the range ahead now, up to read_ahead_size bytes
+#define FS_ADVICE_DONTNEED 4 // drop what has been read ahead
+
+typedef struct fs_options{
+	size_t block_size; // bytes of file_data per hash tree leaf, power of 2 from 256 to 65536
+	int hash_algorithm; // one of the FS_HASH_ values
+	int tree_layout; // one of the FS_LAYOUT_ values, only affects memory so it is not recorded in the volume
+	int features; // FS_FEATURE_ flags
+	size_t write_back_size; // small writes to a file are held in memory until this many bytes are held, 0 writes straight away
+	int write_back_delay; // milliseconds a held write may wait before the next call writes it, 0 for no limit
+	int hash_consistency; // one of the FS_CONSISTENCY_ modes, only affects this session so it is not recorded in the volume
+	size_t scrub_rate; // bytes of file_data per second a background thread verifies against hash_data, 0 for no scrubber
+	int scrub_trust; // milliseconds after the scrubber finds a block correct that reads trust it without verifying, 0 always verifies
+	size_t background_rate; // bytes of file_data per second repack may move, giving way to reads and writes in between, 0 for no limit
+	char * trace_path; // file every call is recorded to, for replay_trace, NULL for no trace
+	char * span_path; // file close_fs writes the spans of every thread since the volume was mounted to in builds with FS_TRACE_SPANS, NULL for none
+	int shared_mount; // 1 lets processes on this machine mount the volume at once, sharing its hash tree and a lock; after another process creates, resizes, renames or deletes a file, the next call reads every directory_table entry again, which takes time in proportion to the size of directory_table
+	size_t read_ahead_size; // bytes read ahead of a file being read in order and checked against the hash tree ahead of time, 0 for no read-ahead
+	int direct_io; // 1 reads and writes file_data and hash_data with O_DIRECT through aligned buffers, bypassing the page cache where the file system allows it
+} fs_options;
+
+// filled by replay_trace, latencies are in microseconds
+typedef struct fs_replay_report{
+	size_t operations; // calls replayed
+	size_t skipped; // calls that cannot be replayed (import_file and export_file, whose host files are not traced)
+	size_t mismatches; // calls whose result differs from the traced one
+	size_t bytes; // bytes read and written
+	double seconds; // time the replay took
+	double operations_per_second;
+	double bytes_per_second;
+	double mean_latency;
+	double p50_latency;
+	double p99_latency;
+	double max_latency;
+} fs_replay_report;
+
+// filled by deduplicate
+typedef struct fs_dedup_report{
+	size_t blocks_scanned; // distinct whole blocks of file data looked at
+	size_t duplicate_blocks; // blocks found to hold the same bytes as another block and shared with it
+	size_t bytes_reclaimed; // bytes of file_data freed
+	double dedup_ratio; // bytes the files refer to divided by bytes of file_data in use, afterwards
+} fs_dedup_report;
+
+void fs_default_options(fs_options * options);
+
 void * init_fs(char * f1, char * f2, char * f3, int n_processors);
 
+void * init_fs_opts(char * f1, char * f2, char * f3, int n_processors, fs_options * options);
+
 void close_fs(void * helper);
 
+void sync_fs(void * helper);
+
+int scrub_fs(void * helper);
+
+int scrub_corrupt_blocks(size_t * blocks, int max, void * helper);
+
+long scrub_age(size_t block_offset, void * helper);
+
 int create_file(char * filename, size_t length, void * helper);
 
 int resize_file(char * filename, size_t length, void * helper);
@@ -17,16 +95,60 @@ int delete_file(char * filename, void * helper);
 
 int rename_file(char * oldname, char * newname, void * helper);
 
+int clone_file(char * src, char * dst, void * helper);
+
+int deduplicate(fs_dedup_report * report, void * helper);
+
 int read_file(char * filename, size_t offset, size_t count, void * buf, void * helper);
 
 int write_file(char * filename, size_t offset, size_t count, void * buf, void * helper);
 
+int import_file(char * host_path, char * filename, void * helper);
+
+int export_file(char * filename, char * host_path, int verify, void * helper);
+
 ssize_t file_size(char * filename, void * helper);
 
+int list_files(char * prefix, char * cursor, char (* out)[64], int max, void * helper);
+
+int fs_open(char * filename, void * helper);
+
+int fs_read(int handle, size_t offset, size_t count, void * buf, void * helper);
+
+int fs_write(int handle, size_t offset, size_t count, void * buf, void * helper);
+
+ssize_t fs_size(int handle, void * helper);
+
+int fs_close_handle(int handle, void * helper);
+
+int fs_advise(char * filename, size_t offset, size_t count, int advice, void * helper);
+
+int create_snapshot(void * helper);
+
+int delete_snapshot(int snapshot_id, void * helper);
+
+int read_snapshot_file(int snapshot_id, char * filename, size_t offset, size_t count, void * buf, void * helper);
+
+ssize_t snapshot_file_size(int snapshot_id, char * filename, void * helper);
+
 void fletcher(uint8_t * buf, size_t length, uint8_t * output);
 
 void compute_hash_tree(void * helper);
 
 void compute_hash_block(size_t block_offset, void * helper);
 
+int replay_trace(char * trace_path, int n_threads, int original_speed, fs_replay_report * report, void * helper);
+
+// only in builds with FS_COUNT_ALLOCATIONS, returns the number of heap allocations made so far
+#ifdef FS_COUNT_ALLOCATIONS
+size_t fs_allocation_count(void);
+#endif
+
+// only in builds with FS_TRACE_SPANS, writes the spans recorded by every thread to path as Chrome trace-event JSON
+// spans an earlier dump wrote and spans missing their begin or end are left out
+// returns 0 if successful, returns 1 if path cannot be written
+#ifdef FS_TRACE_SPANS
+int fs_dump_spans(char * path);
+#endif
+
 #endif
\ No newline at end of file
@@ -1,6 +1,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/wait.h>
 
 #define TEST(x) test(x, #x)
 #include "myfilesystem.h"
@@ -35,6 +39,21 @@ static int compareFiles(FILE *fp1, FILE *fp2)
     return error;
 } 
 
+// creates zero filled backing files for a fresh volume
+static void make_volume(char * f1, char * f2, char * f3, size_t data_size, size_t table_entries, size_t block_size){
+	void * zeros = calloc(1, data_size);
+	FILE * fp = fopen(f1, "w");
+	fwrite(zeros, data_size, 1, fp);
+	fclose(fp);
+	fp = fopen(f2, "w");
+	fwrite(zeros, 72, table_entries, fp);
+	fclose(fp);
+	fp = fopen(f3, "w");
+	fwrite(zeros, 16, (2 * (data_size / block_size)) - 1, fp);
+	fclose(fp);
+	free(zeros);
+}
+
 /* You are free to modify any part of this file. The only requirement is that when it is run, all your tests are automatically executed */
 
 /* Some example unit test functions */
@@ -255,6 +274,1226 @@ int fletcher_test(){
 	return return_value;
 }
 
+int block_size_test(){
+	int return_value = 0;
+	char f1[] = "file_data8.bin";
+	char f2[] = "directory_table8.bin";
+	char f3[] = "hash_data8.bin";
+	char name[] = "file1";
+	char name2[] = "file2";
+	char buffer[5];
+	make_volume(f1, f2, f3, 65536, 4, 4096);
+	
+	fs_options options;
+	fs_default_options(&options);
+	options.block_size = 4096;
+	void * helper = init_fs_opts(f1, f2, f3, 1, &options);
+	return_value += create_file(name, 5000, helper);
+	return_value += write_file(name, 4094, 5, "pasta", helper);
+	close_fs(helper);
+	
+	helper = init_fs(f1, f2, f3, 1); // block size should come from the volume record
+	return_value += read_file(name, 4094, 5, buffer, helper);
+	return_value += memcmp(buffer, "pasta", 5);
+	return_value += create_file(name2, 65536 - 5000, helper); // volume record uses no file_data space
+	close_fs(helper);
+	
+	FILE * hash_data = fopen(f3, "r");
+	fseek(hash_data, 0, SEEK_END);
+	if (ftell(hash_data) != 16 * 31){ // 16 blocks
+		return_value++;
+	}
+	fclose(hash_data);
+	
+	// a volume record from a later version of the format is refused
+	FILE * directory_table = fopen(f2, "r+");
+	char record[72];
+	int version = 2;
+	while (fread(record, 72, 1, directory_table) == 1 && memcmp(record, "\x01MYFSVOL", 8) != 0);
+	fseek(directory_table, -64, SEEK_CUR);
+	fwrite(&version, 4, 1, directory_table);
+	fclose(directory_table);
+	return_value += (init_fs(f1, f2, f3, 1) != NULL);
+	
+	// names starting like a volume or extent record would not be read back as files
+	char volume_name[] = "\x01MYFSVOL";
+	char extent_name[] = "\x02" "file";
+	make_volume(f1, f2, f3, 65536, 4, 256);
+	helper = init_fs(f1, f2, f3, 1);
+	return_value += (create_file(volume_name, 100, helper) != 1);
+	return_value += create_file(name, 100, helper);
+	return_value += (rename_file(name, extent_name, helper) != 1);
+	return_value += (clone_file(name, extent_name, helper) != 1);
+	close_fs(helper);
+	
+	// a volume holding files but no volume record was made with 256 byte blocks
+	options.block_size = 4096;
+	return_value += (init_fs_opts(f1, f2, f3, 1, &options) != NULL);
+	helper = init_fs(f1, f2, f3, 1);
+	return_value += read_file(name, 0, 5, buffer, helper);
+	close_fs(helper);
+	return return_value;
+}
+
+int hash_algorithm_test(){
+	int return_value = 0;
+	char f1[] = "file_data9.bin";
+	char f2[] = "directory_table9.bin";
+	char f3[] = "hash_data9.bin";
+	char name[] = "file1";
+	char buffer[5];
+	int algorithms[2] = {FS_HASH_CRC32C, FS_HASH_FAST128};
+	
+	for (int i = 0; i < 2; i++){
+		make_volume(f1, f2, f3, 4096, 4, 256);
+		
+		fs_options options;
+		fs_default_options(&options);
+		options.hash_algorithm = algorithms[i];
+		void * helper = init_fs_opts(f1, f2, f3, 1, &options);
+		return_value += create_file(name, 1000, helper);
+		return_value += write_file(name, 300, 5, "pizza", helper);
+		close_fs(helper);
+		
+		helper = init_fs(f1, f2, f3, 1); // hash algorithm should come from the volume record
+		return_value += read_file(name, 300, 5, buffer, helper);
+		return_value += memcmp(buffer, "pizza", 5);
+		close_fs(helper);
+	}
+	return return_value;
+}
+
+int tree_layout_test(){
+	int return_value = 0;
+	char f1[] = "file_data10.bin";
+	char f2[] = "directory_table10.bin";
+	char f3[] = "hash_data10.bin";
+	char f3_blocked[] = "hash_data10-1.bin";
+	char name[] = "file1";
+	char buffer[5];
+	
+	// hash_data must not depend on the in-memory layout
+	make_volume(f1, f2, f3, 1 << 20, 4, 256);
+	void * helper = init_fs(f1, f2, f3, 1);
+	return_value += create_file(name, 100000, helper);
+	return_value += write_file(name, 70000, 5, "pizza", helper);
+	close_fs(helper);
+	
+	make_volume(f1, f2, f3_blocked, 1 << 20, 4, 256);
+	fs_options options;
+	fs_default_options(&options);
+	options.tree_layout = FS_LAYOUT_BLOCKED;
+	helper = init_fs_opts(f1, f2, f3_blocked, 1, &options);
+	return_value += create_file(name, 100000, helper);
+	return_value += write_file(name, 70000, 5, "pizza", helper);
+	return_value += read_file(name, 70000, 5, buffer, helper);
+	return_value += memcmp(buffer, "pizza", 5);
+	close_fs(helper);
+	
+	// reads verify against hash_data, not just the tree loaded from it
+	helper = init_fs_opts(f1, f2, f3_blocked, 1, &options);
+	FILE * corrupt = fopen(f3_blocked, "r+");
+	fseek(corrupt, 16 * (4095 + (70000 / 256)), SEEK_SET); // leaf of the block holding byte 70000
+	fputc('x', corrupt);
+	fclose(corrupt);
+	return_value += (read_file(name, 70000, 5, buffer, helper) != 3);
+	close_fs(helper);
+	make_volume(f1, f2, f3_blocked, 1 << 20, 4, 256);
+	helper = init_fs_opts(f1, f2, f3_blocked, 1, &options);
+	return_value += create_file(name, 100000, helper);
+	return_value += write_file(name, 70000, 5, "pizza", helper);
+	close_fs(helper);
+	
+	FILE * hash_data = fopen(f3, "r");
+	FILE * hash_data_blocked = fopen(f3_blocked, "r");
+	return_value += compareFiles(hash_data, hash_data_blocked);
+	fclose(hash_data);
+	fclose(hash_data_blocked);
+	return return_value;
+}
+
+int extents_test(){
+	int return_value = 0;
+	char f1[] = "file_data11.bin";
+	char f2[] = "directory_table11.bin";
+	char f3[] = "hash_data11.bin";
+	char buffer[10];
+	
+	make_volume(f1, f2, f3, 1024, 8, 256);
+	fs_options options;
+	fs_default_options(&options);
+	options.features = FS_FEATURE_EXTENTS;
+	void * helper = init_fs_opts(f1, f2, f3, 1, &options);
+	return_value += create_file("a", 256, helper);
+	return_value += create_file("b", 256, helper);
+	return_value += create_file("c", 256, helper);
+	return_value += create_file("d", 256, helper);
+	return_value += write_file("b", 0, 5, "pizza", helper);
+	return_value += delete_file("a", helper);
+	return_value += delete_file("c", helper);
+	
+	// e fills both gaps without moving b
+	return_value += create_file("e", 512, helper);
+	return_value += write_file("e", 253, 10, "pizzapasta", helper);
+	return_value += read_file("e", 253, 10, buffer, helper);
+	return_value += memcmp(buffer, "pizzapasta", 10);
+	close_fs(helper);
+	
+	FILE * file_data = fopen(f1, "r");
+	fseek(file_data, 256, SEEK_SET);
+	fread(buffer, 5, 1, file_data);
+	fclose(file_data);
+	return_value += memcmp(buffer, "pizza", 5);
+	
+	// extents are restored when mounting again
+	helper = init_fs(f1, f2, f3, 1);
+	return_value += (file_size("e", helper) != 512);
+	return_value += read_file("e", 253, 10, buffer, helper);
+	return_value += memcmp(buffer, "pizzapasta", 10);
+	return_value += resize_file("e", 100, helper);
+	return_value += create_file("f", 412, helper);
+	close_fs(helper);
+	return return_value;
+}
+
+int snapshot_test(){
+	int return_value = 0;
+	char f1[] = "file_data12.bin";
+	char f2[] = "directory_table12.bin";
+	char f3[] = "hash_data12.bin";
+	char buffer[5];
+	
+	make_volume(f1, f2, f3, 2048, 8, 256);
+	void * helper = init_fs(f1, f2, f3, 1);
+	return_value += create_file("file1", 512, helper);
+	return_value += write_file("file1", 300, 5, "pizza", helper);
+	
+	int snapshot_id = create_snapshot(helper);
+	return_value += (snapshot_id < 0);
+	
+	// the snapshot keeps the old data after the file changes
+	return_value += write_file("file1", 300, 5, "pasta", helper);
+	return_value += resize_file("file1", 1000, helper);
+	return_value += read_snapshot_file(snapshot_id, "file1", 300, 5, buffer, helper);
+	return_value += memcmp(buffer, "pizza", 5);
+	return_value += (snapshot_file_size(snapshot_id, "file1", helper) != 512);
+	return_value += read_file("file1", 300, 5, buffer, helper);
+	return_value += memcmp(buffer, "pasta", 5);
+	
+	// the shared space is only freed once both are deleted
+	return_value += delete_file("file1", helper);
+	return_value += (create_file("file2", 2048, helper) != 2);
+	return_value += delete_snapshot(snapshot_id, helper);
+	return_value += (read_snapshot_file(snapshot_id, "file1", 0, 5, buffer, helper) != 1);
+	return_value += create_file("file2", 2048, helper);
+	close_fs(helper);
+	return return_value;
+}
+
+int clone_file_test(){
+	int return_value = 0;
+	char f1[] = "file_data13.bin";
+	char f2[] = "directory_table13.bin";
+	char f3[] = "hash_data13.bin";
+	char buffer[5];
+	
+	make_volume(f1, f2, f3, 2048, 8, 256);
+	void * helper = init_fs(f1, f2, f3, 1);
+	return_value += create_file("file1", 1024, helper);
+	return_value += write_file("file1", 600, 5, "pizza", helper);
+	return_value += clone_file("file1", "file2", helper);
+	return_value += (clone_file("file1", "file2", helper) != 1);
+	return_value += (clone_file("file3", "file4", helper) != 1);
+	
+	// the clone takes no space until it is written
+	return_value += create_file("file3", 1000, helper);
+	return_value += write_file("file2", 600, 5, "pasta", helper);
+	close_fs(helper);
+	
+	// sharing is restored when mounting again
+	helper = init_fs(f1, f2, f3, 1);
+	return_value += read_file("file1", 600, 5, buffer, helper);
+	return_value += memcmp(buffer, "pizza", 5);
+	return_value += read_file("file2", 600, 5, buffer, helper);
+	return_value += memcmp(buffer, "pasta", 5);
+	return_value += delete_file("file3", helper);
+	return_value += clone_file("file2", "file4", helper);
+	return_value += create_file("file5", 1000, helper);
+	return_value += (create_file("file6", 20, helper) != 2);
+	close_fs(helper);
+	return return_value;
+}
+
+int unwritten_test(){
+	int return_value = 0;
+	char f1[] = "file_data14.bin";
+	char f2[] = "directory_table14.bin";
+	char f3[] = "hash_data14.bin";
+	char buffer[5];
+	
+	// fill file_data with non zero bytes left over from earlier files
+	make_volume(f1, f2, f3, 1 << 16, 8, 256);
+	FILE * file_data = fopen(f1, "r+");
+	memset(buffer, 0xff, 5);
+	for (int i = 0; i < (1 << 16); i += 5){
+		fwrite(buffer, 1, ((1 << 16) - i < 5) ? (1 << 16) - i : 5, file_data);
+	}
+	fclose(file_data);
+	
+	fs_options options;
+	fs_default_options(&options);
+	options.features = FS_FEATURE_UNWRITTEN;
+	void * helper = init_fs_opts(f1, f2, f3, 1, &options);
+	compute_hash_tree(helper);
+	return_value += create_file("file1", 40000, helper);
+	return_value += write_file("file1", 20000, 5, "pizza", helper);
+	return_value += resize_file("file1", 60000, helper);
+	return_value += read_file("file1", 39998, 5, buffer, helper);
+	return_value += memcmp(buffer, "\0\0\0\0\0", 5);
+	close_fs(helper);
+	
+	// file_data outside the written bytes was never touched
+	file_data = fopen(f1, "r");
+	fseek(file_data, 10000, SEEK_SET);
+	fread(buffer, 5, 1, file_data);
+	fclose(file_data);
+	return_value += memcmp(buffer, "\xff\xff\xff\xff\xff", 5);
+	
+	helper = init_fs(f1, f2, f3, 1);
+	return_value += read_file("file1", 20000, 5, buffer, helper);
+	return_value += memcmp(buffer, "pizza", 5);
+	return_value += read_file("file1", 50000, 5, buffer, helper);
+	return_value += memcmp(buffer, "\0\0\0\0\0", 5);
+	close_fs(helper);
+	return return_value;
+}
+
+int compression_test(){
+	int return_value = 0;
+	char f1[] = "file_data15.bin";
+	char f2[] = "directory_table15.bin";
+	char f3[] = "hash_data15.bin";
+	char text[20000];
+	char buffer[20000];
+	for (int i = 0; i < 20000; i++){
+		text[i] = "pizza pasta "[i % 12];
+	}
+	
+	make_volume(f1, f2, f3, 1 << 16, 16, 256);
+	fs_options options;
+	fs_default_options(&options);
+	options.features = FS_FEATURE_COMPRESSION;
+	void * helper = init_fs_opts(f1, f2, f3, 1, &options);
+	compute_hash_tree(helper);
+	
+	// zero filled files take almost no space, so both fit in 64 KiB
+	return_value += create_file("file1", 40000, helper);
+	return_value += create_file("file2", 40000, helper);
+	return_value += write_file("file1", 10000, 20000, text, helper);
+	return_value += write_file("file1", 15000, 5, "PIZZA", helper);
+	close_fs(helper);
+	
+	helper = init_fs(f1, f2, f3, 1);
+	return_value += (file_size("file1", helper) != 40000);
+	return_value += read_file("file1", 10000, 20000, buffer, helper);
+	memcpy(text + 5000, "PIZZA", 5);
+	return_value += memcmp(buffer, text, 20000);
+	return_value += read_file("file2", 30000, 5, buffer, helper);
+	return_value += memcmp(buffer, "\0\0\0\0\0", 5);
+	return_value += resize_file("file1", 12000, helper);
+	return_value += read_file("file1", 11995, 5, buffer, helper);
+	return_value += memcmp(buffer, text + 1995, 5);
+	close_fs(helper);
+	return return_value;
+}
+
+int deduplicate_test(){
+	int return_value = 0;
+	char f1[] = "file_data16.bin";
+	char f2[] = "directory_table16.bin";
+	char f3[] = "hash_data16.bin";
+	char text[4096];
+	char buffer[4096];
+	for (int i = 0; i < 4096; i++){
+		text[i] = "pizza pasta "[i % 12];
+	}
+	
+	make_volume(f1, f2, f3, 1 << 14, 16, 256);
+	void * helper = init_fs(f1, f2, f3, 1);
+	compute_hash_tree(helper);
+	return_value += create_file("file1", 4096, helper);
+	return_value += create_file("file2", 4096, helper);
+	return_value += write_file("file1", 0, 4096, text, helper);
+	return_value += write_file("file2", 0, 4096, text, helper);
+	
+	// every block of file2 matches a block of file1 (the text repeats every 3 blocks so file1 shares within itself too)
+	fs_dedup_report report;
+	return_value += deduplicate(&report, helper);
+	return_value += (report.duplicate_blocks < 16);
+	return_value += (report.bytes_reclaimed < 4096);
+	return_value += (report.dedup_ratio < 2.0);
+	
+	// writing a shared block copies it
+	return_value += write_file("file2", 300, 5, "PIZZA", helper);
+	close_fs(helper);
+	
+	helper = init_fs(f1, f2, f3, 1);
+	return_value += read_file("file1", 0, 4096, buffer, helper);
+	return_value += memcmp(buffer, text, 4096);
+	return_value += read_file("file2", 0, 4096, buffer, helper);
+	memcpy(text + 300, "PIZZA", 5);
+	return_value += memcmp(buffer, text, 4096);
+	close_fs(helper);
+	return return_value;
+}
+
+int list_files_test(){
+	int return_value = 0;
+	char f1[] = "file_data17.bin";
+	char f2[] = "directory_table17.bin";
+	char f3[] = "hash_data17.bin";
+	char names[3][64];
+	
+	make_volume(f1, f2, f3, 1 << 12, 8, 256);
+	void * helper = init_fs(f1, f2, f3, 1);
+	compute_hash_tree(helper);
+	return_value += create_file("logs/b", 10, helper);
+	return_value += create_file("config", 10, helper);
+	return_value += create_file("logs/a", 10, helper);
+	return_value += create_file("logs/d", 10, helper);
+	return_value += create_file("logs/c", 10, helper);
+	return_value += rename_file("logs/d", "logz", helper);
+	return_value += delete_file("logs/a", helper);
+	
+	// pages of two names under the prefix, in order
+	return_value += (list_files("logs/", NULL, names, 2, helper) != 2);
+	return_value += strcmp(names[0], "logs/b") + strcmp(names[1], "logs/c");
+	return_value += (list_files("logs/", names[1], names, 2, helper) != 0);
+	close_fs(helper);
+	
+	// the index is built again from directory_table
+	helper = init_fs(f1, f2, f3, 1);
+	return_value += (list_files(NULL, "config", names, 3, helper) != 3);
+	return_value += strcmp(names[0], "logs/b") + strcmp(names[1], "logs/c") + strcmp(names[2], "logz");
+	close_fs(helper);
+	return return_value;
+}
+
+int write_back_test(){
+	int return_value = 0;
+	char f1[] = "file_data18.bin";
+	char f2[] = "directory_table18.bin";
+	char f3[] = "hash_data18.bin";
+	char record[10] = "record 00";
+	char buffer[1000];
+	
+	make_volume(f1, f2, f3, 1 << 12, 8, 256);
+	fs_options options;
+	fs_default_options(&options);
+	options.write_back_size = 4096;
+	void * helper = init_fs_opts(f1, f2, f3, 1, &options);
+	compute_hash_tree(helper);
+	return_value += create_file("log", 0, helper);
+	
+	// appends are held in memory, the file grows straight away
+	for (int i = 0; i < 100; i++){
+		record[7] = '0' + (i / 10);
+		record[8] = '0' + (i % 10);
+		return_value += write_file("log", i * 10, 10, record, helper);
+	}
+	return_value += (file_size("log", helper) != 1000);
+	FILE * file_data = fopen(f1, "r");
+	fread(buffer, 10, 1, file_data);
+	fclose(file_data);
+	return_value += (memcmp(buffer, "record 00", 10) == 0);
+	
+	// reading the range writes the held bytes first
+	return_value += read_file("log", 990, 10, buffer, helper);
+	return_value += memcmp(buffer, "record 99", 10);
+	return_value += write_file("log", 5, 3, "RRR", helper);
+	close_fs(helper);
+	
+	helper = init_fs(f1, f2, f3, 1);
+	return_value += read_file("log", 0, 20, buffer, helper);
+	return_value += memcmp(buffer, "recorRRR0\0record 01", 20);
+	close_fs(helper);
+	return return_value;
+}
+
+int deferred_hashing_test(){
+	int return_value = 0;
+	char f1[] = "file_data19.bin";
+	char f2[] = "directory_table19.bin";
+	char f3[] = "hash_data19.bin";
+	uint8_t before[16 * 31];
+	uint8_t after[16 * 31];
+	char buffer[100];
+	
+	make_volume(f1, f2, f3, 1 << 12, 8, 256);
+	fs_options options;
+	fs_default_options(&options);
+	options.hash_consistency = FS_CONSISTENCY_DEFERRED;
+	void * helper = init_fs_opts(f1, f2, f3, 1, &options);
+	compute_hash_tree(helper);
+	return_value += create_file("data", 1000, helper);
+	sync_fs(helper);
+	
+	// writes leave hash_data as it was until the hashes are needed
+	FILE * hash_data = fopen(f3, "r");
+	fread(before, sizeof(before), 1, hash_data);
+	fclose(hash_data);
+	return_value += write_file("data", 300, 3, "abc", helper);
+	return_value += write_file("data", 600, 3, "xyz", helper);
+	hash_data = fopen(f3, "r");
+	fread(after, sizeof(after), 1, hash_data);
+	fclose(hash_data);
+	return_value += memcmp(before, after, sizeof(before));
+	
+	// reading verifies the range, so its hashes are worked out first
+	return_value += read_file("data", 600, 3, buffer, helper);
+	return_value += memcmp(buffer, "xyz", 3);
+	
+	// after a sync hash_data matches a full rebuild
+	sync_fs(helper);
+	hash_data = fopen(f3, "r");
+	fread(before, sizeof(before), 1, hash_data);
+	fclose(hash_data);
+	compute_hash_tree(helper);
+	hash_data = fopen(f3, "r");
+	fread(after, sizeof(after), 1, hash_data);
+	fclose(hash_data);
+	return_value += memcmp(before, after, sizeof(before));
+	
+	// close_fs brings hash_data up to date for the next session
+	return_value += resize_file("data", 2000, helper);
+	return_value += write_file("data", 1500, 3, "end", helper);
+	close_fs(helper);
+	helper = init_fs(f1, f2, f3, 1);
+	return_value += read_file("data", 1500, 3, buffer, helper);
+	return_value += memcmp(buffer, "end", 3);
+	close_fs(helper);
+	return return_value;
+}
+
+int parallel_repack_test(){
+	int return_value = 0;
+	char f1[] = "file_data20.bin";
+	char f2[] = "directory_table20.bin";
+	char f3[] = "hash_data20.bin";
+	char name[] = "file0";
+	char buffer[1000];
+	char expected[1000];
+	
+	make_volume(f1, f2, f3, 1 << 14, 16, 256);
+	void * helper = init_fs(f1, f2, f3, 4);
+	compute_hash_tree(helper);
+	
+	// fill the volume with files and delete every other one
+	for (int i = 0; i < 10; i++){
+		name[4] = '0' + i;
+		memset(expected, 'a' + i, 1000);
+		return_value += create_file(name, 1000, helper);
+		return_value += write_file(name, 0, 1000, expected, helper);
+	}
+	for (int i = 0; i < 10; i += 2){
+		name[4] = '0' + i;
+		return_value += delete_file(name, helper);
+	}
+	
+	// the files left are moved together by several threads
+	repack(helper);
+	close_fs(helper);
+	
+	helper = init_fs(f1, f2, f3, 4);
+	for (int i = 1; i < 10; i += 2){
+		name[4] = '0' + i;
+		memset(expected, 'a' + i, 1000);
+		return_value += read_file(name, 0, 1000, buffer, helper);
+		return_value += memcmp(buffer, expected, 1000);
+	}
+	return_value += create_file("big", 10000, helper);
+	close_fs(helper);
+	return return_value;
+}
+
+int import_export_test(){
+	int return_value = 0;
+	char f1[] = "file_data21.bin";
+	char f2[] = "directory_table21.bin";
+	char f3[] = "hash_data21.bin";
+	char host[] = "host21.bin";
+	char exported[] = "host21_export.bin";
+	char data[3000];
+	char buffer[3000];
+	
+	for (int i = 0; i < 3000; i++){
+		data[i] = (char)(i * 7);
+	}
+	FILE * host_file = fopen(host, "w");
+	fwrite(data, 3000, 1, host_file);
+	fclose(host_file);
+	
+	make_volume(f1, f2, f3, 1 << 13, 8, 256);
+	void * helper = init_fs(f1, f2, f3, 1);
+	compute_hash_tree(helper);
+	
+	// the host file becomes a file of the same size and contents
+	return_value += import_file(host, "imported", helper);
+	return_value += (import_file(host, "imported", helper) != 1);
+	return_value += (file_size("imported", helper) != 3000);
+	return_value += read_file("imported", 0, 3000, buffer, helper);
+	return_value += memcmp(buffer, data, 3000);
+	
+	// and comes back out unchanged
+	return_value += export_file("imported", exported, 1, helper);
+	host_file = fopen(exported, "r");
+	return_value += (fread(buffer, 1, 3000, host_file) != 3000);
+	fclose(host_file);
+	return_value += memcmp(buffer, data, 3000);
+	return_value += (export_file("missing", exported, 0, helper) != 1);
+	close_fs(helper);
+	
+	// exporting with verification stops at a corrupted block
+	FILE * file_data = fopen(f1, "r+");
+	fseek(file_data, 1000, SEEK_SET);
+	fputc(data[1000] + 1, file_data);
+	fclose(file_data);
+	helper = init_fs(f1, f2, f3, 1);
+	return_value += (export_file("imported", exported, 1, helper) != 3);
+	return_value += export_file("imported", exported, 0, helper);
+	close_fs(helper);
+	return return_value;
+}
+
+int handle_test(){
+	int return_value = 0;
+	char f1[] = "file_data22.bin";
+	char f2[] = "directory_table22.bin";
+	char f3[] = "hash_data22.bin";
+	char buffer[100];
+	
+	make_volume(f1, f2, f3, 1 << 12, 8, 256);
+	void * helper = init_fs(f1, f2, f3, 1);
+	compute_hash_tree(helper);
+	return_value += create_file("first", 100, helper);
+	return_value += create_file("second", 100, helper);
+	
+	int handle = fs_open("first", helper);
+	return_value += (handle < 0);
+	return_value += (fs_open("missing", helper) != -1);
+	return_value += fs_write(handle, 0, 5, "hello", helper);
+	return_value += fs_read(handle, 0, 5, buffer, helper);
+	return_value += memcmp(buffer, "hello", 5);
+	
+	// growing past the next file moves it, the handle follows
+	return_value += fs_write(handle, 100, 5, "world", helper);
+	return_value += (fs_size(handle, helper) != 105);
+	return_value += fs_read(handle, 100, 5, buffer, helper);
+	return_value += memcmp(buffer, "world", 5);
+	return_value += read_file("first", 0, 5, buffer, helper);
+	return_value += memcmp(buffer, "hello", 5);
+	
+	// and follows a rename, but not a delete
+	return_value += rename_file("first", "renamed", helper);
+	return_value += (fs_size(handle, helper) != 105);
+	return_value += delete_file("renamed", helper);
+	return_value += (fs_size(handle, helper) != -1);
+	return_value += (fs_read(handle, 0, 5, buffer, helper) != 1);
+	return_value += fs_close_handle(handle, helper);
+	return_value += (fs_close_handle(handle, helper) != 1);
+	close_fs(helper);
+	return return_value;
+}
+
+int interned_names_test(){
+	int return_value = 0;
+	char f1[] = "file_data23.bin";
+	char f2[] = "directory_table23.bin";
+	char f3[] = "hash_data23.bin";
+	char long_name[64];
+	char names[4][64];
+	
+	memset(long_name, 'n', 63);
+	long_name[63] = '\0';
+	make_volume(f1, f2, f3, 1 << 12, 16, 256);
+	void * helper = init_fs(f1, f2, f3, 1);
+	compute_hash_tree(helper);
+	return_value += create_file(long_name, 10, helper);
+	return_value += create_file("a", 10, helper);
+	
+	// a snapshot keeps the old names of renamed and deleted files
+	int snapshot_id = create_snapshot(helper);
+	return_value += rename_file("a", "b", helper);
+	return_value += delete_file(long_name, helper);
+	return_value += create_file("c", 10, helper);
+	return_value += (snapshot_file_size(snapshot_id, long_name, helper) != 10);
+	return_value += (snapshot_file_size(snapshot_id, "a", helper) != 10);
+	return_value += (snapshot_file_size(snapshot_id, "b", helper) != -1);
+	return_value += delete_snapshot(snapshot_id, helper);
+	
+	// names freed are reused without mixing up files
+	return_value += create_file(long_name, 20, helper);
+	return_value += (list_files(NULL, NULL, names, 4, helper) != 3);
+	return_value += strcmp(names[0], "b");
+	return_value += strcmp(names[1], "c");
+	return_value += strcmp(names[2], long_name);
+	return_value += (file_size(long_name, helper) != 20);
+	close_fs(helper);
+	return return_value;
+}
+
+int allocation_free_test(){
+	int return_value = 0;
+	char f1[] = "file_data24.bin";
+	char f2[] = "directory_table24.bin";
+	char f3[] = "hash_data24.bin";
+	uint8_t data[1000];
+	uint8_t read_data[1000];
+	
+	for (int i = 0; i < 1000; i++){
+		data[i] = i * 7;
+	}
+	make_volume(f1, f2, f3, 1 << 14, 16, 1024);
+	void * helper = init_fs(f1, f2, f3, 1);
+	compute_hash_tree(helper);
+	return_value += create_file("a", 3000, helper);
+	return_value += create_file("b", 100, helper);
+	int handle = fs_open("a", helper);
+	
+	// the first calls set up the scratch arena, the same calls again allocate nothing
+	for (int round = 0; round < 3; round++){
+	#ifdef FS_COUNT_ALLOCATIONS
+		size_t allocations = fs_allocation_count();
+	#endif
+		return_value += write_file("a", 500, 1000, data, helper);
+		return_value += read_file("a", 500, 1000, read_data, helper);
+		return_value += memcmp(data, read_data, 1000);
+		return_value += fs_write(handle, 1500, 1000, data, helper);
+		return_value += fs_read(handle, 1500, 1000, read_data, helper);
+		return_value += memcmp(data, read_data, 1000);
+		compute_hash_block(1, helper);
+	#ifdef FS_COUNT_ALLOCATIONS
+		if (round > 0){
+			return_value += (fs_allocation_count() != allocations);
+		}
+	#endif
+	}
+	
+	// nodes of deleted files are used again
+	return_value += delete_file("b", helper);
+	return_value += create_file("c", 100, helper);
+	return_value += (file_size("c", helper) != 100);
+	return_value += fs_close_handle(handle, helper);
+	close_fs(helper);
+	return return_value;
+}
+
+int scrub_test(){
+	int return_value = 0;
+	char f1[] = "file_data25.bin";
+	char f2[] = "directory_table25.bin";
+	char f3[] = "hash_data25.bin";
+	uint8_t data[1000];
+	size_t blocks[4];
+	
+	for (int i = 0; i < 1000; i++){
+		data[i] = i * 3;
+	}
+	make_volume(f1, f2, f3, 1 << 12, 8, 256);
+	fs_options options;
+	fs_default_options(&options);
+	options.scrub_trust = 60000;
+	void * helper = init_fs_opts(f1, f2, f3, 1, &options);
+	compute_hash_tree(helper);
+	return_value += create_file("data", 1000, helper);
+	return_value += write_file("data", 0, 1000, data, helper);
+	return_value += (scrub_fs(helper) != 0);
+	return_value += (scrub_age(0, helper) < 0);
+	
+	// corrupt block 1 behind the file system's back, reads trust the scrubbed block
+	FILE * file_data = fopen(f1, "r+");
+	fseek(file_data, 300, SEEK_SET);
+	fputc(data[300] + 1, file_data);
+	fclose(file_data);
+	return_value += read_file("data", 0, 1000, data, helper);
+	
+	// the next scrub finds it, and reads verify the block again
+	return_value += (scrub_fs(helper) != 1);
+	return_value += (scrub_corrupt_blocks(blocks, 4, helper) != 1);
+	return_value += (blocks[0] != 1);
+	return_value += (scrub_age(0, helper) != -1);
+	return_value += (read_file("data", 0, 1000, data, helper) != 3);
+	
+	// writing the block again makes it correct
+	for (int i = 0; i < 1000; i++){
+		data[i] = i * 3;
+	}
+	return_value += write_file("data", 0, 1000, data, helper);
+	return_value += (scrub_fs(helper) != 0);
+	return_value += (scrub_corrupt_blocks(blocks, 4, helper) != 0);
+	close_fs(helper);
+	
+	// the background scrubber gets to every block on its own
+	options.scrub_trust = 0;
+	options.scrub_rate = 1 << 20;
+	helper = init_fs_opts(f1, f2, f3, 1, &options);
+	struct timespec pause = {0, 1000000};
+	for (int i = 0; i < 5000 && scrub_age(15, helper) < 0; i++){
+		nanosleep(&pause, NULL);
+	}
+	return_value += (scrub_age(15, helper) < 0);
+	return_value += read_file("data", 0, 1000, data, helper);
+	close_fs(helper);
+	return return_value;
+}
+
+// repacks the volume given as argument, for io_scheduler_test
+static void * repack_thread(void * helper){
+	repack(helper);
+	return NULL;
+}
+
+int io_scheduler_test(){
+	int return_value = 0;
+	char f1[] = "file_data26.bin";
+	char f2[] = "directory_table26.bin";
+	char f3[] = "hash_data26.bin";
+	char name[16];
+	uint8_t data[4096];
+	uint8_t read_data[4096];
+	
+	make_volume(f1, f2, f3, 1 << 20, 64, 256);
+	fs_options options;
+	fs_default_options(&options);
+	options.background_rate = 1 << 22;
+	void * helper = init_fs_opts(f1, f2, f3, 1, &options);
+	compute_hash_tree(helper);
+	
+	// leave a gap before every other file so repacking has data to move
+	for (int i = 0; i < 32; i++){
+		sprintf(name, "file%d", i);
+		memset(data, i, sizeof(data));
+		return_value += create_file(name, sizeof(data), helper);
+		return_value += write_file(name, 0, sizeof(data), data, helper);
+	}
+	for (int i = 0; i < 32; i += 2){
+		sprintf(name, "file%d", i);
+		return_value += delete_file(name, helper);
+	}
+	
+	// reads and writes go on while the volume is repacked
+	pthread_t thread;
+	pthread_create(&thread, NULL, repack_thread, helper);
+	for (int round = 0; round < 20; round++){
+		for (int i = 1; i < 32; i += 2){
+			sprintf(name, "file%d", i);
+			memset(data, i + round, 100);
+			memset(data + 100, i, sizeof(data) - 100);
+			return_value += write_file(name, 0, 100, data, helper);
+			return_value += read_file(name, 0, sizeof(data), read_data, helper);
+			return_value += memcmp(data, read_data, sizeof(data));
+		}
+	}
+	pthread_join(thread, NULL);
+	
+	// every file is still correct afterwards
+	for (int i = 1; i < 32; i += 2){
+		sprintf(name, "file%d", i);
+		return_value += read_file(name, 0, sizeof(data), read_data, helper);
+		return_value += (read_data[sizeof(data) - 1] != i);
+	}
+	return_value += (scrub_fs(helper) != 0);
+	close_fs(helper);
+	return return_value;
+}
+
+int trace_replay_test(){
+	int return_value = 0;
+	char f1[] = "file_data27.bin";
+	char f2[] = "directory_table27.bin";
+	char f3[] = "hash_data27.bin";
+	char trace[] = "trace27.bin";
+	char buffer[5];
+	char names[4][64];
+	fs_replay_report report;
+	
+	// trace 15 calls, one of them an export that replays skip
+	make_volume(f1, f2, f3, 4096, 8, 256);
+	fs_options options;
+	fs_default_options(&options);
+	options.trace_path = trace;
+	void * helper = init_fs_opts(f1, f2, f3, 1, &options);
+	return_value += create_file("file1", 512, helper);
+	return_value += write_file("file1", 300, 5, "pizza", helper);
+	int snapshot_id = create_snapshot(helper);
+	return_value += (snapshot_id < 0);
+	return_value += rename_file("file1", "file2", helper);
+	return_value += (read_snapshot_file(snapshot_id, "file1", 300, 5, buffer, helper) != 0);
+	int handle = fs_open("file2", helper);
+	return_value += (handle < 0);
+	return_value += fs_write(handle, 510, 5, "pasta", helper);
+	return_value += (fs_size(handle, helper) != 515);
+	return_value += fs_close_handle(handle, helper);
+	return_value += (read_file("missing", 0, 5, buffer, helper) != 1);
+	return_value += (list_files(NULL, NULL, names, 4, helper) != 1);
+	return_value += (export_file("file2", "/nonexistent/trace27", 0, helper) == 0);
+	return_value += delete_snapshot(snapshot_id, helper);
+	return_value += create_file("file3", 100, helper);
+	return_value += delete_file("file2", helper);
+	close_fs(helper);
+	
+	// replaying on a copy of the volume as it was gets the same results
+	make_volume(f1, f2, f3, 4096, 8, 256);
+	helper = init_fs(f1, f2, f3, 1);
+	return_value += replay_trace(trace, 1, 0, &report, helper);
+	return_value += (report.operations != 14);
+	return_value += (report.skipped != 1);
+	return_value += (report.mismatches != 0);
+	return_value += (report.bytes != 20);
+	return_value += (report.p50_latency > report.max_latency);
+	return_value += (file_size("file2", helper) != -1);
+	return_value += (file_size("file3", helper) != 100);
+	close_fs(helper);
+	
+	// and with several threads at the pace the calls were made
+	make_volume(f1, f2, f3, 4096, 8, 256);
+	helper = init_fs(f1, f2, f3, 1);
+	return_value += replay_trace(trace, 4, 1, &report, helper);
+	return_value += (report.operations != 14);
+	close_fs(helper);
+	
+	return_value += (replay_trace("trace_missing.bin", 1, 0, &report, NULL) != 1);
+	return return_value;
+}
+
+int span_test(){
+	int return_value = 0;
+	char f1[] = "file_data28.bin";
+	char f2[] = "directory_table28.bin";
+	char f3[] = "hash_data28.bin";
+	char spans[] = "spans28.json";
+	uint8_t data[1000];
+	
+	memset(data, 7, sizeof(data));
+	remove(spans);
+	make_volume(f1, f2, f3, 1 << 12, 8, 256);
+	fs_options options;
+	fs_default_options(&options);
+	options.span_path = spans;
+	void * helper = init_fs_opts(f1, f2, f3, 1, &options);
+	return_value += create_file("a", 100, helper);
+	return_value += write_file("a", 0, 1000, data, helper);
+	return_value += read_file("a", 0, 1000, data, helper);
+	repack(helper);
+	close_fs(helper);
+	
+	// spans are only written by builds with FS_TRACE_SPANS
+	FILE * output = fopen(spans, "r");
+#ifdef FS_TRACE_SPANS
+	// the dump only holds whole spans since the volume was mounted, whatever ran before
+	long size = 0;
+	if (output != NULL){
+		fseek(output, 0, SEEK_END);
+		size = ftell(output);
+		fseek(output, 0, SEEK_SET);
+	}
+	char * text = calloc(1, size + 1);
+	size_t length = (output != NULL) ? fread(text, 1, size, output) : 0;
+	text[length] = '\0';
+	return_value += (strncmp(text, "{\"traceEvents\":[", 16) != 0);
+	return_value += (strstr(text, "\"name\":\"write_file\",\"ph\":\"B\"") == NULL);
+	return_value += (strstr(text, "\"name\":\"resize_file_helper\",\"ph\":\"E\"") == NULL);
+	return_value += (strstr(text, "\"name\":\"lock wait\"") == NULL);
+	int begins = 0;
+	int ends = 0;
+	for (char * event = strstr(text, "\"ph\":\""); event != NULL; event = strstr(event + 1, "\"ph\":\"")){
+		begins += (event[6] == 'B');
+		ends += (event[6] == 'E');
+	}
+	return_value += (begins == 0 || begins != ends);
+	free(text);
+	
+	// spans already dumped are not dumped again
+	return_value += fs_dump_spans(spans);
+	fclose(output);
+	output = fopen(spans, "r");
+	char again[1 << 12];
+	length = fread(again, 1, sizeof(again) - 1, output);
+	again[length] = '\0';
+	return_value += (strstr(again, "\"name\":\"write_file\"") != NULL);
+	return_value += (fs_dump_spans("/nonexistent/spans28.json") != 1);
+#else
+	return_value += (output != NULL);
+#endif
+	if (output != NULL){
+		fclose(output);
+	}
+	return return_value;
+}
+
+int shared_mount_test(){
+	int return_value = 0;
+	char f1[] = "file_data29.bin";
+	char f2[] = "directory_table29.bin";
+	char f3[] = "hash_data29.bin";
+	char name[16];
+	uint8_t data[500];
+	uint8_t read_data[500];
+	
+	make_volume(f1, f2, f3, 1 << 16, 64, 256);
+	remove("directory_table29.bin.mount");
+	fs_options options;
+	fs_default_options(&options);
+	options.shared_mount = 1;
+	void * helper = init_fs_opts(f1, f2, f3, 1, &options);
+	compute_hash_tree(helper);
+	return_value += create_file("parent", 500, helper);
+	int handle = fs_open("parent", helper);
+	
+	// another process mounts the volume at the same time, and both write their own files
+	pid_t child = fork();
+	if (child == 0){
+		int failed = 0;
+		void * child_helper = init_fs_opts(f1, f2, f3, 1, &options);
+		failed += (child_helper == NULL);
+		for (int i = 0; i < 20 && child_helper != NULL; i++){
+			sprintf(name, "child%d", i);
+			memset(data, i, sizeof(data));
+			failed += create_file(name, sizeof(data), child_helper);
+			failed += write_file(name, 0, sizeof(data), data, child_helper);
+		}
+		failed += (file_size("parent", child_helper) != 500);
+		failed += rename_file("parent", "renamed", child_helper);
+		close_fs(child_helper);
+		_exit(failed);
+	}
+	for (int i = 0; i < 20; i++){
+		memset(data, 100 + i, sizeof(data));
+		return_value += write_file("parent", 0, sizeof(data), data, helper);
+	}
+	int status = 0;
+	waitpid(child, &status, 0);
+	return_value += (!WIFEXITED(status) || WEXITSTATUS(status) != 0);
+	
+	// changes made by the other process are seen, and the handle follows the renamed file
+	return_value += (file_size("parent", helper) != -1);
+	return_value += fs_read(handle, 0, sizeof(data), read_data, helper);
+	return_value += memcmp(data, read_data, sizeof(data));
+	for (int i = 0; i < 20; i++){
+		sprintf(name, "child%d", i);
+		memset(data, i, sizeof(data));
+		return_value += read_file(name, 0, sizeof(data), read_data, helper);
+		return_value += memcmp(data, read_data, sizeof(data));
+	}
+	
+	// a write that leaves the file lists alone is seen too
+	child = fork();
+	if (child == 0){
+		void * child_helper = init_fs_opts(f1, f2, f3, 1, &options);
+		memset(data, 200, sizeof(data));
+		int failed = (child_helper == NULL) || write_file("child0", 0, sizeof(data), data, child_helper) != 0;
+		close_fs(child_helper);
+		_exit(failed);
+	}
+	waitpid(child, &status, 0);
+	return_value += (!WIFEXITED(status) || WEXITSTATUS(status) != 0);
+	memset(data, 200, sizeof(data));
+	return_value += read_file("child0", 0, sizeof(data), read_data, helper);
+	return_value += memcmp(data, read_data, sizeof(data));
+	
+	// so is a rename, the only change the other process makes
+	return_value += file_size("child1", helper) != 500;
+	child = fork();
+	if (child == 0){
+		void * child_helper = init_fs_opts(f1, f2, f3, 1, &options);
+		int failed = (child_helper == NULL) || rename_file("child1", "moved", child_helper) != 0;
+		close_fs(child_helper);
+		_exit(failed);
+	}
+	waitpid(child, &status, 0);
+	return_value += (!WIFEXITED(status) || WEXITSTATUS(status) != 0);
+	return_value += (file_size("child1", helper) != -1);
+	return_value += (file_size("moved", helper) != 500);
+	
+	// a handle to a file the other process deletes does not follow a new file given the same directory_table entry
+	int deleted_handle = fs_open("child2", helper);
+	child = fork();
+	if (child == 0){
+		void * child_helper = init_fs_opts(f1, f2, f3, 1, &options);
+		memset(data, 50, sizeof(data));
+		int failed = (child_helper == NULL) || delete_file("child2", child_helper) != 0;
+		failed += create_file("z", sizeof(data), child_helper);
+		failed += write_file("z", 0, sizeof(data), data, child_helper);
+		close_fs(child_helper);
+		_exit(failed);
+	}
+	waitpid(child, &status, 0);
+	return_value += (!WIFEXITED(status) || WEXITSTATUS(status) != 0);
+	return_value += (fs_read(deleted_handle, 0, sizeof(data), read_data, helper) == 0);
+	return_value += (fs_size(deleted_handle, helper) != -1);
+	return_value += read_file("z", 0, sizeof(data), read_data, helper);
+	return_value += fs_close_handle(deleted_handle, helper);
+	return_value += (create_snapshot(helper) != -1);
+	return_value += (scrub_fs(helper) != 0);
+	close_fs(helper);
+	
+	// hash_data matches file_data for a later mount of its own
+	helper = init_fs(f1, f2, f3, 1);
+	return_value += read_file("renamed", 0, sizeof(data), read_data, helper);
+	return_value += (scrub_fs(helper) != 0);
+	close_fs(helper);
+	return return_value;
+}
+
+int read_ahead_test(){
+	int return_value = 0;
+	char f1[] = "file_data30.bin";
+	char f2[] = "directory_table30.bin";
+	char f3[] = "hash_data30.bin";
+	static uint8_t data[65536];
+	uint8_t buf[4096];
+	
+	for (int i = 0; i < 65536; i++){
+		data[i] = (i * 7 + i / 256) % 251;
+	}
+	make_volume(f1, f2, f3, 1 << 17, 8, 256);
+	fs_options options;
+	fs_default_options(&options);
+	options.read_ahead_size = 16384;
+	void * helper = init_fs_opts(f1, f2, f3, 1, &options);
+	compute_hash_tree(helper);
+	return_value += create_file("a", 65536, helper);
+	return_value += write_file("a", 0, 65536, data, helper);
+	return_value += read_file("a", 0, 4096, buf, helper);
+	return_value += (memcmp(buf, data, 4096) != 0);
+	
+	// corrupt a late block behind the file system's back, reading in order only verifies the windows read ahead,
+	// which reach the block from reads after 43520
+	FILE * file_data = fopen(f1, "r+");
+	fseek(file_data, 60000, SEEK_SET);
+	fputc(data[60000] + 1, file_data);
+	fclose(file_data);
+	
+	for (size_t offset = 4096; offset <= 40960; offset += 4096){
+		if (offset == 20480){ // a write reading ahead has passed is seen by the next read
+			memset(data + 20000, 9, 1000);
+			return_value += write_file("a", 20000, 1000, data + 20000, helper);
+		}
+		return_value += read_file("a", offset, 4096, buf, helper);
+		return_value += (memcmp(buf, data + offset, 4096) != 0);
+		if (offset == 32768){ // an empty read needs no buffer, even inside a window read ahead
+			return_value += read_file("a", offset, 0, NULL, helper);
+		}
+	}
+	return_value += (read_file("a", 57344, 4096, buf, helper) != 3);
+	
+	// reads of a file advised to be read randomly verify the whole file
+	return_value += fs_advise("a", 0, 0, FS_ADVICE_RANDOM, helper);
+	return_value += (read_file("a", 4096, 4096, buf, helper) != 3);
+	return_value += fs_advise("a", 0, 0, FS_ADVICE_DONTNEED, helper);
+	return_value += fs_advise("a", 0, 4096, FS_ADVICE_WILLNEED, helper);
+	return_value += (fs_advise("missing", 0, 0, FS_ADVICE_SEQUENTIAL, helper) != 1);
+	return_value += (fs_advise("a", 0, 0, 7, helper) != 1);
+	close_fs(helper);
+	return return_value;
+}
+
+int direct_io_test(){
+	int return_value = 0;
+	char f1[] = "file_data31.bin";
+	char f2[] = "directory_table31.bin";
+	char f3[] = "hash_data31.bin";
+	uint8_t data[10000];
+	uint8_t buf[10050];
+	
+	for (int i = 0; i < 10000; i++){
+		data[i] = (i * 13) % 251;
+	}
+	make_volume(f1, f2, f3, 1 << 16, 8, 256);
+	fs_options options;
+	fs_default_options(&options);
+	options.direct_io = 1;
+	void * helper = init_fs_opts(f1, f2, f3, 1, &options);
+	compute_hash_tree(helper);
+	
+	// writes and reads not on aligned boundaries are read, changed and written a whole aligned unit at a time
+	return_value += create_file("a", 3000, helper);
+	return_value += create_file("b", 100, helper);
+	return_value += write_file("a", 1000, 2000, data, helper);
+	return_value += write_file("b", 50, 10000, data, helper);
+	return_value += write_file("a", 1500, 3, data + 500, helper);
+	return_value += read_file("a", 1000, 2000, buf, helper);
+	return_value += (memcmp(buf, data, 2000) != 0);
+	return_value += read_file("b", 50, 10000, buf, helper);
+	return_value += (memcmp(buf, data, 10000) != 0);
+	repack(helper);
+	return_value += read_file("b", 0, 10050, buf, helper);
+	close_fs(helper);
+	
+	// file_data and hash_data are the same as without direct_io
+	helper = init_fs(f1, f2, f3, 1);
+	return_value += read_file("a", 2000, 1000, buf, helper);
+	return_value += (memcmp(buf, data + 1000, 1000) != 0);
+	return_value += read_file("b", 50, 10000, buf, helper);
+	return_value += (memcmp(buf, data, 10000) != 0);
+	close_fs(helper);
+	return return_value;
+}
+
+int write_back_space_test(){
+	int return_value = 0;
+	char f1[] = "file_data32.bin";
+	char f2[] = "directory_table32.bin";
+	char f3[] = "hash_data32.bin";
+	char * names[2] = {"b", "a"};
+	size_t lengths[2] = {2000, 2000};
+	uint8_t data[2200];
+	uint8_t buf[2200];
+	
+	for (int i = 0; i < 2200; i++){
+		data[i] = (i * 11) % 251;
+	}
+	make_volume(f1, f2, f3, 1 << 12, 8, 256);
+	fs_options options;
+	fs_default_options(&options);
+	options.write_back_size = 4096;
+	void * helper = init_fs_opts(f1, f2, f3, 1, &options);
+	compute_hash_tree(helper);
+	return_value += create_file("a", 2000, helper);
+	return_value += write_file("a", 0, 2000, data, helper);
+	return_value += clone_file("a", "b", helper);
+	
+	// small appends to a file sharing all its bytes are only acknowledged while it could move to free space,
+	// first to the clone, then to the source once a snapshot shares it
+	for (int i = 0; i < 2; i++){
+		if (i == 1){
+			return_value += (create_snapshot(helper) < 0);
+		}
+		for (int j = 0; j < 20; j++){
+			int written = write_file(names[i], lengths[i], 10, data + lengths[i], helper);
+			if (written == 0){
+				lengths[i] += 10;
+			}
+			else{
+				return_value += (written != 3);
+				break;
+			}
+		}
+	}
+	return_value += (lengths[0] == 2000 || lengths[0] == 2200);
+	close_fs(helper);
+	
+	// every acknowledged write is there after the volume is opened again
+	helper = init_fs(f1, f2, f3, 1);
+	for (int i = 0; i < 2; i++){
+		return_value += (file_size(names[i], helper) != (ssize_t)lengths[i]);
+		return_value += read_file(names[i], 0, lengths[i], buf, helper);
+		return_value += (memcmp(buf, data, lengths[i]) != 0);
+	}
+	close_fs(helper);
+	return return_value;
+}
+
 /****************************/
 
 /* Helper function */
@@ -285,6 +1524,31 @@ int main(int argc, char * argv[]) {
 	TEST(compute_hash_tree_test);
 	TEST(compute_hash_block_test);
 	TEST(fletcher_test);
+	TEST(block_size_test);
+	TEST(hash_algorithm_test);
+	TEST(tree_layout_test);
+	TEST(extents_test);
+	TEST(snapshot_test);
+	TEST(clone_file_test);
+	TEST(unwritten_test);
+	TEST(compression_test);
+	TEST(deduplicate_test);
+	TEST(list_files_test);
+	TEST(write_back_test);
+	TEST(deferred_hashing_test);
+	TEST(parallel_repack_test);
+	TEST(import_export_test);
+	TEST(handle_test);
+	TEST(interned_names_test);
+	TEST(allocation_free_test);
+	TEST(scrub_test);
+	TEST(io_scheduler_test);
+	TEST(trace_replay_test);
+	TEST(span_test);
+	TEST(shared_mount_test);
+	TEST(read_ahead_test);
+	TEST(direct_io_test);
+	TEST(write_back_space_test);
     // Add more tests here
 
     return 0;